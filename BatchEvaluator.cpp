@@ -0,0 +1,295 @@
+#include "BatchEvaluator.h"
+#include "TraceRecorder.h"
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <sched.h>
+
+/*
+ * Helper function that reads a list of cores or nodes in the format of
+ * /sys (e.g. "0-3,8-11") from the file at path. It returns an empty list if
+ * the file can't be read.
+ */
+vector<int> readCpuList(const string & path) {
+	vector<int> list;
+	std::ifstream in(path.c_str());
+	string text;
+	if (!std::getline(in, text))
+		return list;
+	std::stringstream ranges(text);
+	string range;
+	while (std::getline(ranges, range, ',')) {
+		if (range.empty())
+			continue;
+		size_t dash = range.find('-');
+		int first = atoi(range.substr(0, dash).c_str());
+		int last = dash == string::npos ? first : atoi(range.substr(dash + 1).c_str());
+		for (int i = first; i <= last; i++)
+			list.push_back(i);
+	}
+	return list;
+}
+
+/*
+ * Constructor that finds the NUMA nodes and starts the workers of each,
+ * threadsPerNode of them, or one for each of its cores if that is 0.
+ */
+BatchEvaluator::BatchEvaluator(int threadsPerNode) {
+	job = NULL;
+	jobNode = -1;
+	generation = 0;
+	running = 0;
+	stopping = false;
+	findNodes();
+	for (size_t n = 0; n < nodes.size(); n++) {
+		int count = threadsPerNode > 0 ? threadsPerNode : nodes[n].cpus.size();
+		for (int w = 0; w < count; w++)
+			nodes[n].workers.push_back(std::thread(&BatchEvaluator::work, this, (int)n, w));
+	}
+}
+
+/*
+ * Destructor that stops the workers and waits for them to finish.
+ */
+BatchEvaluator::~BatchEvaluator() {
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		stopping = true;
+	}
+	start.notify_all();
+	for (size_t n = 0; n < nodes.size(); n++)
+		for (size_t w = 0; w < nodes[n].workers.size(); w++)
+			nodes[n].workers[w].join();
+}
+
+/*
+ * Sets up the NUMA nodes and their cores.
+ *
+ * Algorithm:
+ * Find the cores the process may run on (a container or taskset may leave
+ * out some of them).
+ * For each node listed in /sys/devices/system/node/online, read its cores
+ * from its cpulist and keep the ones the process may run on. Nodes with
+ * none left (e.g. nodes with memory but no cores) are left out.
+ * If no nodes were found, use one node, numbered -1, with all the cores.
+ */
+void BatchEvaluator::findNodes() {
+	vector<int> allowed;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+		for (int c = 0; c < CPU_SETSIZE; c++)
+			if (CPU_ISSET(c, &set))
+				allowed.push_back(c);
+	} else {
+		for (unsigned c = 0; c < std::thread::hardware_concurrency(); c++)
+			allowed.push_back(c);
+	}
+	if (allowed.empty())
+		allowed.push_back(0);
+
+	vector<int> ids = readCpuList("/sys/devices/system/node/online");
+	for (size_t i = 0; i < ids.size(); i++) {
+		std::stringstream path;
+		path << "/sys/devices/system/node/node" << ids[i] << "/cpulist";
+		vector<int> cpus = readCpuList(path.str());
+		Node node;
+		node.id = ids[i];
+		for (size_t c = 0; c < cpus.size(); c++)
+			for (size_t a = 0; a < allowed.size(); a++)
+				if (cpus[c] == allowed[a])
+					node.cpus.push_back(cpus[c]);
+		if (!node.cpus.empty())
+			nodes.push_back(std::move(node));
+	}
+
+	if (nodes.empty()) {
+		Node node;
+		node.id = -1;
+		node.cpus = allowed;
+		nodes.push_back(std::move(node));
+	}
+}
+
+/*
+ * The loop of worker w of node n.
+ * It pins itself to the cores of its node and allocates its nodes from an
+ * arena bound to the node's memory. Then it waits for jobs, runs the ones
+ * for its node, and counts itself done, until the evaluator is stopped.
+ * An exception from a job is caught and kept for run to throw on the
+ * calling thread, so the worker still counts itself done.
+ * The arena goes away with the worker, so trees a job leaves behind must
+ * be deleted before the evaluator is.
+ */
+void BatchEvaluator::work(int n, int w) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (size_t c = 0; c < nodes[n].cpus.size(); c++)
+		CPU_SET(nodes[n].cpus[c], &set);
+	sched_setaffinity(0, sizeof(set), &set); //If this fails, the worker just isn't pinned.
+	NodeArena arena(nodes[n].id);
+	NodeArena::use(&arena);
+
+	long seen = 0;
+	while (true) {
+		const Job * next;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			start.wait(guard, [this, seen]() { return stopping || generation != seen; });
+			if (stopping)
+				break;
+			seen = generation;
+			if (jobNode != -1 && jobNode != n)
+				continue;
+			next = job;
+		}
+		std::exception_ptr thrown;
+		try {
+			(*next)(n, w);
+		} catch (...) {
+			thrown = std::current_exception();
+		}
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			if (thrown && !failure)
+				failure = thrown;
+			if (--running == 0)
+				done.notify_all();
+		}
+	}
+	NodeArena::use(NULL);
+}
+
+/*
+ * Runs j on every worker of node n (an index, as for workerCount), or on
+ * every worker if n is -1, and waits until they have all finished it.
+ * While it runs, each worker's TreeNodes come from its own arena.
+ * One job runs at a time, so this waits for any other caller's job first.
+ * If j threw on any worker, the first exception is thrown here once every
+ * worker has finished.
+ */
+void BatchEvaluator::run(int n, const Job & j) {
+	std::unique_lock<std::mutex> turn(runLock);
+	std::unique_lock<std::mutex> guard(lock);
+	job = &j;
+	jobNode = n;
+	running = 0;
+	for (size_t i = 0; i < nodes.size(); i++)
+		if (n == -1 || n == (int)i)
+			running += nodes[i].workers.size();
+	generation++;
+	start.notify_all();
+	done.wait(guard, [this]() { return running == 0; });
+	job = NULL;
+	std::exception_ptr thrown = failure;
+	failure = std::exception_ptr();
+	if (thrown)
+		std::rethrow_exception(thrown);
+}
+
+/*
+ * Helper function that parses and evaluates expression e (the one at
+ * index id in the batch) with the given variables, recording a span for
+ * each of tokenise, buildTree and the evaluation in trace. Their sizes are
+ * the length of e, the number of tokens and the number of nodes.
+ */
+int tracedEvaluation(TraceRecorder & trace, const string & e, long id, const Bindings & variables) {
+	uint64_t start = trace.now();
+	vector<string> tokens = ExprTree::tokenise(e);
+	uint64_t tokenised = trace.now();
+	trace.record("tokenise", start, tokenised, id, e.size());
+	ExprTree t = ExprTree::buildTree(tokens);
+	uint64_t built = trace.now();
+	trace.record("buildTree", tokenised, built, id, tokens.size());
+	int result = t.evaluateWholeTree(variables);
+	trace.record("evaluate", built, trace.now(), id, t.size());
+	return result;
+}
+
+/*
+ * Returns the value of each of the expressions, with the variables given.
+ *
+ * Algorithm:
+ * Cut the expressions into one run for each node, with a length in
+ * proportion to the node's workers. The workers of each node take
+ * taskSize expressions at a time from their node's run, and parse and
+ * evaluate each of them in turn. Once they are done with a task, its trees
+ * are gone, so the worker resets its arena and the next task reuses the
+ * same (local, and by then cached) memory.
+ * Workers don't take expressions from another node's run, as the point is
+ * to keep each node's work in its own memory.
+ * If a TraceRecorder is installed, each task and each step of each
+ * expression is recorded in it, on a track for each worker.
+ * If an expression can't be parsed, the std::invalid_argument from
+ * buildTree is thrown here.
+ */
+vector<int> BatchEvaluator::evaluate(const vector<string> & expressions, const Bindings & variables) {
+	vector<int> results(expressions.size());
+	TraceRecorder * trace = TraceRecorder::installed();
+	size_t total = 0;
+	for (size_t n = 0; n < nodes.size(); n++)
+		total += nodes[n].workers.size();
+	if (total == 0) {
+		for (size_t i = 0; i < expressions.size(); i++)
+			results[i] = trace == NULL ? ExprTree::buildTree(ExprTree::tokenise(expressions[i])).evaluateWholeTree(variables) :
+				tracedEvaluation(*trace, expressions[i], i, variables);
+		return results;
+	}
+
+	vector<size_t> first(nodes.size() + 1);
+	size_t before = 0;
+	for (size_t n = 0; n < nodes.size(); n++) {
+		first[n] = expressions.size() * before / total;
+		before += nodes[n].workers.size();
+	}
+	first[nodes.size()] = expressions.size();
+	std::unique_ptr<std::atomic<size_t>[]> cursors(new std::atomic<size_t>[nodes.size()]);
+	for (size_t n = 0; n < nodes.size(); n++)
+		cursors[n] = first[n];
+
+	run(-1, [&](int n, int w) {
+		NodeArena * arena = NodeArena::current();
+		if (trace != NULL) {
+			std::stringstream name;
+			name << "node " << getNumaNode(n) << " worker " << w;
+			trace->nameThread(name.str());
+		}
+		while (true) {
+			size_t from = cursors[n].fetch_add(taskSize);
+			if (from >= first[n + 1])
+				return;
+			size_t to = std::min(from + taskSize, first[n + 1]);
+			uint64_t taskStart = trace == NULL ? 0 : trace->now();
+			for (size_t i = from; i < to; i++) {
+				if (trace != NULL) {
+					results[i] = tracedEvaluation(*trace, expressions[i], i, variables);
+					continue;
+				}
+				ExprTree t = ExprTree::buildTree(ExprTree::tokenise(expressions[i]));
+				results[i] = t.evaluateWholeTree(variables);
+			}
+			if (trace != NULL)
+				trace->record("task", taskStart, trace->now(), from, to - from);
+			arena->reset();
+		}
+	});
+	return results;
+}
+
+/*
+ * Returns the number of NUMA nodes used.
+ */
+int BatchEvaluator::nodeCount() { return nodes.size(); }
+
+/*
+ * Returns the number of workers on the node at index n.
+ */
+int BatchEvaluator::workerCount(int n) { return nodes[n].workers.size(); }
+
+/*
+ * Returns the number the system gives the node at index n, or -1 if the
+ * nodes couldn't be read.
+ */
+int BatchEvaluator::getNumaNode(int n) { return nodes[n].id; }
@@ -0,0 +1,79 @@
+#ifndef BATCHEVALUATOR_H
+#define BATCHEVALUATOR_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+#include "ExprTree.h"
+#include "NodeArena.h"
+
+/*
+ * Parses and evaluates batches of expressions on a pool of threads that
+ * knows about the NUMA nodes of the machine.
+ *
+ * The NUMA nodes and their cores are read from /sys. Each node gets its
+ * own workers, which are pinned to its cores, and each worker allocates
+ * the TreeNodes it builds from its own NodeArena, whose memory is on the
+ * worker's node. An expression is parsed and evaluated by the same worker,
+ * so its tree is never read from another node's memory.
+ * If the NUMA nodes can't be read, all the cores the process may use are
+ * treated as one node, without binding any memory.
+ */
+class BatchEvaluator{
+
+ public:
+
+  static const int taskSize = 64; //How many expressions a worker takes at a time.
+
+  /*
+   * A job run on the workers: it is given the index of the worker's NUMA
+   * node (in the order of getNumaNode) and the index of the worker on it.
+   */
+  typedef std::function<void(int, int)> Job;
+
+  BatchEvaluator(int = 0); //Takes the number of workers for each NUMA node, 0 for one per core.
+  ~BatchEvaluator(); //Stops the workers.
+  vector<int> evaluate(const vector<string> &, const Bindings & = Bindings()); //Returns the value of each expression.
+  void run(int, const Job &); //Runs a job on every worker of one NUMA node (-1 for all of them) and waits for it.
+                              //If the job throws on a worker, run throws the first exception once all are done.
+  int nodeCount(); //The number of NUMA nodes used.
+  int workerCount(int); //The number of workers on one of them.
+  int getNumaNode(int); //The NUMA node number the system gives one of them, or -1 if unknown.
+
+ private:
+
+  /*
+   * A NUMA node and its workers.
+   */
+  struct Node{
+    int id; //Its number in /sys, or -1.
+    vector<int> cpus; //The cores the workers are pinned to.
+    vector<std::thread> workers;
+  };
+
+  vector<Node> nodes;
+  std::mutex runLock; //Lets one job run at a time.
+  std::mutex lock; //Guards everything below.
+  std::condition_variable start; //Signalled when there is a job, or when stopping.
+  std::condition_variable done; //Signalled when the last worker finishes a job.
+  const Job * job;
+  int jobNode; //Which node's workers run the job, or -1 for all.
+  long generation; //Goes up by one for each job, so the workers can tell a new job from the last one.
+  int running; //How many workers haven't finished the job yet.
+  std::exception_ptr failure; //The first exception the job threw on a worker, if any.
+  bool stopping;
+
+  BatchEvaluator(const BatchEvaluator &); //Not copyable.
+  BatchEvaluator & operator=(const BatchEvaluator &);
+
+  void findNodes();
+  void work(int, int);
+
+};
+
+#endif
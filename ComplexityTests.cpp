@@ -0,0 +1,75 @@
+/* Generated file, do not edit */
+
+#ifndef CXXTEST_RUNNING
+#define CXXTEST_RUNNING
+#endif
+
+#define _CXXTEST_HAVE_STD
+#define _CXXTEST_HAVE_EH
+#define _CXXTEST_ABORT_TEST_ON_FAIL
+#include <cxxtest/TestListener.h>
+#include <cxxtest/TestTracker.h>
+#include <cxxtest/TestRunner.h>
+#include <cxxtest/RealDescriptions.h>
+#include <cxxtest/TestMain.h>
+#include <cxxtest/ErrorPrinter.h>
+
+int main( int argc, char *argv[] ) {
+ int status;
+    CxxTest::ErrorPrinter tmp;
+    CxxTest::RealWorldDescription::_worldName = "cxxtest";
+    status = CxxTest::Main< CxxTest::ErrorPrinter >( tmp, argc, argv );
+    return status;
+}
+bool suite_ComplexityTests_init = false;
+#include "ComplexityTests.h"
+
+static ComplexityTests suite_ComplexityTests;
+
+static CxxTest::List Tests_ComplexityTests = { 0, 0 };
+CxxTest::StaticSuiteDescription suiteDescription_ComplexityTests( "ComplexityTests.h", 26, "ComplexityTests", suite_ComplexityTests, Tests_ComplexityTests );
+
+static class TestDescription_suite_ComplexityTests_testTokenise : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ComplexityTests_testTokenise() : CxxTest::RealTestDescription( Tests_ComplexityTests, suiteDescription_ComplexityTests, 122, "testTokenise" ) {}
+ void runTest() { suite_ComplexityTests.testTokenise(); }
+} testDescription_suite_ComplexityTests_testTokenise;
+
+static class TestDescription_suite_ComplexityTests_testBuildTree : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ComplexityTests_testBuildTree() : CxxTest::RealTestDescription( Tests_ComplexityTests, suiteDescription_ComplexityTests, 130, "testBuildTree" ) {}
+ void runTest() { suite_ComplexityTests.testBuildTree(); }
+} testDescription_suite_ComplexityTests_testBuildTree;
+
+static class TestDescription_suite_ComplexityTests_testEvaluate : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ComplexityTests_testEvaluate() : CxxTest::RealTestDescription( Tests_ComplexityTests, suiteDescription_ComplexityTests, 139, "testEvaluate" ) {}
+ void runTest() { suite_ComplexityTests.testEvaluate(); }
+} testDescription_suite_ComplexityTests_testEvaluate;
+
+static class TestDescription_suite_ComplexityTests_testPrefixOrder : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ComplexityTests_testPrefixOrder() : CxxTest::RealTestDescription( Tests_ComplexityTests, suiteDescription_ComplexityTests, 150, "testPrefixOrder" ) {}
+ void runTest() { suite_ComplexityTests.testPrefixOrder(); }
+} testDescription_suite_ComplexityTests_testPrefixOrder;
+
+static class TestDescription_suite_ComplexityTests_testInfixOrder : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ComplexityTests_testInfixOrder() : CxxTest::RealTestDescription( Tests_ComplexityTests, suiteDescription_ComplexityTests, 159, "testInfixOrder" ) {}
+ void runTest() { suite_ComplexityTests.testInfixOrder(); }
+} testDescription_suite_ComplexityTests_testInfixOrder;
+
+static class TestDescription_suite_ComplexityTests_testPostfixOrder : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ComplexityTests_testPostfixOrder() : CxxTest::RealTestDescription( Tests_ComplexityTests, suiteDescription_ComplexityTests, 168, "testPostfixOrder" ) {}
+ void runTest() { suite_ComplexityTests.testPostfixOrder(); }
+} testDescription_suite_ComplexityTests_testPostfixOrder;
+
+static class TestDescription_suite_ComplexityTests_testSize : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ComplexityTests_testSize() : CxxTest::RealTestDescription( Tests_ComplexityTests, suiteDescription_ComplexityTests, 181, "testSize" ) {}
+ void runTest() { suite_ComplexityTests.testSize(); }
+} testDescription_suite_ComplexityTests_testSize;
+
+#include <cxxtest/Root.cpp>
+const char* CxxTest::RealWorldDescription::_worldName = "cxxtest";
@@ -0,0 +1,194 @@
+#define CXXTEST_HAVE_EH
+#define CXXTEST_ABORT_TEST_ON_FAIL
+#include <cxxtest/TestSuite.h>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <functional>
+#include <chrono>
+#include <cmath>
+
+#include "ExprTree.h"
+
+/*
+ * Tests that the public functions of ExprTree don't take more than
+ * O(n log n) time, so quadratic behaviour (e.g. rescanning a growing
+ * number token, or recounting subtrees while writing a tree out) can't
+ * creep back in unnoticed.
+ *
+ * Each function is timed on inputs of each shape below, at sizes that
+ * double from smallest, and the growth exponent is the slope of the best
+ * fitting line through log(time) against log(size). Linear time gives 1
+ * and n log n a little more (about 1.1 at these sizes), while quadratic
+ * time gives 2, so anything over maxExponent fails. Timings are the best of
+ * a few runs of at least minimumTime each, to keep noise out of the fit.
+ */
+class ComplexityTests : public CxxTest::TestSuite{
+
+public:
+
+  static const int smallest = 1 << 10; //The size of the smallest input.
+  static const int doublings = 4; //How many times it is doubled.
+
+  /*
+   * The largest growth exponent that passes.
+   */
+  static double maxExponent() { return 1.5; }
+
+  /*
+   * The shortest time each timing run takes, in seconds.
+   */
+  static double minimumTime() { return 0.005; }
+
+  /*
+   * Shapes of input, each made from its size n.
+   */
+  static std::string longNumber(int n) { return std::string(n, '7'); } //One number with n digits.
+
+  static std::string deepNesting(int n) { //1 + (1 + (1 + ...)), nested n deep.
+    std::string out;
+    for (int i = 0; i < n; i++)
+      out += "(1 + ";
+    out += "1";
+    return out + std::string(n, ')');
+  }
+
+  static std::string leftChain(int n) { //1 + 2 - 3 + ..., which groups to the left.
+    std::stringstream out;
+    out << 1;
+    for (int i = 2; i <= n; i++)
+      out << (i % 2 ? " - " : " + ") << i % 10;
+    return out.str();
+  }
+
+  static std::string rightChain(int n) { //x ^ 1 ^ 1 ^ ..., which groups to the right.
+    std::string out = "x";
+    for (int i = 1; i < n; i++)
+      out += " ^ 1";
+    return out;
+  }
+
+  /*
+   * Returns the time one call of f takes, in seconds: f is called over and
+   * over until minimumTime has gone by, and the best of three of those runs
+   * is kept, so a run that was interrupted doesn't count.
+   */
+  static double timeOf(const std::function<void()> & f) {
+    double best = 0;
+    for (int run = 0; run < 3; run++) {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      double elapsed = 0;
+      long calls = 0;
+      while (elapsed < minimumTime()) {
+        f();
+        calls++;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      }
+      if (run == 0 || elapsed / calls < best)
+        best = elapsed / calls;
+    }
+    return best;
+  }
+
+  /*
+   * Times a function on every shape at every size, with secondsFor giving
+   * the time of one call on an expression, and fails if its time grows
+   * faster than maxExponent on any of them.
+   */
+  static void checkGrowth(const std::string & function, const std::function<double(const std::string &)> & secondsFor) {
+    typedef std::string (*Shape)(int);
+    Shape shapes[] = {longNumber, deepNesting, leftChain, rightChain};
+    const char * names[] = {"a long number", "deep nesting", "a left-deep chain", "a right-deep chain"};
+    for (int s = 0; s < 4; s++) {
+      double sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+      int points = doublings + 1;
+      for (int k = 0; k < points; k++) {
+        double x = std::log((double)(smallest << k));
+        double y = std::log(secondsFor(shapes[s](smallest << k)));
+        sumX += x;
+        sumY += y;
+        sumXX += x * x;
+        sumXY += x * y;
+      }
+      double exponent = (points * sumXY - sumX * sumY) / (points * sumXX - sumX * sumX);
+      if (exponent > maxExponent()) {
+        std::stringstream message;
+        message << function << " on " << names[s] << " grows as n^" << exponent;
+        TS_FAIL(message.str());
+      }
+    }
+  }
+
+  void testTokenise(void)
+  {
+    checkGrowth("tokenise", [](const std::string & e) {
+      volatile size_t sink = 0;
+      return timeOf([&]() { sink = sink + ExprTree::tokenise(e).size(); });
+    });
+  }
+
+  void testBuildTree(void)
+  {
+    checkGrowth("buildTree", [](const std::string & e) {
+      std::vector<std::string> tokens = ExprTree::tokenise(e);
+      volatile int sink = 0;
+      return timeOf([&]() { sink = sink + ExprTree::buildTree(tokens).size(); });
+    });
+  }
+
+  void testEvaluate(void)
+  {
+    checkGrowth("evaluate", [](const std::string & e) {
+      ExprTree t = ExprTree::buildTree(ExprTree::tokenise(e));
+      Bindings variables;
+      variables["x"] = 2;
+      volatile int sink = 0;
+      return timeOf([&]() { sink = sink + t.evaluateWholeTree(variables); });
+    });
+  }
+
+  void testPrefixOrder(void)
+  {
+    checkGrowth("prefixOrder", [](const std::string & e) {
+      ExprTree t = ExprTree::buildTree(ExprTree::tokenise(e));
+      volatile size_t sink = 0;
+      return timeOf([&]() { sink = sink + ExprTree::prefixOrder(t).size(); });
+    });
+  }
+
+  void testInfixOrder(void)
+  {
+    checkGrowth("infixOrder", [](const std::string & e) {
+      ExprTree t = ExprTree::buildTree(ExprTree::tokenise(e));
+      volatile size_t sink = 0;
+      return timeOf([&]() { sink = sink + ExprTree::infixOrder(t).size(); });
+    });
+  }
+
+  void testPostfixOrder(void)
+  {
+    checkGrowth("postfixOrder", [](const std::string & e) {
+      ExprTree t = ExprTree::buildTree(ExprTree::tokenise(e));
+      volatile size_t sink = 0;
+      return timeOf([&]() { sink = sink + ExprTree::postfixOrder(t).size(); });
+    });
+  }
+
+  /*
+   * size() itself returns a count kept in the tree, so this times the count
+   * made when a tree is given its root.
+   */
+  void testSize(void)
+  {
+    checkGrowth("size", [](const std::string & e) {
+      ExprTree t = ExprTree::buildTree(ExprTree::tokenise(e));
+      volatile int sink = 0;
+      return timeOf([&]() {
+        ExprTree counted(t.getRoot());
+        sink = sink + counted.size();
+        counted.release();
+      });
+    });
+  }
+
+};
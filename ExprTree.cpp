@@ -1,8 +1,15 @@
 #include "ExprTree.h"
+#include "Reclaimer.h"
+#include "HeavyHitters.h"
+#include "Metrics.h"
 #include <sstream>
+#include <climits>
+#include <stdexcept>
 
 /*
- * Helper function that tests whether a string is a non-negative integer.
+ * Helper function that tests whether a string is an integer, i.e. digits
+ * with an optional leading minus sign. tokenise never puts the sign in the
+ * number token, but a negative literal can be given to buildTree directly.
  */
 
 bool isdigit(const char & c) {
@@ -27,8 +34,38 @@ bool isdigit(const char & c) {
 bool is_number(const std::string & s)
 {
 	std::string::const_iterator it = s.begin();
+	if (it != s.end() && *it == '-') ++it;
+	std::string::const_iterator digits = it;
 	while (it != s.end() && isdigit(*it)) ++it;
-	return !s.empty() && it == s.end();
+	return it != digits && it == s.end();
+}
+
+/*
+ * Helper function that tests whether a char is a lower or upper case letter.
+ * Letters make up the names of variables and of the function-call operators (min, max, abs).
+ */
+bool isletter(const char & c) {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+/*
+ * Helper function that tests whether a string is a word, i.e. a letter
+ * followed by any number of letters and digits.
+ */
+bool is_word(const std::string & s) {
+	if (s.empty() || !isletter(s[0]))
+		return false;
+	std::string::const_iterator it = s.begin();
+	while (it != s.end() && (isletter(*it) || isdigit(*it))) ++it;
+	return it == s.end();
+}
+
+/*
+ * Helper function that tests whether a string is the name of a variable,
+ * i.e. any word that is not the symbol of an operator (like max or neg).
+ */
+bool is_variable(const std::string & s) {
+	return is_word(s) && OperatorRegistry::lookup(s) == NoOp;
 }
 
 /*
@@ -48,38 +85,90 @@ string to_string(const int & n) {
 }
 
 /*
- * Additional overloaded helper function that converts a char to a string.
+ * The largest subtree (in nodes) that evaluate treats as cheap.
+ * Cheap operands of &&, || and ?: are evaluated unconditionally and
+ * combined with a branchless select. Bigger operands are short-circuited,
+ * since skipping them saves more than a mispredicted branch costs.
  */
-string to_string(const char &c) {
-	std::stringstream stream;
-	stream << c;
-	return stream.str();
-}
+const int cheapSubtreeSize = 3;
 
 /*
- * Helper function that creates a TreeNode with the appropriate operator
- * when given a string that's "+", "-", "*" or "/". If the string is wrong
- * it gives a NoOp value.
+ * Helper function that tells whether the subtree at n is cheap, i.e. it has
+ * at most budget nodes and contains nothing that can trap when evaluated
+ * unconditionally (division or modulo by zero, or a custom operator, which
+ * might do anything), or that would have to be parsed first (a Deferred
+ * group). It stops counting as soon
+ * as the budget runs out, so it never walks more than budget nodes.
  */
-TreeNode * createOperatorNode(const string & op) {
-
-	if (op == "+") return new TreeNode(Plus);
-	if (op == "-") return new TreeNode(Minus);
-	if (op == "*") return new TreeNode(Times);
-	if (op == "/") return new TreeNode(Divide);
-	return new TreeNode(NoOp);
+bool isCheap(TreeNode * n, int & budget) {
+	if (n == NULL)
+		return true;
+	if (--budget < 0)
+		return false;
+	if (n->getOperator() == Divide || n->getOperator() == Modulo || n->getOperator() == Deferred || n->getOperator() > NoOp)
+		return false;
+	return isCheap(n->getLeftChild(), budget) && isCheap(n->getRightChild(), budget);
+}
 
+bool isCheap(TreeNode * n) {
+	int budget = cheapSubtreeSize;
+	return isCheap(n, budget);
 }
 
 /*
- * Recursive function that counts the size of nodes in the tree.
+ * Function that counts the size of nodes in the tree.
  * It return 0 if the size is null.
- * +1 of the return statement is for the current node.
+ * It walks the tree with a TreeIterator rather than recursing, so a long
+ * chain of nodes can't overflow the stack.
  */
 int countSize(TreeNode *r) {
+	int count = 0;
+	for (TreeIterator i(r, TreeIterator::Preorder), end; i != end; ++i)
+		count++;
+	return count;
+}
+
+/*
+ * Helper function that deletes every node of the subtree at r.
+ * It keeps a stack of the nodes still to delete rather than recursing, so a
+ * long chain of nodes (e.g. 1 + 2 + ... + 100000) can't overflow the stack.
+ */
+void freeNodes(TreeNode * r) {
 	if (r == NULL)
-		return 0;
-	return (countSize(r->getLeftChild()) + countSize(r->getRightChild()) + 1);
+		return;
+	vector<TreeNode *> pending(1, r);
+	while (!pending.empty()) {
+		TreeNode * n = pending.back();
+		pending.pop_back();
+		if (n->getLeftChild() != NULL)
+			pending.push_back(n->getLeftChild());
+		if (n->getRightChild() != NULL)
+			pending.push_back(n->getRightChild());
+		delete n;
+	}
+}
+
+/*
+ * Recursive function that returns a copy of the subtree at n, with the
+ * parent of its root set to parent. A Deferred node gets its own
+ * DeferredGroup, which shares the tokens with the original.
+ */
+TreeNode * copyNodes(TreeNode * n, TreeNode * parent) {
+	if (n == NULL)
+		return NULL;
+	TreeNode * c;
+	if (n->isValue())
+		c = new TreeNode(n->getValue());
+	else if (n->isVariable())
+		c = new TreeNode(n->getName());
+	else if (n->getOperator() == Deferred)
+		c = new TreeNode(new DeferredGroup(*n->getDeferred()));
+	else
+		c = new TreeNode(n->getOperator());
+	c->setParent(parent);
+	c->setLeftChild(copyNodes(n->getLeftChild(), c));
+	c->setRightChild(copyNodes(n->getRightChild(), c));
+	return c;
 }
 
 /*
@@ -88,6 +177,7 @@ int countSize(TreeNode *r) {
 ExprTree::ExprTree() {
 	root = NULL;
 	_size = countSize(NULL);
+	reclaimer = NULL;
 }
 
 /*
@@ -96,57 +186,128 @@ ExprTree::ExprTree() {
 ExprTree::ExprTree(TreeNode * r) {
 	root = r;
 	_size = countSize(r);
+	reclaimer = NULL;
+}
+
+/*
+ * Copy constructor that copies every node of t, so that the two trees can
+ * be deleted separately. The copy frees its nodes itself, even if t has a
+ * Reclaimer.
+ */
+ExprTree::ExprTree(const ExprTree & t) {
+	root = copyNodes(t.root, NULL);
+	_size = t._size;
+	reclaimer = NULL;
 }
 
 /*
- * Destructor to clean up the tree.
+ * Assignment that frees the nodes this tree had and copies every node of t.
+ */
+ExprTree & ExprTree::operator=(const ExprTree & t) {
+	if (this == &t)
+		return *this;
+	TreeNode * old = root;
+	root = copyNodes(t.root, NULL);
+	_size = t._size;
+	if (reclaimer != NULL)
+		reclaimer->reclaim(old);
+	else
+		freeNodes(old);
+	return *this;
+}
+
+/*
+ * Destructor that deletes every node of the tree, or if the tree has a
+ * Reclaimer, hands them to it so they are deleted on its thread.
  */
 ExprTree::~ExprTree() {
-	delete root;
+	if (reclaimer != NULL)
+		reclaimer->reclaim(root);
+	else
+		freeNodes(root);
 }
 
 /*
  * This function takes a string representing an arithmetic expression and breaks
- * it up into components (number, operators, parentheses).
+ * it up into components (number, operators, function names, commas, parentheses).
  * It returns the broken up expression as a vector of strings.
  *
  * Algortihm:
- * Scan the expression string.
- * If it is not a whitespace,
- *	check if the output vector is not empty,
- *	the scanned char is a digit and the previous element in the vector is a non-negative integer,
- *	convert the scanned digit into a string and append it to the previous number in the vector.
- *	This is to deal with more than 1 digit expression.
- * Else, convert the scanned char into a string and push into the back of the vector.
+ * Scan the expression string, skipping whitespace.
+ * If the scanned char is a digit, the whole run of digits is one number token,
+ * unless the previous token is also a number, in which case the digits are
+ * appended to it. This is to deal with more than 1 digit expression.
+ * If it is a letter, the run of letters and digits is one word token, so "max" and "x1" become one token.
+ * Else it is the start of the longest operator symbol in the OperatorRegistry that the
+ * expression has at that point (so "<=" and "&&" become one token), or a char on its own.
+ * If Metrics are enabled, it is timed.
  */
 vector<string> ExprTree::tokenise(string expression) {
+	vector<int> matches;
+	if (!Metrics::enabled())
+		return tokenise(expression, matches);
+	uint64_t start = Metrics::now();
+	vector<string> tokens = tokenise(expression, matches);
+	Metrics::observe(Metrics::Tokenise, start);
+	return tokens;
+}
+
+/*
+ * Same as tokenise, and also fills in matches with the position of the
+ * matching parenthesis of every parenthesis token (and -1 for every other
+ * token, or a parenthesis without a match), using a stack of the open
+ * parentheses seen so far.
+ */
+vector<string> ExprTree::tokenise(string expression, vector<int> & matches) {
 	vector<string> vec;
+	stack<int> open;
+	matches.clear();
+	bool lastIsNumber = false;
+	string::size_type i = 0;
 
-	for (string::iterator i = expression.begin(); i != expression.end(); ++i) {
-		if (*i != ' ') {
-			if (!vec.empty() && isdigit(*i) && is_number(vec[vec.size() - 1]))				
-				vec[vec.size() - 1] += to_string(*i);
-			else
-				vec.push_back(to_string(*i));
+	while (i < expression.size()) {
+		char c = expression[i];
+		if (c == ' ') {
+			i++;
+			continue;
 		}
+
+		string::size_type length = 1;
+		if (isdigit(c)) {
+			while (i + length < expression.size() && isdigit(expression[i + length]))
+				length++;
+		}
+		else if (isletter(c)) {
+			while (i + length < expression.size() && (isletter(expression[i + length]) || isdigit(expression[i + length])))
+				length++;
+		}
+		else
+			length = OperatorRegistry::matchSymbol(expression, i);
+
+		if (isdigit(c) && lastIsNumber)
+			vec[vec.size() - 1].append(expression, i, length);
+		else {
+			vec.push_back(expression.substr(i, length));
+			matches.push_back(-1);
+			if (c == '(')
+				open.push(vec.size() - 1);
+			else if (c == ')' && !open.empty()) {
+				matches[open.top()] = vec.size() - 1;
+				matches[vec.size() - 1] = open.top();
+				open.pop();
+			}
+		}
+		lastIsNumber = isdigit(c);
+		i += length;
 	}
 	return vec;
 }
 
 /*
- * This function returns the precedence level of the operators.
- * Lower level number means lower precedence.
- * Higher level number means higher precedence which goes first.
+ * Marks an open parenthesis on the operator stack of to_postfix, which
+ * otherwise holds Operator values.
  */
-int getPrecedence(string op) {
-	if (op == "(")
-		return 0;
-	if (op == "+" || op == "-")
-		return 1;
-	if (op == "*" || op == "/")
-		return 2;
-	return 3;
-}
+const int openParenthesis = -1;
 
 /*
  * This function takes the infix notation of the vector of strings
@@ -156,46 +317,104 @@ int getPrecedence(string op) {
  * Algorithm:
  * Scan the infix notation from left to right.
  * If it is an open parenthesis, push it onto the stack.
+ * Else if it is a comma, push the value from the stack into the back of the
+ * vector until the open parenthesis of the function call is on top.
+ * If the stack runs out first, the comma isn't in a function call, so throw
+ * std::invalid_argument.
  * Else if it is a close parenthesis, 
  * push the value from the stack into the back of the vector until an open parenthesis is encountered.
- * Else it is either a number or an operator.
- *	If is a number (operand), push into the back of the vector.
- *	Else it is an operator, while the stack is not empty and
- *	the precedence of operator in the stack is equal or higher than
- *	the precedence of the scanned operator, 
+ * If the stack runs out first, the parenthesis has no match, so throw std::invalid_argument.
+ * If the parenthesis belonged to a function call, the function goes into the vector as well.
+ * Else if is a number, a variable or a built subtree ("()", see buildSubtree) (operand), push into the back of the vector.
+ * Else it is an operator, which is looked up once in the OperatorRegistry.
+ * A minus sign that does not follow an operand (a number, a variable or a close parenthesis)
+ * is a unary minus, and is treated as the prefix operator neg.
+ *	If it is a function or a prefix operator, push it onto the stack.
+ *	A prefix operator has nothing to its left, so it doesn't pop anything. It binds
+ *	tighter than * and /, but not ^, so -2 ^ 2 means -(2 ^ 2).
+ *	Else if it is the colon of a conditional, push the value from the stack into the back
+ *	of the vector until its question mark is on top (a finished inner conditional on the
+ *	way is pushed as a colon followed by its question mark), then push the colon.
+ *	If the stack runs out or an open parenthesis is on top first, the colon has no question
+ *	mark in its parentheses, so throw std::invalid_argument.
+ *	Else, while the stack is not empty and
+ *	the precedence of operator in the stack is higher than
+ *	the precedence of the scanned operator (or equal, for left associative operators),
  *	push into the back of the vector and pop.
  *	Push the scanned operator onto the stack.
  * While the stack is not empty, push into the back of the vector and pop.
  * Return the postfix vector of strings.
  */
 vector<string> to_postfix(vector<string> tokens) {
-	stack<string> opStack;
+	stack<int> opStack;
 	vector<string> vec;
+	bool afterOperand = false;
 
 	for (vector<string>::const_iterator i = tokens.begin(); i != tokens.end(); i++) {
+		bool wasAfterOperand = afterOperand;
+		afterOperand = (*i) == ")" || (*i) == "()" || is_number(*i) || is_variable(*i);
+
 		if ((*i) == "(")
-			opStack.push(*i);
+			opStack.push(openParenthesis);
+		else if ((*i) == ",") {
+			while (!opStack.empty() && opStack.top() != openParenthesis) {
+				vec.push_back(OperatorRegistry::get(Operator(opStack.top())).symbol);
+				opStack.pop();
+			}
+			if (opStack.empty())
+				throw std::invalid_argument("',' outside a function call");
+		}
 		else if ((*i) == ")") {
-			while (opStack.top() != "(") {
-				vec.push_back(opStack.top());
+			while (!opStack.empty() && opStack.top() != openParenthesis) {
+				vec.push_back(OperatorRegistry::get(Operator(opStack.top())).symbol);
 				opStack.pop();
 			}
+			if (opStack.empty())
+				throw std::invalid_argument("')' without a matching '('");
 			opStack.pop();
+			if (!opStack.empty() && opStack.top() != openParenthesis &&
+				OperatorRegistry::get(Operator(opStack.top())).notation == Function) {
+				vec.push_back(OperatorRegistry::get(Operator(opStack.top())).symbol);
+				opStack.pop();
+			}
 		}
+		else if (afterOperand)
+			vec.push_back(*i);
 		else {
-			if (is_number(*i))
-				vec.push_back(*i);
+			Operator op = ((*i) == "-" && !wasAfterOperand) ? Negate : OperatorRegistry::lookup(*i);
+			const OperatorInfo & info = OperatorRegistry::get(op);
+
+			if (info.notation != Infix)
+				opStack.push(op);
+			else if (op == Alternative) {
+				while (!opStack.empty() && opStack.top() != Conditional && opStack.top() != openParenthesis) {
+					bool finishedConditional = opStack.top() == Alternative;
+					vec.push_back(OperatorRegistry::get(Operator(opStack.top())).symbol);
+					opStack.pop();
+					if (finishedConditional) {
+						vec.push_back(OperatorRegistry::get(Operator(opStack.top())).symbol);
+						opStack.pop();
+					}
+				}
+				if (opStack.empty() || opStack.top() == openParenthesis)
+					throw std::invalid_argument("':' without a matching '?'");
+				opStack.push(op);
+			}
 			else {
-				while (!opStack.empty() && getPrecedence(opStack.top()) >= getPrecedence(*i)) {
-					vec.push_back(opStack.top());
+				while (!opStack.empty() && opStack.top() != openParenthesis) {
+					const OperatorInfo & top = OperatorRegistry::get(Operator(opStack.top()));
+					if (top.precedence < info.precedence ||
+						(top.precedence == info.precedence && info.rightAssociative))
+						break;
+					vec.push_back(top.symbol);
 					opStack.pop();
 				}
-				opStack.push(*i);
+				opStack.push(op);
 			}
 		}
 	}
 	while (!opStack.empty()) {
-		vec.push_back(opStack.top());
+		vec.push_back(OperatorRegistry::get(Operator(opStack.top())).symbol);
 		opStack.pop();
 	}
 	return vec;
@@ -210,23 +429,66 @@ vector<string> to_postfix(vector<string> tokens) {
  * Scan the postfix tokens from left to right.
  *	If it is a number:
  *	Create a number node (converting the string into int type) and push it onto the stack.
+ *	Else if it is a variable:
+ *	Create a variable node with its name and push it onto the stack.
  *	Else if it is an operator:
- *	Create an operator node, set the right and left childs, and then push the operator node onto the stack.
+ *	Look up the operator in the OperatorRegistry, create an operator node, set the right and left childs, and then push the operator node onto the stack.
+ *	Unary operators (abs, neg) only take one node off the stack, which becomes the left child.
+ *	A neg whose operand is a number is folded into a negative number node instead.
  * If the stack is empty, return null.
  * Else return the top of the stack.
+ * If Metrics are enabled, the expression is counted and the build is timed.
  */
 ExprTree ExprTree::buildTree(vector<string> tokens) {
+	static const vector<TreeNode *> noSubtrees;
+	if (!Metrics::enabled())
+		return buildSubtree(tokens, noSubtrees);
+	uint64_t start = Metrics::now();
+	TreeNode * root = buildSubtree(tokens, noSubtrees);
+	Metrics::observe(Metrics::Build, start);
+	Metrics::add(Metrics::ExpressionsParsed);
+	return root;
+}
+
+/*
+ * Same as buildTree, except that the tokens can have "()" tokens in them,
+ * each standing for the next subtree in subtrees, which is used as it is.
+ * tokenise never makes a "()" token, since it splits up parentheses.
+ * Only the new nodes are visited, and the root is returned without counting
+ * the nodes of the tree, so the work done depends on the number of tokens,
+ * not the size of the subtrees.
+ * The subtrees shouldn't be single numbers, since a neg in front of one
+ * would fold it into a new node.
+ */
+TreeNode * ExprTree::buildSubtree(vector<string> tokens, const vector<TreeNode *> & subtrees) {
 	stack<TreeNode *> nodeStack;
 	vector<string> postfix = to_postfix(tokens);
+	vector<TreeNode *>::const_iterator subtree = subtrees.begin();
 
 	for (vector<string>::const_iterator i = postfix.begin(); i != postfix.end(); i++) {
-		if (is_number(*i))
+		if ((*i) == "()" && subtree != subtrees.end())
+			nodeStack.push(*subtree++);
+		else if (is_number(*i))
 			nodeStack.push(new TreeNode(to_number(*i)));
+		else if (is_variable(*i))
+			nodeStack.push(new TreeNode(*i));
 		else {
-			TreeNode *op = createOperatorNode(*i);
-			op->setRightChild(nodeStack.top());
-			nodeStack.pop();
+			Operator o = OperatorRegistry::lookup(*i);
+			if (o == Negate && nodeStack.top()->isValue()) {
+				TreeNode *literal = nodeStack.top();
+				nodeStack.pop();
+				nodeStack.push(new TreeNode(-literal->getValue()));
+				delete literal;
+				continue;
+			}
+			TreeNode *op = new TreeNode(o);
+			if (!op->isUnary()) {
+				op->setRightChild(nodeStack.top());
+				nodeStack.top()->setParent(op);
+				nodeStack.pop();
+			}
 			op->setLeftChild(nodeStack.top());
+			nodeStack.top()->setParent(op);
 			nodeStack.pop();
 			nodeStack.push(op);
 		}
@@ -238,30 +500,632 @@ ExprTree ExprTree::buildTree(vector<string> tokens) {
 		return nodeStack.top();
 }
 
+/*
+ * Helper function that tells whether the parenthesised group that starts
+ * at token i can be left unparsed by buildLazyTree. It can't if it holds
+ * too few tokens to be worth it, if it is a function call's arguments, or if
+ * it might be all there is of a neg's operand (a minus sign that doesn't
+ * follow an operand, maybe with more open parentheses in between), since a
+ * group that turns out to be a number would then have to be folded into it.
+ */
+const int smallestDeferredGroup = 8;
+
+bool is_deferrable(const vector<string> & tokens, const vector<int> & matches, int i) {
+	if (matches[i] - i - 1 < smallestDeferredGroup)
+		return false;
+	if (i > 0 && OperatorRegistry::get(OperatorRegistry::lookup(tokens[i - 1])).notation == Function)
+		return false;
+	int k = i - 1;
+	while (k >= 0 && tokens[k] == "(")
+		k--;
+	if (k < 0 || tokens[k] != "-")
+		return true;
+	return k > 0 && (tokens[k - 1] == ")" || is_number(tokens[k - 1]) || is_variable(tokens[k - 1]));
+}
+
+/*
+ * Helper function that builds the tokens from first up to last, leaving
+ * the groups in them that is_deferrable allows as Deferred nodes, and
+ * returns the root. Only the tokens outside those groups are looked at.
+ */
+TreeNode * buildLevel(const std::shared_ptr<const vector<string> > & tokens,
+                      const std::shared_ptr<const vector<int> > & matches, int first, int last) {
+	vector<string> level;
+	vector<TreeNode *> groups;
+	for (int i = first; i < last; i++) {
+		if ((*tokens)[i] == "(" && (*matches)[i] > i && is_deferrable(*tokens, *matches, i)) {
+			DeferredGroup * group = new DeferredGroup;
+			group->tokens = tokens;
+			group->matches = matches;
+			group->first = i + 1;
+			group->last = (*matches)[i];
+			groups.push_back(new TreeNode(group));
+			level.push_back("()");
+			i = (*matches)[i];
+		}
+		else
+			level.push_back((*tokens)[i]);
+	}
+	return ExprTree::buildSubtree(level, groups);
+}
+
+/*
+ * This function takes the tokens of an expression and the matching
+ * parenthesis index from tokenise(string, vector<int> &), and builds a
+ * tree in which the bigger parenthesised groups are left as Deferred nodes.
+ * A Deferred node is parsed, in place, the first time evaluate or one of
+ * the order functions reaches it (or by materialise), and the groups inside
+ * it are left unparsed in the same way. So only the parts of the expression
+ * that are used get parsed.
+ * The tree's size() counts each Deferred node as one node.
+ * Code that reads the nodes directly should call materialise on each node
+ * before looking at it, or materialiseAll on the root.
+ */
+ExprTree ExprTree::buildLazyTree(vector<string> tokens, vector<int> matches) {
+	int size = tokens.size();
+	vector<string> * ownTokens = new vector<string>;
+	vector<int> * ownMatches = new vector<int>;
+	ownTokens->swap(tokens);
+	ownMatches->swap(matches);
+	std::shared_ptr<const vector<string> > sharedTokens(ownTokens);
+	std::shared_ptr<const vector<int> > sharedMatches(ownMatches);
+	return buildLevel(sharedTokens, sharedMatches, 0, size);
+}
+
+/*
+ * If n is a Deferred node, parses the group it stands for and turns n into
+ * the root of the group's subtree. Nothing happens to other nodes.
+ * (The root of a group can be a Deferred node again, e.g. for "((...))".)
+ */
+void ExprTree::materialise(TreeNode * n) {
+	while (n != NULL && n->getOperator() == Deferred) {
+		DeferredGroup * group = n->getDeferred();
+		TreeNode * r = buildLevel(group->tokens, group->matches, group->first, group->last);
+		if (r == NULL)
+			r = new TreeNode(NoOp);
+		n->takeOver(r);
+		delete r;
+	}
+}
+
+/*
+ * Recursive function that materialises every node of the subtree at n.
+ */
+void ExprTree::materialiseAll(TreeNode * n) {
+	if (n == NULL)
+		return;
+	materialise(n);
+	materialiseAll(n->getLeftChild());
+	materialiseAll(n->getRightChild());
+}
+
+/*
+ * This function takes a TreeNode and does the maths to calculate
+ * the value of the expression it represents, which must not contain variables.
+ */
+int ExprTree::evaluate(const TreeNode * n) {
+	static const Bindings noVariables;
+	return evaluate(n, noVariables);
+}
+
 /*
  * This function takes a TreeNode and does the maths to calculate
  * the value of the expression it represents.
+ * Most operators are evaluated with the kernel in their OperatorRegistry entry.
+ * Comparisons and logical operators give 1 for true and 0 for false.
+ * The right operand of && and || and the branches of ?: are only
+ * evaluated when needed, unless they are cheap (see isCheap).
+ * Variables take their value from variables, or 0 if they are not bound there.
  */
-int ExprTree::evaluate(TreeNode * n) {
+int ExprTree::evaluate(const TreeNode * n, const Bindings & variables) {
+	materialise(const_cast<TreeNode *>(n)); //Parsing a Deferred node doesn't change what the tree means.
 	switch (n->getOperator()) {
-	case Plus:
-		return (evaluate(n->getLeftChild()) + evaluate(n->getRightChild()));
-	case Minus:
-		return (evaluate(n->getLeftChild()) - evaluate(n->getRightChild()));
-	case Times:
-		return (evaluate(n->getLeftChild()) * evaluate(n->getRightChild()));
-	case Divide:
-		return evaluate(n->getLeftChild()) / evaluate(n->getRightChild());
+	case Value:
+		return n->getValue();
+	case Variable: {
+		Bindings::const_iterator binding = variables.find(n->getName());
+		return binding == variables.end() ? 0 : binding->second;
+	}
+	case And: {
+		int left = evaluate(n->getLeftChild(), variables) != 0;
+		if (isCheap(n->getRightChild()))
+			return left & (evaluate(n->getRightChild(), variables) != 0);
+		return left && evaluate(n->getRightChild(), variables) != 0;
+	}
+	case Or: {
+		int left = evaluate(n->getLeftChild(), variables) != 0;
+		if (isCheap(n->getRightChild()))
+			return left | (evaluate(n->getRightChild(), variables) != 0);
+		return left || evaluate(n->getRightChild(), variables) != 0;
+	}
+	case Conditional: {
+		int condition = evaluate(n->getLeftChild(), variables);
+		TreeNode * branches = n->getRightChild();
+		if (branches->getOperator() != Alternative)
+			return condition ? evaluate(branches, variables) : 0;
+		if (isCheap(branches->getLeftChild()) && isCheap(branches->getRightChild())) {
+			int whenTrue = evaluate(branches->getLeftChild(), variables);
+			int whenFalse = evaluate(branches->getRightChild(), variables);
+			int mask = -(condition != 0);
+			return (whenTrue & mask) | (whenFalse & ~mask);
+		}
+		return condition ? evaluate(branches->getLeftChild(), variables) : evaluate(branches->getRightChild(), variables);
+	}
+	case Alternative:
+		return evaluate(n->getLeftChild(), variables);
+	default: {
+		const OperatorInfo & info = OperatorRegistry::get(n->getOperator());
+		if (info.kernel == NULL)
+			return 0;
+		int left = evaluate(n->getLeftChild(), variables);
+		if (info.arity == 1)
+			return info.kernel(left, 0);
+		return info.kernel(left, evaluate(n->getRightChild(), variables));
+	}
 	}
-	return n->getValue();
 }
 
 /*
  * When called on an ExprTree, this function calculates the value of the
  * expression represented by the whole tree.
+ * If a HeavyHitters profiler is installed, it does the evaluating, so it
+ * can time some of them. If Metrics are enabled, the evaluation is counted
+ * and timed.
+ */
+int ExprTree::evaluateWholeTree() const {
+	static const Bindings noVariables;
+	return evaluateWholeTree(noVariables);
+}
+
+/*
+ * Same as evaluateWholeTree(), with the values of the variables in the expression.
  */
-int ExprTree::evaluateWholeTree() {
-	return evaluate(root);
+int ExprTree::evaluateWholeTree(const Bindings & variables) const {
+	bool measured = Metrics::enabled();
+	uint64_t start = measured ? Metrics::now() : 0;
+	HeavyHitters * profiler = HeavyHitters::installed();
+	int result = profiler != NULL ? profiler->evaluate(*this, variables) : evaluate(root, variables);
+	if (measured) {
+		Metrics::observe(Metrics::Evaluate, start);
+		Metrics::add(Metrics::Evaluations);
+	}
+	return result;
+}
+
+/*
+ * A stack that keeps its first inlineSize items inside itself, and only
+ * allocates once it grows past them.
+ */
+template <typename T, int inlineSize>
+class InlineStack {
+ public:
+	InlineStack() : count(0) {}
+	void push(const T & item) {
+		if (count < inlineSize)
+			local[count] = item;
+		else
+			more.push_back(item);
+		count++;
+	}
+	T & top() { return count <= inlineSize ? local[count - 1] : more.back(); }
+	void pop() {
+		if (count > inlineSize)
+			more.pop_back();
+		count--;
+	}
+	bool empty() const { return count == 0; }
+ private:
+	T local[inlineSize];
+	vector<T> more;
+	int count;
+};
+
+/*
+ * An operator waiting on the stack of evaluateExpression for its operands.
+ */
+struct PendingOperator {
+	int op; //An Operator, or openParenthesis.
+	bool skipping; //True if the operand after it doesn't need to be evaluated.
+	bool chosen; //For ?, true once its : has picked a branch.
+};
+
+typedef InlineStack<PendingOperator, 32> PendingStack;
+typedef InlineStack<int, 32> ValueStack;
+
+/*
+ * Helper function that pops a value, or gives 0 if there are none (which
+ * only happens with text that isn't a proper expression).
+ */
+int popValue(ValueStack & values) {
+	if (values.empty())
+		return 0;
+	int v = values.top();
+	values.pop();
+	return v;
+}
+
+/*
+ * Helper function that takes the operator off the top of ops, applies it to
+ * its operands on top of values, and pushes the result, in the same way as
+ * evaluate(...) does for its node. skipped is the number of operators on
+ * ops whose next operand isn't needed; while it is above 0, nothing is
+ * worked out and 0 is pushed instead.
+ */
+void applyPending(PendingStack & ops, ValueStack & values, int & skipped) {
+	PendingOperator p = ops.top();
+	ops.pop();
+	if (p.skipping)
+		skipped--;
+	const OperatorInfo & info = OperatorRegistry::get(Operator(p.op));
+	int right = info.arity == 1 ? 0 : popValue(values);
+	int left = popValue(values);
+	if (p.op == Alternative && !ops.empty())
+		ops.top().chosen = true;
+	int result = 0;
+	if (skipped == 0) {
+		switch (p.op) {
+		case And:
+			result = left != 0 && right != 0;
+			break;
+		case Or:
+			result = left != 0 || right != 0;
+			break;
+		case Alternative:
+			result = (values.empty() ? 0 : values.top()) ? left : right;
+			break;
+		case Conditional:
+			result = p.chosen ? right : (left ? right : 0);
+			break;
+		default:
+			if (info.kernel != NULL)
+				result = info.kernel(left, info.arity == 1 ? 0 : right);
+		}
+	}
+	values.push(result);
+}
+
+/*
+ * Helper function that puts an operator that has just been read onto ops,
+ * after applying the operators it closes off, as to_postfix does.
+ * The left operand of an infix operator is on top of values by then, so
+ * it can tell straight away whether its right operand is needed: not after
+ * false && or true ||, nor the first branch of a false ?, nor the second
+ * branch of a true one.
+ */
+void pushPending(Operator op, PendingStack & ops, ValueStack & values, int & skipped) {
+	const OperatorInfo & info = OperatorRegistry::get(op);
+	PendingOperator p = {op, false, false};
+	if (info.notation != Infix) {
+		ops.push(p);
+		return;
+	}
+	if (op == Alternative) {
+		while (!ops.empty() && ops.top().op != Conditional) {
+			bool finishedConditional = ops.top().op == Alternative;
+			applyPending(ops, values, skipped);
+			if (finishedConditional)
+				applyPending(ops, values, skipped);
+		}
+		if (!ops.empty() && ops.top().skipping) {
+			ops.top().skipping = false;
+			skipped--;
+		}
+		int whenTrue = popValue(values);
+		bool condition = !values.empty() && values.top() != 0;
+		values.push(whenTrue);
+		p.skipping = skipped == 0 && condition;
+	}
+	else {
+		while (!ops.empty() && ops.top().op != openParenthesis) {
+			const OperatorInfo & top = OperatorRegistry::get(Operator(ops.top().op));
+			if (top.precedence < info.precedence ||
+				(top.precedence == info.precedence && info.rightAssociative))
+				break;
+			applyPending(ops, values, skipped);
+		}
+		if (skipped == 0 && !values.empty()) {
+			if (op == And || op == Conditional)
+				p.skipping = values.top() == 0;
+			else if (op == Or)
+				p.skipping = values.top() != 0;
+		}
+	}
+	if (p.skipping)
+		skipped++;
+	ops.push(p);
+}
+
+/*
+ * Same as evaluateExpression(string, Bindings), for expressions without variables.
+ */
+int ExprTree::evaluateExpression(const string & expression) {
+	static const Bindings noVariables;
+	return evaluateExpression(expression, noVariables);
+}
+
+/*
+ * This function takes a string representing an expression and works out
+ * its value, giving the same result as
+ * buildTree(tokenise(expression)).evaluateWholeTree(variables), but without
+ * making a token list, a postfix list or a tree. It is meant for
+ * expressions that are evaluated once and thrown away.
+ *
+ * Algorithm:
+ * Read the tokens one at a time, the same way tokenise splits them up (so
+ * runs of digits with only spaces between them are one number), and put
+ * them through the steps of to_postfix. Where to_postfix would push a token
+ * onto the back of the postfix list, do what buildTree and evaluate would do
+ * with it instead:
+ *	A number or variable pushes its value onto a value stack.
+ *	An operator pops its operands off the value stack and pushes its result.
+ * Both stacks only hold what is still open, so they are as deep as the
+ * expression is nested, and they don't allocate until that is over 32.
+ * Like evaluate, the operands that && || and ?: don't need are not
+ * worked out (so 0 && 1 / 0 is 0): an operator whose next operand isn't
+ * needed marks itself skipping, and while any operator is skipping, the
+ * operators read are only popped and pushed back as 0 (see pushPending).
+ * Once it is applied (or, for ?, once its : is read) it stops skipping.
+ */
+int ExprTree::evaluateExpression(const string & expression, const Bindings & variables) {
+	PendingStack ops;
+	ValueStack values;
+	int skipped = 0;
+	bool afterOperand = false;
+	string token; //Reused for every word and symbol, which mostly fit in without allocating.
+	string::size_type i = 0;
+
+	while (i < expression.size()) {
+		char c = expression[i];
+		if (c == ' ') {
+			i++;
+			continue;
+		}
+		bool wasAfterOperand = afterOperand;
+		afterOperand = false;
+
+		if (isdigit(c)) {
+			long number = 0; //Worked out like atoi, which to_number uses, so it overflows in the same way.
+			while (i < expression.size()) {
+				if (isdigit(expression[i])) {
+					int digit = expression[i] - '0';
+					number = number > (LONG_MAX - digit) / 10 ? LONG_MAX : number * 10 + digit;
+					i++;
+					continue;
+				}
+				string::size_type next = expression.find_first_not_of(' ', i);
+				if (next == i || next == string::npos || !isdigit(expression[next]))
+					break;
+				i = next;
+			}
+			values.push(skipped == 0 ? (int)number : 0);
+			afterOperand = true;
+			continue;
+		}
+
+		string::size_type length = 1;
+		if (isletter(c)) {
+			while (i + length < expression.size() && (isletter(expression[i + length]) || isdigit(expression[i + length])))
+				length++;
+		}
+		else
+			length = OperatorRegistry::matchSymbol(expression, i);
+		token.assign(expression, i, length);
+		i += length;
+
+		if (c == '(')
+			ops.push(PendingOperator{openParenthesis, false, false});
+		else if (c == ',' || c == ')') {
+			while (!ops.empty() && ops.top().op != openParenthesis)
+				applyPending(ops, values, skipped);
+			if (c == ')') {
+				if (!ops.empty())
+					ops.pop();
+				if (!ops.empty() && ops.top().op != openParenthesis &&
+					OperatorRegistry::get(Operator(ops.top().op)).notation == Function)
+					applyPending(ops, values, skipped);
+				afterOperand = true;
+			}
+		}
+		else if (is_variable(token)) {
+			Bindings::const_iterator binding = variables.find(token);
+			values.push(skipped == 0 && binding != variables.end() ? binding->second : 0);
+			afterOperand = true;
+		}
+		else
+			pushPending(token == "-" && !wasAfterOperand ? Negate : OperatorRegistry::lookup(token), ops, values, skipped);
+	}
+
+	while (!ops.empty()) {
+		if (ops.top().op == openParenthesis)
+			ops.pop();
+		else
+			applyPending(ops, values, skipped);
+	}
+	return values.empty() ? 0 : values.top();
+}
+
+/*
+ * Recursive helper functions for the three orders below. Each one appends
+ * the notation of the subtree at n onto the back of out, so the whole
+ * expression is written into one string instead of joining copies of
+ * every subtree's string on the way back up.
+ * Unary operators (abs, neg) only have a left child.
+ * Deferred nodes are materialised as they are reached.
+ */
+void appendPrefix(TreeNode * n, string & out) {
+	ExprTree::materialise(n);
+	if (n->isValue() || n->isVariable()) {
+		out += n->toString();
+		return;
+	}
+	if (!n->isOperator())
+		return;
+	out += n->toString();
+	out += ' ';
+	appendPrefix(n->getLeftChild(), out);
+	if (!n->isUnary()) {
+		out += ' ';
+		appendPrefix(n->getRightChild(), out);
+	}
+}
+
+/*
+ * Function-call operators are written as min(a, b), max(a, b) and abs(a).
+ * A neg is written as a minus sign in front of its operand, which gets
+ * parentheses when it is a binary operator, e.g. -(1 + 2).
+ */
+void appendInfix(TreeNode * n, string & out) {
+	ExprTree::materialise(n);
+	if (n->isValue() || n->isVariable()) {
+		out += n->toString();
+		return;
+	}
+	if (!n->isOperator())
+		return;
+	if (n->getOperator() == Negate) {
+		TreeNode * operand = n->getLeftChild();
+		ExprTree::materialise(operand);
+		bool parenthesise = operand->isOperator() && !operand->isFunction() && !operand->isUnary();
+		out += '-';
+		if (parenthesise)
+			out += '(';
+		appendInfix(operand, out);
+		if (parenthesise)
+			out += ')';
+		return;
+	}
+	if (n->isFunction()) {
+		out += n->toString();
+		out += '(';
+		appendInfix(n->getLeftChild(), out);
+		if (!n->isUnary()) {
+			out += ", ";
+			appendInfix(n->getRightChild(), out);
+		}
+		out += ')';
+		return;
+	}
+	appendInfix(n->getLeftChild(), out);
+	out += ' ';
+	out += n->toString();
+	out += ' ';
+	appendInfix(n->getRightChild(), out);
+}
+
+/*
+ * Helper function that returns how tightly the subtree at n holds together
+ * when it is written in infix: the precedence of its operator, or a level
+ * above every operator for numbers, variables and function calls, which
+ * never need parentheses. A negative number is read back as a neg applied
+ * to a number, so it holds together like a neg.
+ */
+int bindingOf(TreeNode * n) {
+	const int atomic = 1000;
+	if (n->isValue())
+		return n->getValue() < 0 ? OperatorRegistry::get(Negate).precedence : atomic;
+	if (!n->isOperator() || n->isFunction())
+		return atomic;
+	return OperatorRegistry::get(n->getOperator()).precedence;
+}
+
+/*
+ * Returns true if child has to be put in parentheses when parent is written
+ * in infix, so that parsing the text gives the same tree back. This follows
+ * the way to_postfix decides whether to pop an operator:
+ *	The arguments of a function call and the middle of c ? a : b are
+ *	already closed off by the commas, parentheses and colon around them.
+ *	A left operand needs them if it binds more loosely than the parent, or
+ *	as loosely and the parent is right associative (e.g. (a ^ b) ^ c).
+ *	A right operand needs them if it binds more loosely than the parent, or
+ *	as loosely and it is left associative itself (e.g. a - (b - c)). A neg
+ *	(or negative number) on the right never does, since nothing before it
+ *	can take its operand away.
+ *	The operand of a neg needs them if it binds more loosely than the neg.
+ */
+bool ExprTree::needsParentheses(TreeNode * parent, TreeNode * child) {
+	if (parent->isFunction() || (parent->getOperator() == Alternative && child == parent->getLeftChild()))
+		return false;
+	bool left = parent->isUnary() || child == parent->getLeftChild();
+	if (!left && (child->isValue() || child->getOperator() == Negate))
+		return false;
+	const OperatorInfo & outer = OperatorRegistry::get(parent->getOperator());
+	int inner = bindingOf(child);
+	if (inner != outer.precedence)
+		return inner < outer.precedence;
+	if (parent->isUnary())
+		return false;
+	if (left)
+		return outer.rightAssociative;
+	return !OperatorRegistry::get(child->getOperator()).rightAssociative;
+}
+
+void appendParsableInfix(TreeNode * n, string & out);
+
+/*
+ * Appends the operand child of parent in infix with the fewest parentheses
+ * needed to read it back (see appendParsableInfix below).
+ */
+void appendOperand(TreeNode * parent, TreeNode * child, string & out) {
+	ExprTree::materialise(child);
+	bool parenthesise = ExprTree::needsParentheses(parent, child);
+	if (parenthesise)
+		out += '(';
+	appendParsableInfix(child, out);
+	if (parenthesise)
+		out += ')';
+}
+
+/*
+ * Same as appendInfix, except that operands are put in parentheses where
+ * needsParentheses says so, and the operand of a neg only gets them when
+ * it binds more loosely than the neg (e.g. -(1 + 2) but -2 ^ 3).
+ */
+void appendParsableInfix(TreeNode * n, string & out) {
+	ExprTree::materialise(n);
+	if (n->isValue() || n->isVariable()) {
+		out += n->toString();
+		return;
+	}
+	if (!n->isOperator())
+		return;
+	if (n->getOperator() == Negate) {
+		out += '-';
+		appendOperand(n, n->getLeftChild(), out);
+		return;
+	}
+	if (n->isFunction()) {
+		out += n->toString();
+		out += '(';
+		appendParsableInfix(n->getLeftChild(), out);
+		if (!n->isUnary()) {
+			out += ", ";
+			appendParsableInfix(n->getRightChild(), out);
+		}
+		out += ')';
+		return;
+	}
+	appendOperand(n, n->getLeftChild(), out);
+	out += ' ';
+	out += n->toString();
+	out += ' ';
+	appendOperand(n, n->getRightChild(), out);
+}
+
+void appendPostfix(TreeNode * n, string & out) {
+	ExprTree::materialise(n);
+	if (n->isValue() || n->isVariable()) {
+		out += n->toString();
+		return;
+	}
+	if (!n->isOperator())
+		return;
+	appendPostfix(n->getLeftChild(), out);
+	out += ' ';
+	if (!n->isUnary()) {
+		appendPostfix(n->getRightChild(), out);
+		out += ' ';
+	}
+	out += n->toString();
 }
 
 /*
@@ -270,16 +1134,10 @@ int ExprTree::evaluateWholeTree() {
  * prefix notation.
  */
 string ExprTree::prefixOrder(const ExprTree &t) {
-	switch (t.root->getOperator()) {
-	case Value: return t.root->toString();
-	case Plus:
-	case Minus:
-	case Times:
-	case Divide:
-		return t.root->toString() + " " + prefixOrder(t.root->getLeftChild()) + " " + prefixOrder(t.root->getRightChild());
-	default:
-		return "";
-	}
+	string out;
+	if (t.root != NULL)
+		appendPrefix(t.root, out);
+	return out;
 }
 
 /*
@@ -288,16 +1146,26 @@ string ExprTree::prefixOrder(const ExprTree &t) {
  * infix notation.
  */
 string ExprTree::infixOrder(const ExprTree &t) {
-	switch (t.root->getOperator()) {
-	case Value: return t.root->toString();
-	case Plus:
-	case Minus:
-	case Times:
-	case Divide:
-		return infixOrder(t.root->getLeftChild()) + " " + t.root->toString() + " " + infixOrder(t.root->getRightChild());
-	default:
-		return "";
-	}
+	string out;
+	if (t.root != NULL)
+		appendInfix(t.root, out);
+	return out;
+}
+
+/*
+ * Given an ExprTree t, this function returns a string that represents that
+ * same expression as the tree in infix notation, with only the parentheses
+ * needed for buildTree(tokenise(...)) to give the same tree back, e.g.
+ * (1 + 2) * 3 and a - (b - c), but 1 + 2 * 3 and a - b - c.
+ * The one tree it can't give back is a neg applied directly to a number,
+ * since buildTree folds that into a negative number.
+ * It takes time linear in the length of the output.
+ */
+string ExprTree::parsableInfixOrder(const ExprTree &t) {
+	string out;
+	if (t.root != NULL)
+		appendParsableInfix(t.root, out);
+	return out;
 }
 
 /*
@@ -306,29 +1174,63 @@ string ExprTree::infixOrder(const ExprTree &t) {
  * postfix notation.
  */
 string ExprTree::postfixOrder(const ExprTree &t) {
-	switch (t.root->getOperator()) {
-	case Value: return t.root->toString();
-	case Plus:
-	case Minus:
-	case Times:
-	case Divide:
-		return postfixOrder(t.root->getLeftChild()) + " " + postfixOrder(t.root->getRightChild()) + " " + t.root->toString();
-	default:
-		return "";
-	}
+	string out;
+	if (t.root != NULL)
+		appendPostfix(t.root, out);
+	return out;
 }
 
 /*
  * Returns the size of the tree. (i.e. the number of nodes in it)
  */
-int ExprTree::size() { return _size; }
+int ExprTree::size() const { return _size; }
 
 /*
  * Returns true if the tree contains no nodes. False otherwise.
  */
-bool ExprTree::isEmpty() { return _size == 0; }
+bool ExprTree::isEmpty() const { return _size == 0; }
 
 /*
  * Returns the root of the tree.
  */
-TreeNode * ExprTree::getRoot() { return root; }
+TreeNode * ExprTree::getRoot() const { return root; }
+
+/*
+ * Gives up ownership of the nodes and returns the root, leaving the tree empty.
+ * The caller becomes responsible for the nodes, e.g. by handing them to another ExprTree.
+ */
+TreeNode * ExprTree::release() {
+	TreeNode * r = root;
+	root = NULL;
+	_size = 0;
+	return r;
+}
+
+/*
+ * Return the nodes of the tree in preorder, inorder, postorder and level
+ * order, for use with range-based for (see TreeIterator).
+ */
+TreeRange ExprTree::preorder() const { return TreeRange(root, TreeIterator::Preorder); }
+
+TreeRange ExprTree::inorder() const { return TreeRange(root, TreeIterator::Inorder); }
+
+TreeRange ExprTree::postorder() const { return TreeRange(root, TreeIterator::Postorder); }
+
+TreeRange ExprTree::levelOrder() const { return TreeRange(root, TreeIterator::LevelOrder); }
+
+/*
+ * Return a copy of the subtree at n and delete the subtree at n, for code
+ * that works on subtrees rather than whole trees (see copyNodes and
+ * freeNodes).
+ */
+TreeNode * ExprTree::copySubtree(TreeNode * n) { return copyNodes(n, NULL); }
+
+void ExprTree::freeSubtree(TreeNode * n) { freeNodes(n); }
+
+/*
+ * Makes the destructor hand the nodes to reclaimer, which must outlive the
+ * tree, instead of deleting them. NULL goes back to deleting them.
+ */
+void ExprTree::setReclaimer(Reclaimer * reclaimer) {
+	this->reclaimer = reclaimer;
+}
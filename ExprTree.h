@@ -11,19 +11,38 @@
 #include <stack>
 #include <vector>
 #include <string>
+#include <map>
 #include <cstdlib> //This is include for the atoi() function used in the to_number(string) helper function.
 
 #include "TreeNode.h"
+#include "OperatorRegistry.h"
+#include "TreeIterator.h"
 
 /*
- * The four included data types have been imported into the
+ * The included data types have been imported into the
  * local namespace so you don't have to write std:: all the time.
  */
 using std::queue;
 using std::stack;
 using std::vector;
 using std::string;
+using std::map;
 
+/*
+ * The values of the variables in an expression, by name.
+ */
+typedef map<string, int> Bindings;
+
+class Reclaimer;
+
+/*
+ * Reading a tree doesn't change it, so any number of threads can read the
+ * same tree at once (evaluate it, write it out in any of the orders, or use
+ * the const methods here and in TreeNode) without copying or locking it, as
+ * long as no thread changes it (or registers an operator) meanwhile.
+ * The exception is a tree from buildLazyTree, since reading a Deferred node
+ * parses it in place: call materialiseAll on it before sharing it.
+ */
 class ExprTree{
 
  private:
@@ -31,6 +50,7 @@ class ExprTree{
   TreeNode * root; //The root of the tree! What a surprise :0.
   int _size; //The number of nodes in the tree. To keep things simple,
              //it's just an int.
+  Reclaimer * reclaimer; //If not NULL, the destructor hands the nodes to this to be freed in the background.
 
  public:
 
@@ -41,11 +61,25 @@ class ExprTree{
    */
   ExprTree();
   ExprTree(TreeNode *);
-  ~ExprTree();
+  ExprTree(const ExprTree &); //Copies every node, so the copy owns its own.
+  ExprTree & operator=(const ExprTree &);
+  ~ExprTree(); //Deletes every node (or hands them to the Reclaimer).
   static vector<string> tokenise(string);
-  static ExprTree buildTree(vector<string>);
-  static int evaluate(TreeNode *);
-  int evaluateWholeTree();
+  static vector<string> tokenise(string, vector<int> &); //Also gives the matching parenthesis of each parenthesis token.
+  static ExprTree buildTree(vector<string>); //Throws std::invalid_argument on a stray ',', ':' or ')', as do
+                                             //buildSubtree and buildLazyTree (when a group is parsed).
+  static TreeNode * buildSubtree(vector<string>, const vector<TreeNode *> &); //buildTree with "()" tokens standing for
+                                                                          //subtrees that are already built.
+  static ExprTree buildLazyTree(vector<string>, vector<int>); //buildTree that leaves parenthesised groups to be
+                                                             //parsed when they are first needed.
+  static void materialise(TreeNode *); //Parses a Deferred node in place. Other nodes are left alone.
+  static void materialiseAll(TreeNode *); //Parses every Deferred node in a subtree.
+  static int evaluate(const TreeNode *);
+  static int evaluate(const TreeNode *, const Bindings &);
+  int evaluateWholeTree() const;
+  int evaluateWholeTree(const Bindings &) const;
+  static int evaluateExpression(const string &); //Evaluates infix text in one pass, without building a tree.
+  static int evaluateExpression(const string &, const Bindings &);
   //static vector<string> to_postfix(vector<string>); //own declaration
 
   /*
@@ -57,10 +91,20 @@ class ExprTree{
    */
   static string prefixOrder(const ExprTree &);
   static string infixOrder(const ExprTree &);
+  static string parsableInfixOrder(const ExprTree &); //Infix with the parentheses needed to parse it back.
   static string postfixOrder(const ExprTree &);
-  int size();
-  bool isEmpty();
-  TreeNode * getRoot();
+  int size() const;
+  bool isEmpty() const;
+  TreeNode * getRoot() const;
+  TreeNode * release();
+  TreeRange preorder() const; //The nodes in each order, e.g. for (TreeNode * n : t.preorder()).
+  TreeRange inorder() const;
+  TreeRange postorder() const;
+  TreeRange levelOrder() const;
+  void setReclaimer(Reclaimer *); //Frees the nodes on the Reclaimer's thread instead of in the destructor.
+  static bool needsParentheses(TreeNode *, TreeNode *); //Whether a child needs parentheses under its parent in infix.
+  static TreeNode * copySubtree(TreeNode *); //Returns a copy of a subtree, whose root has no parent.
+  static void freeSubtree(TreeNode *); //Deletes every node of a subtree.
 
 };
 
@@ -0,0 +1,189 @@
+/* Generated file, do not edit */
+
+#ifndef CXXTEST_RUNNING
+#define CXXTEST_RUNNING
+#endif
+
+#define _CXXTEST_HAVE_STD
+#define _CXXTEST_HAVE_EH
+#define _CXXTEST_ABORT_TEST_ON_FAIL
+#include <cxxtest/TestListener.h>
+#include <cxxtest/TestTracker.h>
+#include <cxxtest/TestRunner.h>
+#include <cxxtest/RealDescriptions.h>
+#include <cxxtest/TestMain.h>
+#include <cxxtest/ErrorPrinter.h>
+
+int main( int argc, char *argv[] ) {
+ int status;
+    CxxTest::ErrorPrinter tmp;
+    CxxTest::RealWorldDescription::_worldName = "cxxtest";
+    status = CxxTest::Main< CxxTest::ErrorPrinter >( tmp, argc, argv );
+    return status;
+}
+bool suite_ExtensionTests_init = false;
+#include "ExtensionTests.h"
+
+static ExtensionTests suite_ExtensionTests;
+
+static CxxTest::List Tests_ExtensionTests = { 0, 0 };
+CxxTest::StaticSuiteDescription suiteDescription_ExtensionTests( "ExtensionTests.h", 39, "ExtensionTests", suite_ExtensionTests, Tests_ExtensionTests );
+
+static class TestDescription_suite_ExtensionTests_testPowerModuloAndFunctions : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testPowerModuloAndFunctions() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 43, "testPowerModuloAndFunctions" ) {}
+ void runTest() { suite_ExtensionTests.testPowerModuloAndFunctions(); }
+} testDescription_suite_ExtensionTests_testPowerModuloAndFunctions;
+
+static class TestDescription_suite_ExtensionTests_testComparisonsAndConditionals : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testComparisonsAndConditionals() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 74, "testComparisonsAndConditionals" ) {}
+ void runTest() { suite_ExtensionTests.testComparisonsAndConditionals(); }
+} testDescription_suite_ExtensionTests_testComparisonsAndConditionals;
+
+static class TestDescription_suite_ExtensionTests_testVariables : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testVariables() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 111, "testVariables" ) {}
+ void runTest() { suite_ExtensionTests.testVariables(); }
+} testDescription_suite_ExtensionTests_testVariables;
+
+static class TestDescription_suite_ExtensionTests_testRuleSet : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testRuleSet() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 134, "testRuleSet" ) {}
+ void runTest() { suite_ExtensionTests.testRuleSet(); }
+} testDescription_suite_ExtensionTests_testRuleSet;
+
+static class TestDescription_suite_ExtensionTests_testUnaryMinus : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testUnaryMinus() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 168, "testUnaryMinus" ) {}
+ void runTest() { suite_ExtensionTests.testUnaryMinus(); }
+} testDescription_suite_ExtensionTests_testUnaryMinus;
+
+static class TestDescription_suite_ExtensionTests_testOperatorRegistry : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testOperatorRegistry() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 194, "testOperatorRegistry" ) {}
+ void runTest() { suite_ExtensionTests.testOperatorRegistry(); }
+} testDescription_suite_ExtensionTests_testOperatorRegistry;
+
+static class TestDescription_suite_ExtensionTests_testGradientTape : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testGradientTape() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 223, "testGradientTape" ) {}
+ void runTest() { suite_ExtensionTests.testGradientTape(); }
+} testDescription_suite_ExtensionTests_testGradientTape;
+
+static class TestDescription_suite_ExtensionTests_testSuccinctTree : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testSuccinctTree() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 247, "testSuccinctTree" ) {}
+ void runTest() { suite_ExtensionTests.testSuccinctTree(); }
+} testDescription_suite_ExtensionTests_testSuccinctTree;
+
+static class TestDescription_suite_ExtensionTests_testIndexedPrefix : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testIndexedPrefix() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 297, "testIndexedPrefix" ) {}
+ void runTest() { suite_ExtensionTests.testIndexedPrefix(); }
+} testDescription_suite_ExtensionTests_testIndexedPrefix;
+
+static class TestDescription_suite_ExtensionTests_testParallelSerialiser : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testParallelSerialiser() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 325, "testParallelSerialiser" ) {}
+ void runTest() { suite_ExtensionTests.testParallelSerialiser(); }
+} testDescription_suite_ExtensionTests_testParallelSerialiser;
+
+static class TestDescription_suite_ExtensionTests_testParsableInfixOrder : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testParsableInfixOrder() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 397, "testParsableInfixOrder" ) {}
+ void runTest() { suite_ExtensionTests.testParsableInfixOrder(); }
+} testDescription_suite_ExtensionTests_testParsableInfixOrder;
+
+static class TestDescription_suite_ExtensionTests_testIncrementalParser : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testIncrementalParser() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 417, "testIncrementalParser" ) {}
+ void runTest() { suite_ExtensionTests.testIncrementalParser(); }
+} testDescription_suite_ExtensionTests_testIncrementalParser;
+
+static class TestDescription_suite_ExtensionTests_testTreeDiff : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testTreeDiff() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 523, "testTreeDiff" ) {}
+ void runTest() { suite_ExtensionTests.testTreeDiff(); }
+} testDescription_suite_ExtensionTests_testTreeDiff;
+
+static class TestDescription_suite_ExtensionTests_testLazyBuild : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testLazyBuild() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 574, "testLazyBuild" ) {}
+ void runTest() { suite_ExtensionTests.testLazyBuild(); }
+} testDescription_suite_ExtensionTests_testLazyBuild;
+
+static class TestDescription_suite_ExtensionTests_testReclaimer : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testReclaimer() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 645, "testReclaimer" ) {}
+ void runTest() { suite_ExtensionTests.testReclaimer(); }
+} testDescription_suite_ExtensionTests_testReclaimer;
+
+static class TestDescription_suite_ExtensionTests_testBatchEvaluator : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testBatchEvaluator() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 681, "testBatchEvaluator" ) {}
+ void runTest() { suite_ExtensionTests.testBatchEvaluator(); }
+} testDescription_suite_ExtensionTests_testBatchEvaluator;
+
+static class TestDescription_suite_ExtensionTests_testEvaluateExpression : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testEvaluateExpression() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 726, "testEvaluateExpression" ) {}
+ void runTest() { suite_ExtensionTests.testEvaluateExpression(); }
+} testDescription_suite_ExtensionTests_testEvaluateExpression;
+
+static class TestDescription_suite_ExtensionTests_testSharedReaders : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testSharedReaders() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 765, "testSharedReaders" ) {}
+ void runTest() { suite_ExtensionTests.testSharedReaders(); }
+} testDescription_suite_ExtensionTests_testSharedReaders;
+
+static class TestDescription_suite_ExtensionTests_testTreeIterators : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testTreeIterators() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 798, "testTreeIterators" ) {}
+ void runTest() { suite_ExtensionTests.testTreeIterators(); }
+} testDescription_suite_ExtensionTests_testTreeIterators;
+
+static class TestDescription_suite_ExtensionTests_testNativeRules : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testNativeRules() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 845, "testNativeRules" ) {}
+ void runTest() { suite_ExtensionTests.testNativeRules(); }
+} testDescription_suite_ExtensionTests_testNativeRules;
+
+static class TestDescription_suite_ExtensionTests_testTreeCache : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testTreeCache() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 886, "testTreeCache" ) {}
+ void runTest() { suite_ExtensionTests.testTreeCache(); }
+} testDescription_suite_ExtensionTests_testTreeCache;
+
+static class TestDescription_suite_ExtensionTests_testHeavyHitters : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testHeavyHitters() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 989, "testHeavyHitters" ) {}
+ void runTest() { suite_ExtensionTests.testHeavyHitters(); }
+} testDescription_suite_ExtensionTests_testHeavyHitters;
+
+static class TestDescription_suite_ExtensionTests_testNodeProfile : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testNodeProfile() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 1057, "testNodeProfile" ) {}
+ void runTest() { suite_ExtensionTests.testNodeProfile(); }
+} testDescription_suite_ExtensionTests_testNodeProfile;
+
+static class TestDescription_suite_ExtensionTests_testTraceRecorder : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testTraceRecorder() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 1105, "testTraceRecorder" ) {}
+ void runTest() { suite_ExtensionTests.testTraceRecorder(); }
+} testDescription_suite_ExtensionTests_testTraceRecorder;
+
+static class TestDescription_suite_ExtensionTests_testMetrics : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testMetrics() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 1167, "testMetrics" ) {}
+ void runTest() { suite_ExtensionTests.testMetrics(); }
+} testDescription_suite_ExtensionTests_testMetrics;
+
+static class TestDescription_suite_ExtensionTests_testStraySeparators : public CxxTest::RealTestDescription {
+public:
+ TestDescription_suite_ExtensionTests_testStraySeparators() : CxxTest::RealTestDescription( Tests_ExtensionTests, suiteDescription_ExtensionTests, 1272, "testStraySeparators" ) {}
+ void runTest() { suite_ExtensionTests.testStraySeparators(); }
+} testDescription_suite_ExtensionTests_testStraySeparators;
+
+#include <cxxtest/Root.cpp>
+const char* CxxTest::RealWorldDescription::_worldName = "cxxtest";
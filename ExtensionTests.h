@@ -0,0 +1,1312 @@
+#define CXXTEST_HAVE_EH
+#define CXXTEST_ABORT_TEST_ON_FAIL
+#include <cxxtest/TestSuite.h>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+
+#include "ExprTree.h"
+#include "RuleSet.h"
+#include "GradientTape.h"
+#include "SuccinctTree.h"
+#include "IndexedPrefix.h"
+#include "ParallelSerialiser.h"
+#include "IncrementalParser.h"
+#include "TreeDiff.h"
+#include "Reclaimer.h"
+#include "BatchEvaluator.h"
+#include "NativeRules.h"
+#include "TreeCache.h"
+#include "HeavyHitters.h"
+#include "NodeProfile.h"
+#include "TraceRecorder.h"
+#include "Metrics.h"
+#include <fstream>
+
+int shiftLeft(int a, int b) { return a << b; }
+int exclusiveOr(int a, int b) { return a ^ b; }
+
+/*
+ * Tests for the operators and features added on top of the
+ * original assignment (see Assignment1Tests.h for those).
+ */
+class ExtensionTests : public CxxTest::TestSuite{
+
+public:
+
+  void testPowerModuloAndFunctions(){
+
+    std::vector<std::string> output = ExprTree::tokenise("max(2, 3) ^ 2");
+
+    TS_ASSERT_EQUALS(output.size(), 8);
+    TS_ASSERT_EQUALS(output[0], "max");
+    TS_ASSERT_EQUALS(output[1], "(");
+    TS_ASSERT_EQUALS(output[3], ",");
+    TS_ASSERT_EQUALS(output[6], "^");
+
+    ExprTree t = ExprTree::buildTree(output);
+    TS_ASSERT_EQUALS(t.getRoot()->getOperator(), Power);
+    TS_ASSERT_EQUALS(t.getRoot()->getLeftChild()->getOperator(), Max);
+    TS_ASSERT_EQUALS(t.evaluateWholeTree(), 9);
+    TS_ASSERT_EQUALS(ExprTree::prefixOrder(t), "^ max 2 3 2");
+    TS_ASSERT_EQUALS(ExprTree::infixOrder(t), "max(2, 3) ^ 2");
+    TS_ASSERT_EQUALS(ExprTree::postfixOrder(t), "2 3 max 2 ^");
+
+    ExprTree rightAssoc = ExprTree::buildTree(ExprTree::tokenise("2 ^ 3 ^ 2"));
+    TS_ASSERT_EQUALS(rightAssoc.evaluateWholeTree(), 512);
+
+    ExprTree mixed = ExprTree::buildTree(ExprTree::tokenise("17 % 5 + min(abs(0 - 7), 3) * 2 ^ 10"));
+    TS_ASSERT_EQUALS(mixed.evaluateWholeTree(), 2 + 3 * 1024);
+    TS_ASSERT_EQUALS(ExprTree::prefixOrder(mixed), "+ % 17 5 * min abs - 0 7 3 ^ 2 10");
+    TS_ASSERT_EQUALS(ExprTree::postfixOrder(mixed), "17 5 % 0 7 - abs 3 min 2 10 ^ * +");
+
+    ExprTree negativeExp = ExprTree::buildTree(ExprTree::tokenise("2 ^ (0 - 1)"));
+    TS_ASSERT_EQUALS(negativeExp.evaluateWholeTree(), 0);
+
+  }
+
+  void testComparisonsAndConditionals(){
+
+    std::vector<std::string> output = ExprTree::tokenise("1<=2 && 3 != 4 || 5 == 6");
+
+    TS_ASSERT_EQUALS(output.size(), 11);
+    TS_ASSERT_EQUALS(output[1], "<=");
+    TS_ASSERT_EQUALS(output[3], "&&");
+    TS_ASSERT_EQUALS(output[5], "!=");
+    TS_ASSERT_EQUALS(output[7], "||");
+    TS_ASSERT_EQUALS(output[9], "==");
+
+    ExprTree t = ExprTree::buildTree(output);
+    TS_ASSERT_EQUALS(t.getRoot()->getOperator(), Or);
+    TS_ASSERT_EQUALS(t.getRoot()->getLeftChild()->getOperator(), And);
+    TS_ASSERT_EQUALS(t.evaluateWholeTree(), 1);
+
+    ExprTree cond = ExprTree::buildTree(ExprTree::tokenise("2 > 3 ? 10 : 4 < 5 ? 20 : 30"));
+    TS_ASSERT_EQUALS(cond.getRoot()->getOperator(), Conditional);
+    TS_ASSERT_EQUALS(cond.getRoot()->getRightChild()->getOperator(), Alternative);
+    TS_ASSERT_EQUALS(cond.evaluateWholeTree(), 20);
+    TS_ASSERT_EQUALS(ExprTree::prefixOrder(cond), "? > 2 3 : 10 ? < 4 5 : 20 30");
+    TS_ASSERT_EQUALS(ExprTree::postfixOrder(cond), "2 3 > 10 4 5 < 20 30 : ? : ?");
+
+    ExprTree nested = ExprTree::buildTree(ExprTree::tokenise("1 ? 0 ? 2 : 3 : 4"));
+    TS_ASSERT_EQUALS(ExprTree::postfixOrder(nested), "1 0 2 3 : ? 4 : ?");
+    TS_ASSERT_EQUALS(nested.evaluateWholeTree(), 3);
+
+    // Expensive or trapping operands must be short-circuited.
+    ExprTree guarded = ExprTree::buildTree(ExprTree::tokenise("0 == 0 ? 7 : 10 / 0"));
+    TS_ASSERT_EQUALS(guarded.evaluateWholeTree(), 7);
+    ExprTree shortAnd = ExprTree::buildTree(ExprTree::tokenise("0 && 10 % 0"));
+    TS_ASSERT_EQUALS(shortAnd.evaluateWholeTree(), 0);
+    ExprTree shortOr = ExprTree::buildTree(ExprTree::tokenise("2 || 1 / 0"));
+    TS_ASSERT_EQUALS(shortOr.evaluateWholeTree(), 1);
+
+  }
+
+  void testVariables(){
+
+    std::vector<std::string> output = ExprTree::tokenise("price1 * qty > 100");
+
+    TS_ASSERT_EQUALS(output.size(), 5);
+    TS_ASSERT_EQUALS(output[0], "price1");
+    TS_ASSERT_EQUALS(output[2], "qty");
+
+    ExprTree t = ExprTree::buildTree(output);
+    TS_ASSERT(t.getRoot()->getLeftChild()->getLeftChild()->isVariable());
+    TS_ASSERT(!t.getRoot()->getLeftChild()->getLeftChild()->isOperator());
+    TS_ASSERT_EQUALS(ExprTree::prefixOrder(t), "> * price1 qty 100");
+
+    Bindings event;
+    event["price1"] = 30;
+    event["qty"] = 4;
+    TS_ASSERT_EQUALS(t.evaluateWholeTree(event), 1);
+    event["qty"] = 3;
+    TS_ASSERT_EQUALS(t.evaluateWholeTree(event), 0);
+    TS_ASSERT_EQUALS(t.evaluateWholeTree(), 0);
+
+  }
+
+  void testRuleSet(){
+
+    RuleSet rules;
+    TS_ASSERT_EQUALS(rules.addRule("x > 10 && y < 5"), 0);
+    TS_ASSERT_EQUALS(rules.addRule("20 <= x"), 1);
+    TS_ASSERT_EQUALS(rules.addRule("y == 3 && x > 0"), 2);
+    TS_ASSERT_EQUALS(rules.addRule("x + y > 4"), 3);
+    for (int i = 0; i < 100; i++) {
+      std::stringstream stream;
+      stream << "x > " << (1000 + i);
+      rules.addRule(stream.str());
+    }
+    TS_ASSERT_EQUALS(rules.size(), 104);
+
+    Bindings event;
+    event["x"] = 20;
+    event["y"] = 3;
+
+    std::vector<int> matched = rules.match(event);
+    TS_ASSERT_EQUALS(matched.size(), 4);
+    TS_ASSERT_EQUALS(matched[0], 0);
+    TS_ASSERT_EQUALS(matched[1], 1);
+    TS_ASSERT_EQUALS(matched[2], 2);
+    TS_ASSERT_EQUALS(matched[3], 3);
+    TS_ASSERT_EQUALS(rules.candidates(event), 4);
+
+    event["x"] = 1050;
+    event["y"] = 9;
+    matched = rules.match(event);
+    TS_ASSERT_EQUALS(matched.size(), 52);
+    TS_ASSERT_EQUALS(rules.candidates(event), 53);
+
+  }
+
+  void testUnaryMinus(){
+
+    ExprTree literal = ExprTree::buildTree(ExprTree::tokenise("-5 * 3"));
+    TS_ASSERT_EQUALS(literal.size(), 3);
+    TS_ASSERT_EQUALS(literal.getRoot()->getLeftChild()->getValue(), -5);
+    TS_ASSERT_EQUALS(literal.evaluateWholeTree(), -15);
+    TS_ASSERT_EQUALS(ExprTree::prefixOrder(literal), "* -5 3");
+
+    ExprTree negate = ExprTree::buildTree(ExprTree::tokenise("2 * (-x) - -(1 + y)"));
+    TS_ASSERT_EQUALS(negate.getRoot()->getLeftChild()->getRightChild()->getOperator(), Negate);
+    TS_ASSERT_EQUALS(ExprTree::prefixOrder(negate), "- * 2 neg x neg + 1 y");
+    TS_ASSERT_EQUALS(ExprTree::infixOrder(negate), "2 * -x - -(1 + y)");
+    TS_ASSERT_EQUALS(ExprTree::postfixOrder(negate), "2 x neg * 1 y + neg -");
+
+    Bindings variables;
+    variables["x"] = 4;
+    variables["y"] = 2;
+    TS_ASSERT_EQUALS(negate.evaluateWholeTree(variables), -8 + 3);
+
+    TS_ASSERT_EQUALS(ExprTree::buildTree(ExprTree::tokenise("-2 ^ 2")).evaluateWholeTree(), -4);
+    TS_ASSERT_EQUALS(ExprTree::buildTree(ExprTree::tokenise("2 ^ -1 + 3 - -4")).evaluateWholeTree(), 7);
+    TS_ASSERT_EQUALS(ExprTree::buildTree(ExprTree::tokenise("max(-3, -7)")).evaluateWholeTree(), -3);
+    TS_ASSERT_EQUALS(ExprTree::buildTree(ExprTree::tokenise("1 < 2 ? -1 : 1")).evaluateWholeTree(), -1);
+
+  }
+
+  void testOperatorRegistry(){
+
+    TS_ASSERT_EQUALS(OperatorRegistry::lookup("<="), LessEqual);
+    TS_ASSERT_EQUALS(OperatorRegistry::lookup("max"), Max);
+    TS_ASSERT_EQUALS(OperatorRegistry::lookup("x"), NoOp);
+    TS_ASSERT_EQUALS(OperatorRegistry::get(Power).precedence, OperatorRegistry::get(Times).precedence + 2);
+    TS_ASSERT(OperatorRegistry::get(Power).rightAssociative);
+    TS_ASSERT_EQUALS(OperatorRegistry::get(Abs).arity, 1);
+
+    Operator shift = OperatorRegistry::registerOperator("<<", OperatorRegistry::get(Times).precedence, false, shiftLeft);
+    Operator xorOp = OperatorRegistry::registerOperator("xor", OperatorRegistry::get(Or).precedence, false, exclusiveOr);
+    TS_ASSERT(shift > NoOp);
+    TS_ASSERT(xorOp > shift);
+    TS_ASSERT_EQUALS(OperatorRegistry::registerOperator("+", 6, false, shiftLeft), NoOp);
+
+    std::vector<std::string> output = ExprTree::tokenise("1<<3 + 1 <= 9 xor 3");
+    TS_ASSERT_EQUALS(output.size(), 9);
+    TS_ASSERT_EQUALS(output[1], "<<");
+    TS_ASSERT_EQUALS(output[5], "<=");
+    TS_ASSERT_EQUALS(output[7], "xor");
+
+    ExprTree t = ExprTree::buildTree(output);
+    TS_ASSERT_EQUALS(t.getRoot()->getOperator(), xorOp);
+    TS_ASSERT_EQUALS(t.evaluateWholeTree(), 1 ^ 3);
+    TS_ASSERT_EQUALS(ExprTree::prefixOrder(t), "xor <= + << 1 3 1 9 3");
+    TS_ASSERT_EQUALS(ExprTree::infixOrder(t), "1 << 3 + 1 <= 9 xor 3");
+
+  }
+
+  void testGradientTape(){
+
+    ExprTree t = ExprTree::buildTree(ExprTree::tokenise("x * x * y + 3 * x - y ^ 2 / 5"));
+
+    RealBindings parameters;
+    parameters["x"] = 2;
+    parameters["y"] = 5;
+
+    GradientTape tape;
+    TS_ASSERT_DELTA(tape.evaluate(t.getRoot(), parameters), 20 + 6 - 5, 1e-9);
+    TS_ASSERT_EQUALS(tape.length(), 12);
+
+    std::map<std::string, double> gradient = tape.gradient();
+    TS_ASSERT_EQUALS(gradient.size(), 2);
+    TS_ASSERT_DELTA(gradient["x"], 2 * 2 * 5 + 3, 1e-9);
+    TS_ASSERT_DELTA(gradient["y"], 2 * 2 - 2 * 5 / 5.0, 1e-9);
+
+    ExprTree piecewise = ExprTree::buildTree(ExprTree::tokenise("x > 1 ? abs(-x) * 4 : max(x, 0)"));
+    tape.evaluate(piecewise.getRoot(), parameters);
+    TS_ASSERT_DELTA(tape.value(), 8, 1e-9);
+    TS_ASSERT_DELTA(tape.gradient()["x"], 4, 1e-9);
+
+  }
+
+  void testSuccinctTree(){
+
+    std::string expr = "x > 1 ? abs(-x) * 4 : max(x, 0) - -300";
+    for (int i = 0; i < 200; i++) {
+      std::stringstream stream;
+      stream << "(" << expr << ") " << "+-*%"[i % 4] << " " << (i * 37 % 1000 + 1);
+      if (i % 7 == 0)
+        stream << " && y <= " << i;
+      expr = stream.str();
+    }
+
+    ExprTree t = ExprTree::buildTree(ExprTree::tokenise(expr));
+    SuccinctTree s(t.getRoot());
+
+    TS_ASSERT_EQUALS(s.size(), t.size());
+    TS_ASSERT(s.memoryUsage() * 10 < t.size() * sizeof(TreeNode));
+
+    Bindings variables;
+    for (int x = -3; x <= 3; x++) {
+      variables["x"] = x;
+      variables["y"] = x * 50;
+      TS_ASSERT_EQUALS(s.evaluate(variables), t.evaluateWholeTree(variables));
+    }
+    TS_ASSERT_EQUALS(SuccinctTree::prefixOrder(s), ExprTree::prefixOrder(t));
+    TS_ASSERT_EQUALS(SuccinctTree::infixOrder(s), ExprTree::infixOrder(t));
+    TS_ASSERT_EQUALS(SuccinctTree::postfixOrder(s), ExprTree::postfixOrder(t));
+
+    TreeNode * n = t.getRoot();
+    int node = 0;
+    while (n->getRightChild() != NULL) {
+      TS_ASSERT_EQUALS(s.getOperator(node), n->getOperator());
+      node = s.getRightChild(node);
+      n = n->getRightChild();
+    }
+    TS_ASSERT_EQUALS(s.getValue(node), n->getValue());
+    TS_ASSERT_EQUALS(s.getRightChild(node), -1);
+    TS_ASSERT_EQUALS(s.subtreeSize(0), t.size());
+    TS_ASSERT_EQUALS(s.subtreeSize(s.getLeftChild(0)) + 2, t.size());
+    TS_ASSERT_EQUALS(s.getName(s.getLeftChild(s.getLeftChild(s.getLeftChild(0)))), "x");
+
+    ExprTree decoded(s.decode());
+    TS_ASSERT_EQUALS(decoded.size(), t.size());
+    TS_ASSERT_EQUALS(ExprTree::postfixOrder(decoded), ExprTree::postfixOrder(t));
+
+    SuccinctTree empty;
+    TS_ASSERT(empty.isEmpty());
+    TS_ASSERT_EQUALS(SuccinctTree::prefixOrder(empty), "");
+
+  }
+
+  void testIndexedPrefix(){
+
+    ExprTree small = ExprTree::buildTree(ExprTree::tokenise("2 * (3 + 4)"));
+    TS_ASSERT_EQUALS(IndexedPrefix::write(small), "*:9 2 +:3 3 4");
+
+    ExprTree t = ExprTree::buildTree(ExprTree::tokenise("(x > 1 ? -x : 1 / 0) * max(10 - 2 ^ 3, abs(-4)) - 7 % 5"));
+    std::string s = IndexedPrefix::write(t);
+
+    Bindings variables;
+    variables["x"] = 9;
+    TS_ASSERT_EQUALS(IndexedPrefix::evaluate(s, 0, variables), t.evaluateWholeTree(variables));
+    TS_ASSERT_EQUALS(IndexedPrefix::skip(s, 0), s.size());
+
+    size_t maxCall = IndexedPrefix::find(s, "LR");
+    TS_ASSERT_DIFFERS(maxCall, std::string::npos);
+    TS_ASSERT_EQUALS(IndexedPrefix::extract(s, maxCall), "max:24 -:10 10 ^:3 2 3 abs:2 -4");
+    TS_ASSERT_EQUALS(IndexedPrefix::evaluate(s, maxCall), 4);
+    TS_ASSERT_EQUALS(IndexedPrefix::evaluate(s, IndexedPrefix::find(s, "LRLR")), 8);
+    TS_ASSERT_EQUALS(IndexedPrefix::find(s, "LRRR"), std::string::npos);
+    TS_ASSERT_EQUALS(IndexedPrefix::find(s, "RRL"), std::string::npos);
+    TS_ASSERT_EQUALS(IndexedPrefix::extract(s, IndexedPrefix::find(s, "LLRL")), "neg:1 x");
+
+    ExprTree rebuilt(IndexedPrefix::toTree(s, 0));
+    TS_ASSERT_EQUALS(rebuilt.size(), t.size());
+    TS_ASSERT_EQUALS(ExprTree::prefixOrder(rebuilt), ExprTree::prefixOrder(t));
+
+  }
+
+  void testParallelSerialiser(){
+
+    std::string expr = "x > 1 ? abs(-x) * 4 : max(x, 0) - -300";
+    for (int i = 0; i < 12; i++)
+      expr = "(" + expr + ") " + "+-*/"[i % 4] + " -(y % " + expr + ")";
+
+    ExprTree t = ExprTree::buildTree(ExprTree::tokenise(expr));
+    TS_ASSERT(t.size() > 10000);
+
+    unsigned threads[] = {1, 2, 3, 8};
+    for (int i = 0; i < 4; i++) {
+      TS_ASSERT_EQUALS(ParallelSerialiser::prefixOrder(t, threads[i]), ExprTree::prefixOrder(t));
+      TS_ASSERT_EQUALS(ParallelSerialiser::infixOrder(t, threads[i]), ExprTree::infixOrder(t));
+      TS_ASSERT_EQUALS(ParallelSerialiser::parsableInfixOrder(t, threads[i]), ExprTree::parsableInfixOrder(t));
+      TS_ASSERT_EQUALS(ParallelSerialiser::postfixOrder(t, threads[i]), ExprTree::postfixOrder(t));
+    }
+
+    ExprTree small = ExprTree::buildTree(ExprTree::tokenise("-(1 + 2) * min(3, 4)"));
+    TS_ASSERT_EQUALS(ParallelSerialiser::infixOrder(small), ExprTree::infixOrder(small));
+    ExprTree empty;
+    TS_ASSERT_EQUALS(ParallelSerialiser::postfixOrder(empty), "");
+
+    //A long left-deep chain, 1 + 2 - 3 + ..., which has to be cut along its
+    //length to be shared out, and is too deep to write recursively.
+    std::string chain = "1", prefix, postfix = "1";
+    for (int i = 2; i <= 100000; i++) {
+      const char * op = i % 2 ? "-" : "+";
+      std::string digit(1, '0' + i % 10);
+      chain += std::string(" ") + op + " " + digit;
+      prefix += std::string(op) + " ";
+      postfix += " " + digit + " " + op;
+    }
+    for (int i = 1; i <= 100000; i++)
+      prefix += std::string(i > 1 ? " " : "") + char('0' + i % 10);
+    ExprTree deep = ExprTree::buildTree(ExprTree::tokenise(chain));
+    for (int i = 0; i < 4; i++) {
+      TS_ASSERT_EQUALS(ParallelSerialiser::prefixOrder(deep, threads[i]), prefix);
+      TS_ASSERT_EQUALS(ParallelSerialiser::infixOrder(deep, threads[i]), chain);
+      TS_ASSERT_EQUALS(ParallelSerialiser::parsableInfixOrder(deep, threads[i]), chain);
+      TS_ASSERT_EQUALS(ParallelSerialiser::postfixOrder(deep, threads[i]), postfix);
+    }
+
+  }
+
+  TreeNode * randomTree(int depth){
+    static const Operator operators[] = {Plus, Minus, Times, Divide, Power, Modulo, Min, Abs, Negate,
+                                         Less, Equal, And, Or, Conditional};
+    if (depth == 0 || std::rand() % 4 == 0) {
+      if (std::rand() % 3 == 0)
+        return new TreeNode(std::string(1, "xyz"[std::rand() % 3]));
+      return new TreeNode(std::rand() % 200 - 50);
+    }
+    TreeNode * n = new TreeNode(operators[std::rand() % 14]);
+    TreeNode * left = randomTree(depth - 1);
+    if (n->getOperator() == Negate && left->isValue()) {
+      delete n;
+      return left;
+    }
+    n->setLeftChild(left);
+    if (n->isUnary())
+      return n;
+    TreeNode * right = randomTree(depth - 1);
+    if (n->getOperator() == Conditional) {
+      TreeNode * branches = new TreeNode(Alternative);
+      branches->setLeftChild(right);
+      branches->setRightChild(randomTree(depth - 1));
+      right = branches;
+    }
+    n->setRightChild(right);
+    return n;
+  }
+
+  void testParsableInfixOrder(){
+
+    const char * expressions[] = {"(1 + 2) * 3", "1 + 2 * 3", "a - (b - c)", "a - b - c", "2 ^ 3 ^ 2",
+                                  "(2 ^ 3) ^ 2", "(-x) ^ 2", "-x ^ 2", "-(a + b)", "2 ^ -x * 3",
+                                  "c ? x ? 1 : 2 : y ? 3 : 4", "(c ? 1 : 2) ? 3 : 4", "(a || b) && c",
+                                  "max(a - b, c ? 1 : 2) * -abs(-3)"};
+    for (int i = 0; i < 14; i++) {
+      ExprTree t = ExprTree::buildTree(ExprTree::tokenise(expressions[i]));
+      TS_ASSERT_EQUALS(ExprTree::parsableInfixOrder(t), expressions[i]);
+    }
+
+    std::srand(85);
+    for (int i = 0; i < 500; i++) {
+      ExprTree t(randomTree(6));
+      ExprTree parsed = ExprTree::buildTree(ExprTree::tokenise(ExprTree::parsableInfixOrder(t)));
+      TS_ASSERT_EQUALS(ExprTree::prefixOrder(parsed), ExprTree::prefixOrder(t));
+    }
+
+  }
+
+  void testIncrementalParser(){
+
+    std::string expr = "x > 1 ? abs(-x) * 4 : max(x, (0)) - -300";
+    for (int i = 0; i < 100; i++) {
+      std::stringstream stream;
+      stream << "(" << expr << ") " << "+-*%"[i % 4] << " (" << (i * 37 % 1000 + 1) << " - y)";
+      expr = stream.str();
+    }
+
+    IncrementalParser p;
+    p.parse(expr);
+    int fullParse = p.tokensParsed();
+    ExprTree view(p.getRoot());
+    TS_ASSERT_EQUALS(ExprTree::prefixOrder(view), ExprTree::prefixOrder(ExprTree::buildTree(ExprTree::tokenise(expr))));
+    view.release();
+
+    const char * numbers[] = {"7", "23 - 4", "y", "-5", "(1 + x)", "max(2, y)"};
+    const char * operators[] = {"+", "*", "-", "%", "^", "&&"};
+    std::srand(86);
+    for (int i = 0; i < 300; i++) {
+      size_t pos = std::rand() % expr.size();
+      size_t count = 1;
+      std::string replacement;
+      if (isdigit(expr[pos])) {
+        while (pos > 0 && isdigit(expr[pos - 1]))
+          pos--;
+        while (isdigit(expr[pos + count]))
+          count++;
+        replacement = numbers[std::rand() % 6];
+      } else if (expr[pos] == '+' || expr[pos] == '*' || expr[pos] == '%') {
+        replacement = operators[std::rand() % 6];
+      } else {
+        continue;
+      }
+      expr.replace(pos, count, replacement);
+
+      p.edit(pos, count, replacement);
+      TS_ASSERT_EQUALS(p.getText(), expr);
+      ExprTree updated(p.getRoot());
+      TS_ASSERT_EQUALS(ExprTree::prefixOrder(updated), ExprTree::prefixOrder(ExprTree::buildTree(ExprTree::tokenise(expr))));
+      updated.release();
+    }
+
+    p.edit(expr.find("300"), 3, "9");
+    TS_ASSERT(p.tokensParsed() * 20 < fullParse);
+
+    //Edits in a group whose root is also the root of a group inside it.
+    const char * texts[] = {"(x-9 94)", "2 * ((a + b))", "((x - 1))", "max(((y)), 2) + ((1 * 3))"};
+    size_t positions[] = {0, 5, 1, 17};
+    const char * insertions[] = {"-", "1 + ", "3 * ", "2 ^ "};
+    for (int i = 0; i < 4; i++) {
+      IncrementalParser nested;
+      nested.parse(texts[i]);
+      nested.edit(positions[i], 0, insertions[i]);
+      std::string edited = texts[i];
+      edited.insert(positions[i], insertions[i]);
+      TS_ASSERT_EQUALS(nested.getText(), edited);
+      TS_ASSERT(nested.getRoot()->getParent() == NULL);
+      ExprTree tree(nested.getRoot());
+      TS_ASSERT_EQUALS(ExprTree::prefixOrder(tree), ExprTree::prefixOrder(ExprTree::buildTree(ExprTree::tokenise(edited))));
+      for (TreeNode * n : tree.preorder()) {
+        if (n->getLeftChild() != NULL)
+          TS_ASSERT(n->getLeftChild()->getParent() == n);
+        if (n->getRightChild() != NULL)
+          TS_ASSERT(n->getRightChild()->getParent() == n);
+      }
+      tree.release();
+    }
+
+    //Edits that make the text unparsable leave the text and the tree as they were: one in a
+    //kept group, one in a function call's arguments, and one that needs a full parse.
+    const char * before = "max(1, 2) * (4 - (5 + y)) ^ ((x * 2))";
+    size_t at[] = {15, 8, 18};
+    const char * stray[] = {" :", " : 7", " )"};
+    IncrementalParser unchanged;
+    unchanged.parse(before);
+    for (int i = 0; i < 3; i++) {
+      bool rejected = false;
+      try {
+        unchanged.edit(at[i], 0, stray[i]);
+      } catch (const std::invalid_argument &) {
+        rejected = true;
+      }
+      TS_ASSERT(rejected);
+      TS_ASSERT_EQUALS(unchanged.getText(), before);
+      TS_ASSERT(unchanged.getRoot()->getParent() == NULL);
+      ExprTree tree(unchanged.getRoot());
+      TS_ASSERT_EQUALS(ExprTree::prefixOrder(tree), ExprTree::prefixOrder(ExprTree::buildTree(ExprTree::tokenise(before))));
+      for (TreeNode * n : tree.preorder()) {
+        if (n->getLeftChild() != NULL)
+          TS_ASSERT(n->getLeftChild()->getParent() == n);
+        if (n->getRightChild() != NULL)
+          TS_ASSERT(n->getRightChild()->getParent() == n);
+      }
+      tree.release();
+    }
+    unchanged.edit(13, 1, "6");
+    std::string after = before;
+    after.replace(13, 1, "6");
+    TS_ASSERT_EQUALS(unchanged.getText(), after);
+    ExprTree edited(unchanged.getRoot());
+    TS_ASSERT_EQUALS(ExprTree::prefixOrder(edited), ExprTree::prefixOrder(ExprTree::buildTree(ExprTree::tokenise(after))));
+    edited.release();
+
+  }
+
+  void testTreeDiff(){
+
+    ExprTree a = ExprTree::buildTree(ExprTree::tokenise("(x + 1) * max(y, 2) - abs(z) / 4"));
+    ExprTree b = ExprTree::buildTree(ExprTree::tokenise("(x + 7) * min(y, 2) - (z % 3) / 4"));
+
+    TS_ASSERT_EQUALS(TreeDiff::hash(a.getRoot()), TreeDiff::hash(ExprTree::buildTree(ExprTree::tokenise("(x + 1) * max(y, 2) - abs(z) / 4")).getRoot()));
+    TS_ASSERT_DIFFERS(TreeDiff::hash(a.getRoot()), TreeDiff::hash(b.getRoot()));
+    TS_ASSERT_DIFFERS(TreeDiff::hash(a.getRoot()->getLeftChild()->getLeftChild()),
+                      TreeDiff::hash(ExprTree::buildTree(ExprTree::tokenise("1 + x")).getRoot()));
+    TS_ASSERT(TreeDiff::diff(a.getRoot(), a.getRoot()).empty());
+
+    std::vector<TreeDiff::Edit> edits = TreeDiff::diff(a.getRoot(), b.getRoot());
+    TS_ASSERT_EQUALS(edits.size(), 3);
+    TS_ASSERT_EQUALS(edits[0].kind, TreeDiff::ChangedLeaf);
+    TS_ASSERT_EQUALS(edits[0].path, "LLR");
+    TS_ASSERT_EQUALS(edits[0].after->getValue(), 7);
+    TS_ASSERT_EQUALS(edits[1].kind, TreeDiff::ChangedOperator);
+    TS_ASSERT_EQUALS(edits[1].path, "LR");
+    TS_ASSERT_EQUALS(edits[2].kind, TreeDiff::ReplacedSubtree);
+    TS_ASSERT_EQUALS(edits[2].path, "RL");
+
+    ExprTree patched(TreeDiff::patch(ExprTree::buildTree(ExprTree::tokenise("(x + 1) * max(y, 2) - abs(z) / 4")).release(), edits));
+    TS_ASSERT_EQUALS(ExprTree::prefixOrder(patched), ExprTree::prefixOrder(b));
+
+    for (int i = 0; i < 300; i++) {
+      std::srand(1000 + i);
+      ExprTree before(randomTree(6));
+      std::srand(1000 + i);
+      ExprTree after(randomTree(6));
+      for (int changes = i % 4; changes > 0; changes--) {
+        TreeNode * n = after.getRoot();
+        while (n->getLeftChild() != NULL) {
+          TreeNode * next = (n->getRightChild() != NULL && std::rand() % 2) ? n->getRightChild() : n->getLeftChild();
+          if (next->getLeftChild() == NULL && std::rand() % 2) {
+            if (next == n->getLeftChild())
+              n->setLeftChild(std::rand() % 2 ? new TreeNode(std::rand() % 9) : randomTree(2));
+            else
+              n->setRightChild(new TreeNode("w"));
+            break;
+          }
+          n = next;
+        }
+      }
+      std::vector<TreeDiff::Edit> script = TreeDiff::diff(before.getRoot(), after.getRoot());
+      TS_ASSERT_EQUALS(script.empty(), ExprTree::prefixOrder(before) == ExprTree::prefixOrder(after));
+      ExprTree result(TreeDiff::patch(before.release(), script));
+      TS_ASSERT_EQUALS(ExprTree::prefixOrder(result), ExprTree::prefixOrder(after));
+    }
+
+  }
+
+  void testLazyBuild(){
+
+    std::vector<int> matches;
+    std::vector<std::string> tokens = ExprTree::tokenise("max(1, 2) * (3 + (4 - 5))", matches);
+    TS_ASSERT_EQUALS(matches[1], 5);
+    TS_ASSERT_EQUALS(matches[5], 1);
+    TS_ASSERT_EQUALS(matches[7], 15);
+    TS_ASSERT_EQUALS(matches[10], 14);
+    TS_ASSERT_EQUALS(matches[0], -1);
+
+    std::string left = "x > 1 ? abs(-x) * 4 : max(x, (0)) - -300";
+    std::string right = left;
+    for (int i = 0; i < 50; i++) {
+      std::stringstream stream;
+      stream << "(" << left << ") " << "+-*%"[i % 4] << " -(y - (" << i << " + 2 * y))";
+      left = stream.str();
+      right = "-(-(" + right + "))";
+    }
+    std::string expr = "y > 100 ? (" + left + ") : (" + right + ") - ((((7))))";
+
+    Bindings variables;
+    variables["x"] = 3;
+    variables["y"] = 200;
+    ExprTree eager = ExprTree::buildTree(ExprTree::tokenise(expr));
+    tokens = ExprTree::tokenise(expr, matches);
+    ExprTree lazy = ExprTree::buildLazyTree(tokens, matches);
+    TS_ASSERT(lazy.size() < 10);
+    TS_ASSERT_EQUALS(lazy.getRoot()->getRightChild()->getLeftChild()->getOperator(), Deferred);
+
+    TS_ASSERT_EQUALS(lazy.evaluateWholeTree(variables), eager.evaluateWholeTree(variables));
+    TS_ASSERT(lazy.getRoot()->getRightChild()->getLeftChild()->isOperator());
+    TS_ASSERT_EQUALS(lazy.getRoot()->getRightChild()->getRightChild()->getLeftChild()->getOperator(), Deferred);
+
+    TS_ASSERT_EQUALS(ExprTree::infixOrder(lazy), ExprTree::infixOrder(eager));
+    TS_ASSERT_EQUALS(ExprTree::prefixOrder(lazy), ExprTree::prefixOrder(eager));
+
+    ExprTree lazyAgain = ExprTree::buildLazyTree(tokens, matches);
+    TS_ASSERT_EQUALS(ParallelSerialiser::parsableInfixOrder(lazyAgain, 4), ExprTree::parsableInfixOrder(eager));
+    ExprTree lazyOnceMore = ExprTree::buildLazyTree(tokens, matches);
+    ExprTree::materialiseAll(lazyOnceMore.getRoot());
+    TS_ASSERT_EQUALS(TreeDiff::hash(lazyOnceMore.getRoot()), TreeDiff::hash(eager.getRoot()));
+
+    //The other readers of trees parse Deferred nodes as they reach them too.
+    ExprTree lazyToHash = ExprTree::buildLazyTree(tokens, matches);
+    TS_ASSERT_EQUALS(TreeDiff::hash(lazyToHash.getRoot()), TreeDiff::hash(eager.getRoot()));
+    std::vector<int> otherMatches;
+    std::vector<std::string> otherTokens = ExprTree::tokenise("x + (1 + 2 + 3 + 4 + 5)", otherMatches);
+    ExprTree group = ExprTree::buildLazyTree(otherTokens, otherMatches);
+    otherTokens = ExprTree::tokenise("x + (1 + 2 + 3 + 4 + 6)", otherMatches);
+    ExprTree otherGroup = ExprTree::buildLazyTree(otherTokens, otherMatches);
+    TS_ASSERT_EQUALS(group.getRoot()->getRightChild()->getOperator(), Deferred);
+    TS_ASSERT_DIFFERS(TreeDiff::hash(group.getRoot()), TreeDiff::hash(otherGroup.getRoot()));
+    ExprTree lazyToDiff = ExprTree::buildLazyTree(tokens, matches);
+    TS_ASSERT(TreeDiff::diff(lazyToDiff.getRoot(), eager.getRoot()).empty());
+
+    ExprTree lazyToWrite = ExprTree::buildLazyTree(tokens, matches);
+    TS_ASSERT_EQUALS(IndexedPrefix::write(lazyToWrite), IndexedPrefix::write(eager));
+
+    ExprTree lazyToEncode = ExprTree::buildLazyTree(tokens, matches);
+    TS_ASSERT_EQUALS(SuccinctTree::prefixOrder(SuccinctTree(lazyToEncode.getRoot())), ExprTree::prefixOrder(eager));
+
+    ExprTree lazyToRecord = ExprTree::buildLazyTree(tokens, matches);
+    RealBindings real;
+    real["x"] = 3;
+    real["y"] = 200;
+    GradientTape eagerTape, lazyTape;
+    TS_ASSERT_EQUALS(lazyTape.evaluate(lazyToRecord.getRoot(), real), eagerTape.evaluate(eager.getRoot(), real));
+    TS_ASSERT(lazyTape.gradient() == eagerTape.gradient());
+
+  }
+
+  void testReclaimer(){
+
+    Reclaimer reclaimer(2, 100); //Declared first, so it outlives the trees that use it.
+    std::string expr = "1";
+    for (int i = 0; i < 2000; i++)
+      expr += " + x";
+    ExprTree original = ExprTree::buildTree(ExprTree::tokenise(expr));
+    ExprTree copy(original);
+    TS_ASSERT(copy.getRoot() != original.getRoot());
+    TS_ASSERT_EQUALS(copy.size(), 4001);
+    TS_ASSERT_EQUALS(copy.getRoot()->getLeftChild()->getParent(), copy.getRoot());
+    ExprTree assigned = ExprTree::buildTree(ExprTree::tokenise("2 * 3"));
+    assigned = copy;
+    TS_ASSERT_EQUALS(ExprTree::prefixOrder(assigned), ExprTree::prefixOrder(original));
+
+    for (int i = 0; i < 10; i++) {
+      ExprTree t = ExprTree::buildTree(ExprTree::tokenise(expr));
+      t.setReclaimer(&reclaimer);
+    }
+    copy.setReclaimer(&reclaimer);
+    reclaimer.reclaim(assigned.release());
+    reclaimer.drain();
+    Reclaimer::Stats stats = reclaimer.getStats();
+    TS_ASSERT_EQUALS(stats.treesQueued, 11);
+    TS_ASSERT_EQUALS(stats.treesFreed, 11);
+    TS_ASSERT_EQUALS(stats.nodesFreed, 11 * 4001);
+    TS_ASSERT(stats.batches >= 11 * 41);
+    TS_ASSERT(stats.maxQueueDepth <= 2);
+
+    Bindings variables;
+    variables["x"] = 1;
+    TS_ASSERT_EQUALS(copy.evaluateWholeTree(variables), 2001);
+    TS_ASSERT_EQUALS(original.evaluateWholeTree(variables), 2001);
+
+  }
+
+  void testBatchEvaluator(){
+
+    NodeArena arena;
+    NodeArena * previous = NodeArena::use(&arena);
+    TreeNode * inArena = ExprTree::buildTree(ExprTree::tokenise("max(x, 2) * (3 - y)")).release();
+    NodeArena::use(previous);
+    TS_ASSERT(arena.bytesReserved() >= NodeArena::chunkSize);
+    ExprTree onHeap = ExprTree::buildTree(ExprTree::tokenise("max(x, 2) * (3 - y)"));
+    Bindings variables;
+    variables["x"] = 5;
+    variables["y"] = -1;
+    TS_ASSERT_EQUALS(ExprTree::evaluate(inArena, variables), 20);
+    delete new ExprTree(inArena);
+    arena.reset();
+    TS_ASSERT_EQUALS(onHeap.evaluateWholeTree(variables), 20);
+
+    BatchEvaluator batch(2);
+    TS_ASSERT(batch.nodeCount() >= 1);
+    TS_ASSERT_EQUALS(batch.workerCount(0), 2);
+    std::vector<std::string> expressions;
+    for (int i = 0; i < 1000; i++) {
+      std::stringstream stream;
+      stream << i << " * x - max(" << i % 7 << ", y) + (" << i << " > 500 ? 1 : -(2 ^ 3))";
+      expressions.push_back(stream.str());
+    }
+    std::vector<int> results = batch.evaluate(expressions, variables);
+    TS_ASSERT_EQUALS(results.size(), 1000u);
+    for (size_t i = 0; i < expressions.size(); i++)
+      TS_ASSERT_EQUALS(results[i], ExprTree::buildTree(ExprTree::tokenise(expressions[i])).evaluateWholeTree(variables));
+    TS_ASSERT(batch.evaluate(std::vector<std::string>(), variables).empty());
+
+    //An expression that can't be parsed throws on the calling thread, and the workers carry on.
+    expressions[700] = "1 ? (2 : 3)";
+    bool rejected = false;
+    try {
+      batch.evaluate(expressions, variables);
+    } catch (const std::invalid_argument &) {
+      rejected = true;
+    }
+    TS_ASSERT(rejected);
+    expressions[700] = "7";
+    TS_ASSERT_EQUALS(batch.evaluate(expressions, variables)[700], 7);
+
+  }
+
+  void testEvaluateExpression(){
+
+    const char * expressions[] = {"1 + 2 * 3", "12 34 + 1", "2 ^ 3 ^ 2", "-2 ^ 2", "7 - -3", "-(4 - 9) % 4",
+                                  "max(x, -y) * abs(-3)", "min(2, max(1, 3)) - 10 / 3", "x > 1 ? y : z",
+                                  "c ? x ? 1 : 2 : y ? 3 : 4", "(c ? 1 : 2) ? 3 : 4", "0 ? 5", "(x || 0) && y",
+                                  "0 && 1 / 0", "1 || 5 % 0", "1 ? 2 : 3 / 0", "0 ? 3 / 0 : 4", "x < 0 && (1 / 0 + 2)",
+                                  "c ? 1 % 0 : (0 ? 1 / 0 : 5)", "99999999999 + 1", "x <= y == (z != 2)"};
+    Bindings variables;
+    variables["x"] = 3;
+    variables["y"] = -4;
+    variables["z"] = 2;
+    for (int i = 0; i < 21; i++)
+      TS_ASSERT_EQUALS(ExprTree::evaluateExpression(expressions[i], variables),
+                       ExprTree::buildTree(ExprTree::tokenise(expressions[i])).evaluateWholeTree(variables));
+    TS_ASSERT_EQUALS(ExprTree::evaluateExpression("0 && 1 / 0"), 0);
+    TS_ASSERT_EQUALS(ExprTree::evaluateExpression("c ? 1 % 0 : (0 ? 1 / 0 : 5)", variables), 5);
+
+    std::string deep = "1";
+    for (int i = 0; i < 200; i++) {
+      std::stringstream stream;
+      stream << "(" << deep << " - " << i << ") ^ 1";
+      deep = stream.str();
+    }
+    TS_ASSERT_EQUALS(ExprTree::evaluateExpression(deep), ExprTree::buildTree(ExprTree::tokenise(deep)).evaluateWholeTree());
+
+    std::srand(91);
+    int compared = 0;
+    for (int i = 0; i < 3000; i++) {
+      ExprTree t(randomTree(5));
+      std::string text = ExprTree::parsableInfixOrder(t);
+      if (text.find_first_of("/%") != std::string::npos)
+        continue;
+      TS_ASSERT_EQUALS(ExprTree::evaluateExpression(text, variables), t.evaluateWholeTree(variables));
+      compared++;
+    }
+    TS_ASSERT(compared > 100);
+
+  }
+
+  void testSharedReaders(){
+
+    std::string expr = "x";
+    for (int i = 0; i < 300; i++) {
+      std::stringstream stream;
+      stream << "(" << expr << ") " << "+-*<"[i % 4] << " max(y, " << i << ")";
+      expr = stream.str();
+    }
+    const ExprTree tree = ExprTree::buildTree(ExprTree::tokenise(expr));
+    Bindings variables;
+    variables["x"] = 2;
+    variables["y"] = 150;
+    int expected = tree.evaluateWholeTree(variables);
+    std::string prefix = ExprTree::prefixOrder(tree);
+    TS_ASSERT_EQUALS(tree.getRoot()->getOperator(), Less);
+    TS_ASSERT(!tree.isEmpty());
+
+    std::atomic<int> mismatches(0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 8; t++)
+      readers.push_back(std::thread([&]() {
+        for (int i = 0; i < 20; i++)
+          if (tree.evaluateWholeTree(variables) != expected)
+            mismatches++;
+        if (ExprTree::prefixOrder(tree) != prefix || IndexedPrefix::write(tree).empty())
+          mismatches++;
+      }));
+    for (size_t t = 0; t < readers.size(); t++)
+      readers[t].join();
+    TS_ASSERT_EQUALS(mismatches, 0);
+
+  }
+
+  void testTreeIterators(){
+
+    ExprTree t = ExprTree::buildTree(ExprTree::tokenise("max(1, -x) * (2 + 3) - abs(y)"));
+    std::string pre, in, post, level;
+    for (TreeNode * n : t.preorder())
+      pre += n->toString() + " ";
+    for (TreeNode * n : t.inorder())
+      in += n->toString() + " ";
+    for (TreeNode * n : t.postorder())
+      post += n->toString() + " ";
+    for (TreeNode * n : t.levelOrder())
+      level += n->toString() + " ";
+    TS_ASSERT_EQUALS(pre, "- * max 1 neg x + 2 3 abs y ");
+    TS_ASSERT_EQUALS(in, "1 max x neg * 2 + 3 - y abs ");
+    TS_ASSERT_EQUALS(post, ExprTree::postfixOrder(t) + " ");
+    TS_ASSERT_EQUALS(level, "- * abs max + y 1 neg 2 3 x ");
+    TS_ASSERT(ExprTree().preorder().begin() == ExprTree().preorder().end());
+
+    std::string chain = "1";
+    for (int i = 0; i < 100000; i++)
+      chain += " - 1";
+    ExprTree deep = ExprTree::buildTree(ExprTree::tokenise(chain));
+    TS_ASSERT_EQUALS(deep.size(), 200001);
+    int leaves = 0, nodes = 0;
+    for (TreeNode * n : deep.postorder())
+      leaves += n->isValue();
+    for (TreeIterator i = deep.levelOrder().begin(); i != deep.levelOrder().end(); i++)
+      nodes++;
+    TS_ASSERT_EQUALS(leaves, 100001);
+    TS_ASSERT_EQUALS(nodes, 200001);
+
+    std::srand(93);
+    for (int i = 0; i < 100; i++) {
+      ExprTree r(randomTree(8));
+      std::string walked;
+      for (TreeNode * n : r.postorder())
+        walked += n->toString() + " ";
+      walked.erase(walked.size() - 1);
+      TS_ASSERT_EQUALS(walked, ExprTree::postfixOrder(r));
+      int count = 0;
+      for (TreeNode * n : r.inorder())
+        count += n != NULL;
+      TS_ASSERT_EQUALS(count, r.size());
+    }
+
+  }
+
+  void testNativeRules(){
+
+    const char * expressions[] = {"x * y + 3 ^ z", "max(x, -y) % 7 - abs(z)", "x > 2 && y / z > 1",
+                                  "z == 0 || x / z < y", "x ? y ? 1 : 2 : z ? 3 : 4", "x << 2 xor y",
+                                  "(x < y) + (x <= y) + (x >= y) * 10 + (x != y) * 100", "7"};
+    NativeRules rules;
+    for (int i = 0; i < 8; i++)
+      TS_ASSERT_EQUALS(rules.addRule(ExprTree::buildTree(ExprTree::tokenise(expressions[i]))), i);
+    TS_ASSERT_EQUALS(rules.getVariables().size(), 3u);
+    TS_ASSERT(rules.generate().find("extern \"C\" int rule7(") != std::string::npos);
+
+    TS_ASSERT(!rules.compile("no-such-compiler"));
+    TS_ASSERT(!rules.getError().empty());
+    TS_ASSERT(!rules.isNative(0));
+    bool native = rules.compile();
+    TS_ASSERT_EQUALS(native, rules.getError().empty());
+    TS_ASSERT_EQUALS(rules.isNative(7), native);
+
+    int values[][3] = {{3, 5, 2}, {0, -4, 0}, {5, 1, -3}, {-7, 2, 3}, {1, 0, 1}};
+    for (int v = 0; v < 5; v++) {
+      Bindings variables;
+      std::vector<int> ordered;
+      for (size_t i = 0; i < rules.getVariables().size(); i++) {
+        variables[rules.getVariables()[i]] = values[v][i];
+        ordered.push_back(values[v][i]);
+      }
+      for (int i = 0; i < 8; i++) {
+        int expected = ExprTree::buildTree(ExprTree::tokenise(expressions[i])).evaluateWholeTree(variables);
+        TS_ASSERT_EQUALS(rules.evaluate(i, variables), expected);
+        TS_ASSERT_EQUALS(rules.evaluate(i, ordered), expected);
+      }
+    }
+
+    int extra = rules.addRule(ExprTree::buildTree(ExprTree::tokenise("w + 1")));
+    TS_ASSERT(!rules.isNative(extra));
+    Bindings w;
+    w["w"] = 41;
+    TS_ASSERT_EQUALS(rules.evaluate(extra, w), 42);
+
+  }
+
+  void testTreeCache(void)
+  {
+    const char * expressions[] = {"x * y + 3 ^ z", "max(x, -y) % 7 - abs(z)", "x ? y : z", "", "42"};
+    string path = "/tmp/treecache_test.bin";
+    Bindings variables;
+    variables["x"] = 3;
+    variables["y"] = -2;
+    variables["z"] = 4;
+
+    TreeCache warm;
+    for (int i = 0; i < 5; i++)
+      warm.get(expressions[i]);
+    TS_ASSERT_EQUALS(&warm.get(expressions[0]), &warm.get(expressions[0]));
+    TS_ASSERT_EQUALS(warm.getStats().misses, 5);
+    TS_ASSERT_EQUALS(warm.getStats().hits, 2);
+
+    //An expression that can't be parsed isn't cached, so it is rejected every time.
+    for (int i = 0; i < 2; i++) {
+      bool rejected = false;
+      try {
+        warm.get("1 , 2");
+      } catch (const std::invalid_argument &) {
+        rejected = true;
+      }
+      TS_ASSERT(rejected);
+    }
+    TS_ASSERT_EQUALS(warm.size(), 5);
+
+    //Threads asking for the same expressions at once all get the one tree that was kept.
+    TreeCache shared;
+    std::vector<const ExprTree *> seen(4 * 20);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+      threads.push_back(std::thread([&shared, &seen, t]() {
+        for (int i = 0; i < 20; i++) {
+          std::stringstream e;
+          e << "x * " << i << " + y";
+          seen[t * 20 + i] = &shared.get(e.str());
+        }
+      }));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+      threads[t].join();
+    TS_ASSERT_EQUALS(shared.size(), 20);
+    for (int i = 0; i < 20; i++) {
+      std::stringstream e;
+      e << "x * " << i << " + y";
+      for (int t = 0; t < 4; t++)
+        TS_ASSERT_EQUALS(seen[t * 20 + i], &shared.get(e.str()));
+    }
+    TS_ASSERT_EQUALS(shared.getStats().hits + shared.getStats().misses, 4 * 20 + 4 * 20);
+    TS_ASSERT(warm.save(path));
+
+    TreeCache restarted;
+    TS_ASSERT(restarted.load(path));
+    TS_ASSERT_EQUALS(restarted.size(), 5);
+    TS_ASSERT_EQUALS(restarted.getStats().loaded, 5);
+    TS_ASSERT_EQUALS(restarted.getStats().validated, 0);
+    for (int i = 0; i < 5; i++) {
+      const ExprTree & tree = restarted.get(expressions[i]);
+      TS_ASSERT_EQUALS(ExprTree::prefixOrder(tree), ExprTree::prefixOrder(warm.get(expressions[i])));
+      if (!tree.isEmpty())
+        TS_ASSERT_EQUALS(tree.evaluateWholeTree(variables), warm.get(expressions[i]).evaluateWholeTree(variables));
+    }
+    TS_ASSERT_EQUALS(restarted.getStats().validated, 5);
+    TS_ASSERT_EQUALS(restarted.getStats().rejected, 0);
+    TS_ASSERT_EQUALS(restarted.getStats().misses, 0);
+
+    //A saved cache that was only loaded saves the same entries.
+    TS_ASSERT(restarted.save(path));
+    TreeCache again;
+    TS_ASSERT(again.load(path));
+    TS_ASSERT_EQUALS(again.get("x ? y : z").evaluateWholeTree(variables), -2);
+
+    std::string bytes;
+    {
+      std::ifstream in(path.c_str(), std::ios::binary);
+      std::stringstream contents;
+      contents << in.rdbuf();
+      bytes = contents.str();
+    }
+    for (size_t flip = 0; flip < bytes.size(); flip += 7) {
+      std::string corrupt = bytes;
+      corrupt[flip] ^= 0x10;
+      {
+        std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+        out << corrupt;
+      }
+      TreeCache rejected;
+      TS_ASSERT(!rejected.load(path));
+      TS_ASSERT_EQUALS(rejected.size(), 0);
+    }
+    {
+      std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+      out << bytes.substr(0, bytes.size() / 2);
+    }
+    TreeCache truncated;
+    TS_ASSERT(!truncated.load(path));
+    TS_ASSERT(!truncated.load("/tmp/no_such_treecache.bin"));
+    std::remove(path.c_str());
+
+  }
+
+  void testHeavyHitters(void)
+  {
+    HeavyHitters direct(3, 1, 64, 4);
+    for (uint64_t key = 1; key <= 50; key++)
+      direct.record(key, key == 7 ? 5000 : key == 20 ? 3000 : key == 33 ? 4000 : 10, 1);
+    direct.record(20, 2000, 1);
+    std::vector<HeavyHitters::Hitter> top = direct.snapshot();
+    TS_ASSERT_EQUALS(top.size(), 3u);
+    TS_ASSERT_EQUALS(top[0].hash, 20u);
+    TS_ASSERT(top[0].nanoseconds >= 5000u);
+    TS_ASSERT(top[0].samples >= 2u);
+    TS_ASSERT_EQUALS(top[1].hash, 7u);
+    TS_ASSERT_EQUALS(top[2].hash, 33u);
+    TS_ASSERT_EQUALS(direct.getSamples(), 51u);
+    direct.reset();
+    TS_ASSERT(direct.snapshot().empty());
+
+    std::string big = "x";
+    for (int i = 0; i < 2000; i++)
+      big += i % 2 ? " + x" : " * y";
+    ExprTree heavy = ExprTree::buildTree(ExprTree::tokenise(big));
+    ExprTree light = ExprTree::buildTree(ExprTree::tokenise("x + 1"));
+    Bindings variables;
+    variables["x"] = 3;
+    variables["y"] = 1;
+    int heavyValue = heavy.evaluateWholeTree(variables);
+    int lightValue = light.evaluateWholeTree(variables);
+
+    HeavyHitters profiler(4, 1);
+    TS_ASSERT(HeavyHitters::install(&profiler) == NULL);
+    std::vector<std::thread> threads;
+    std::atomic<int> wrong(0);
+    for (int t = 0; t < 4; t++) {
+      threads.push_back(std::thread([&]() {
+        for (int i = 0; i < 200; i++) {
+          if (heavy.evaluateWholeTree(variables) != heavyValue)
+            wrong++;
+          if (light.evaluateWholeTree(variables) != lightValue)
+            wrong++;
+        }
+      }));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+      threads[t].join();
+    TS_ASSERT(HeavyHitters::install(NULL) == &profiler);
+    TS_ASSERT(HeavyHitters::installed() == NULL);
+
+    TS_ASSERT_EQUALS(wrong, 0);
+    TS_ASSERT_EQUALS(profiler.getSamples(), 1600u);
+    top = profiler.snapshot();
+    TS_ASSERT_EQUALS(top.size(), 2u);
+    TS_ASSERT_EQUALS(top[0].hash, TreeDiff::hash(heavy.getRoot()));
+    TS_ASSERT_EQUALS(top[0].nodes, heavy.size());
+    TS_ASSERT_EQUALS(top[1].hash, TreeDiff::hash(light.getRoot()));
+    TS_ASSERT_EQUALS(top[1].samples, 800u);
+
+    HeavyHitters sampled(4, 8);
+    HeavyHitters::install(&sampled);
+    for (int i = 0; i < 800; i++) {
+      heavy.evaluateWholeTree(variables);
+      light.evaluateWholeTree();
+    }
+    HeavyHitters::install(NULL);
+    TS_ASSERT(sampled.getSamples() > 100u && sampled.getSamples() < 300u);
+    TS_ASSERT_EQUALS(sampled.snapshot().size(), 2u);
+
+  }
+
+  void testNodeProfile(void)
+  {
+    ExprTree t = ExprTree::buildTree(ExprTree::tokenise("(x * y + 3) * (a > 0 && b / a > 1) + (a ? max(x, -y) : z)"));
+    NodeProfile profile(t);
+    TS_ASSERT_EQUALS(profile.size(), t.size());
+    int i = 0;
+    for (TreeNode * n : t.preorder())
+      TS_ASSERT_EQUALS(profile.getNode(i++), n);
+
+    int values[][5] = {{3, 4, 0, 7, 2}, {3, 4, 2, 7, 2}, {-1, 5, 3, 2, 9}};
+    for (int v = 0; v < 3; v++) {
+      Bindings variables;
+      variables["x"] = values[v][0];
+      variables["y"] = values[v][1];
+      variables["a"] = values[v][2];
+      variables["b"] = values[v][3];
+      variables["z"] = values[v][4];
+      TS_ASSERT_EQUALS(profile.evaluate(variables), t.evaluateWholeTree(variables));
+    }
+    TS_ASSERT_EQUALS(profile.getVisits(0), 3u);
+    for (int n = 0; n < profile.size(); n++) {
+      TS_ASSERT(profile.getCycles(n) <= profile.getCycles(0));
+      TS_ASSERT(profile.getSelfCycles(n) <= profile.getCycles(n));
+      if (profile.getNode(n)->getOperator() == Divide)
+        TS_ASSERT_EQUALS(profile.getVisits(n), 2u); //Not needed when a is 0.
+      if (profile.getNode(n)->isVariable() && profile.getNode(n)->getName() == "z")
+        TS_ASSERT_EQUALS(profile.getVisits(n), 1u);
+    }
+
+    std::string prefix = profile.annotatedPrefix();
+    TS_ASSERT_EQUALS((int)std::count(prefix.begin(), prefix.end(), '\n'), profile.size());
+    TS_ASSERT_EQUALS(prefix.substr(0, 4), "* + ");
+    TS_ASSERT(prefix.find("100.0%") != std::string::npos);
+    std::string infix = profile.annotatedInfix(0.0);
+    TS_ASSERT(infix.find("]=100.0%") != std::string::npos);
+    std::string plain = profile.annotatedInfix(2.0);
+    TS_ASSERT_EQUALS(plain, ExprTree::infixOrder(t));
+
+    profile.reset();
+    TS_ASSERT_EQUALS(profile.getVisits(0), 0u);
+    TS_ASSERT_EQUALS(profile.evaluate(), t.evaluateWholeTree());
+    ExprTree empty;
+    NodeProfile none(empty);
+    TS_ASSERT_EQUALS(none.evaluate(), 0);
+    TS_ASSERT_EQUALS(none.annotatedInfix(), "");
+
+  }
+
+  void testTraceRecorder(void)
+  {
+    std::vector<std::string> expressions;
+    for (int i = 0; i < 300; i++) {
+      std::stringstream stream;
+      stream << "x * " << i << " + max(y, " << i % 5 << ")";
+      expressions.push_back(stream.str());
+    }
+    Bindings variables;
+    variables["x"] = 2;
+    variables["y"] = 3;
+
+    BatchEvaluator batch(2);
+    std::vector<int> untraced = batch.evaluate(expressions, variables);
+    TraceRecorder trace;
+    TS_ASSERT(TraceRecorder::install(&trace) == NULL);
+    std::vector<int> traced = batch.evaluate(expressions, variables);
+    TS_ASSERT(TraceRecorder::install(NULL) == &trace);
+    TS_ASSERT(traced == untraced);
+
+    int tasks = 0;
+    std::string json = trace.toJson();
+    size_t at = 0;
+    while ((at = json.find("\"name\":\"task\"", at)) != std::string::npos) {
+      tasks++;
+      at++;
+    }
+    TS_ASSERT(tasks >= 300 / BatchEvaluator::taskSize);
+    TS_ASSERT_EQUALS(trace.eventCount(), 300 * 3 + tasks);
+    TS_ASSERT_EQUALS(trace.getDropped(), 0);
+    TS_ASSERT_EQUALS(json.substr(0, 39), "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    TS_ASSERT(json.find("\"name\":\"tokenise\"") != std::string::npos);
+    TS_ASSERT(json.find("\"name\":\"buildTree\"") != std::string::npos);
+    TS_ASSERT(json.find("\"name\":\"evaluate\"") != std::string::npos);
+    TS_ASSERT(json.find("\"args\":{\"id\":299,") != std::string::npos);
+    TS_ASSERT(json.find(" worker 1\"") != std::string::npos);
+    TS_ASSERT_EQUALS(std::count(json.begin(), json.end(), '{'), std::count(json.begin(), json.end(), '}'));
+
+    TraceRecorder direct;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+      threads.push_back(std::thread([&direct, t]() {
+        if (t == 0)
+          direct.nameThread("first \"quoted\"");
+        for (int i = 0; i < 5000; i++) {
+          uint64_t start = direct.now();
+          direct.record("step", start, direct.now(), i, t);
+        }
+      }));
+    }
+    for (int i = 0; i < 10; i++)
+      TS_ASSERT(direct.toJson().size() > 10);
+    for (size_t t = 0; t < threads.size(); t++)
+      threads[t].join();
+    TS_ASSERT_EQUALS(direct.eventCount(), 20000);
+    json = direct.toJson();
+    TS_ASSERT(json.find("first \\\"quoted\\\"") != std::string::npos);
+    TS_ASSERT(direct.write("/tmp/trace_test.json"));
+    std::remove("/tmp/trace_test.json");
+
+  }
+
+  void testMetrics(void)
+  {
+    Metrics::reset();
+    ExprTree::buildTree(ExprTree::tokenise("1 + 2")).evaluateWholeTree();
+    TS_ASSERT(!Metrics::enabled());
+    TS_ASSERT_EQUALS(Metrics::get(Metrics::ExpressionsParsed), 0u);
+
+    Metrics::enable(true);
+    std::vector<std::thread> threads;
+    std::atomic<int> wrong(0);
+    for (int t = 0; t < 4; t++) {
+      threads.push_back(std::thread([&wrong]() {
+        Bindings variables;
+        variables["x"] = 3;
+        for (int i = 0; i < 100; i++)
+          if (ExprTree::buildTree(ExprTree::tokenise("1 + 2 * x")).evaluateWholeTree(variables) != 7)
+            wrong++;
+      }));
+    }
+    for (size_t t = 0; t < threads.size(); t++)
+      threads[t].join();
+    TS_ASSERT_EQUALS(wrong, 0);
+    {
+      TreeCache cache;
+      cache.get("a - b");
+      cache.get("a - b");
+    }
+    Metrics::enable(false);
+    ExprTree::buildTree(ExprTree::tokenise("1 + 2")).evaluateWholeTree();
+
+    TS_ASSERT_EQUALS(Metrics::get(Metrics::ExpressionsParsed), 401u);
+    TS_ASSERT_EQUALS(Metrics::get(Metrics::NodesBuilt), 2003u);
+    TS_ASSERT_EQUALS(Metrics::get(Metrics::NodesFreed), 2003u);
+    TS_ASSERT(Metrics::get(Metrics::BytesAllocated) >= 2003 * sizeof(TreeNode));
+    TS_ASSERT_EQUALS(Metrics::get(Metrics::Evaluations), 400u);
+    TS_ASSERT_EQUALS(Metrics::get(Metrics::CacheHits), 1u);
+    TS_ASSERT_EQUALS(Metrics::get(Metrics::CacheMisses), 1u);
+    TS_ASSERT_EQUALS(Metrics::observations(Metrics::Tokenise), 401u);
+    TS_ASSERT_EQUALS(Metrics::observations(Metrics::Build), 401u);
+    TS_ASSERT_EQUALS(Metrics::observations(Metrics::Evaluate), 400u);
+
+    std::string text = Metrics::render();
+    TS_ASSERT(text.find("# TYPE exprtree_expressions_parsed_total counter\nexprtree_expressions_parsed_total 401\n") != std::string::npos);
+    TS_ASSERT(text.find("exprtree_nodes_live 0\n") != std::string::npos);
+    TS_ASSERT(text.find("# TYPE exprtree_phase_duration_seconds histogram\n") != std::string::npos);
+    TS_ASSERT(text.find("exprtree_phase_duration_seconds_bucket{phase=\"evaluate\",le=\"1e-06\"}") != std::string::npos);
+    TS_ASSERT(text.find("exprtree_phase_duration_seconds_bucket{phase=\"build\",le=\"4.194304\"}") != std::string::npos);
+    TS_ASSERT(text.find("exprtree_phase_duration_seconds_bucket{phase=\"tokenise\",le=\"+Inf\"} 401\n") != std::string::npos);
+    TS_ASSERT(text.find("exprtree_phase_duration_seconds_count{phase=\"evaluate\"} 400\n") != std::string::npos);
+
+    TS_ASSERT(Metrics::write("/tmp/metrics_test.prom"));
+    std::ifstream in("/tmp/metrics_test.prom");
+    std::stringstream contents;
+    contents << in.rdbuf();
+    TS_ASSERT_EQUALS(contents.str(), text);
+    std::remove("/tmp/metrics_test.prom");
+    Metrics::reset();
+    TS_ASSERT_EQUALS(Metrics::get(Metrics::Evaluations), 0u);
+
+    //Resetting while other threads count: every count made after the last
+    //reset is read back, and none from before it.
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> counted(0);
+    std::vector<std::thread> counters;
+    for (int t = 0; t < 4; t++) {
+      counters.push_back(std::thread([&stop, &counted]() {
+        while (!stop) {
+          Metrics::add(Metrics::CacheHits);
+          counted++;
+        }
+      }));
+    }
+    uint64_t before = 0;
+    for (int i = 0; i < 200; i++) {
+      before = counted;
+      Metrics::reset();
+    }
+    uint64_t after = counted;
+    uint64_t read = Metrics::get(Metrics::CacheHits);
+    stop = true;
+    for (size_t t = 0; t < counters.size(); t++)
+      counters[t].join();
+    TS_ASSERT(read <= Metrics::get(Metrics::CacheHits));
+    TS_ASSERT(Metrics::get(Metrics::CacheHits) <= counted - before + counters.size());
+    TS_ASSERT(read + before <= after + counters.size());
+    Metrics::reset();
+    TS_ASSERT_EQUALS(Metrics::get(Metrics::CacheHits), 0u);
+
+    //Threads that end leave their counts behind, and lose them at a reset like the others.
+    for (int t = 0; t < 50; t++) {
+      std::thread shortLived([]() {
+        Metrics::add(Metrics::CacheMisses, 3);
+        Metrics::observe(Metrics::Build, Metrics::now());
+      });
+      shortLived.join();
+    }
+    TS_ASSERT_EQUALS(Metrics::get(Metrics::CacheMisses), 150u);
+    TS_ASSERT_EQUALS(Metrics::observations(Metrics::Build), 50u);
+    TS_ASSERT(Metrics::render().find("exprtree_cache_misses_total 150\n") != std::string::npos);
+    Metrics::reset();
+    TS_ASSERT_EQUALS(Metrics::get(Metrics::CacheMisses), 0u);
+    TS_ASSERT_EQUALS(Metrics::observations(Metrics::Build), 0u);
+
+  }
+
+  void testStraySeparators(void)
+  {
+    bool rejected = false;
+    try {
+      ExprTree::buildTree(ExprTree::tokenise("1 , 2"));
+    } catch (const std::invalid_argument &) {
+      rejected = true;
+    }
+    TS_ASSERT(rejected);
+    TS_ASSERT_EQUALS(ExprTree::buildTree(ExprTree::tokenise("max(1, 2)")).evaluateWholeTree(), 2);
+
+    rejected = false;
+    try {
+      ExprTree::buildTree(ExprTree::tokenise("1 : 2"));
+    } catch (const std::invalid_argument &) {
+      rejected = true;
+    }
+    TS_ASSERT(rejected);
+    TS_ASSERT_EQUALS(ExprTree::buildTree(ExprTree::tokenise("0 ? 1 : 1 ? 2 : 3")).evaluateWholeTree(), 2);
+
+    rejected = false;
+    try {
+      ExprTree::buildTree(ExprTree::tokenise("1 ? (2 : 3)"));
+    } catch (const std::invalid_argument &) {
+      rejected = true;
+    }
+    TS_ASSERT(rejected);
+    TS_ASSERT_EQUALS(ExprTree::buildTree(ExprTree::tokenise("1 ? (0 ? 2 : 3) : 4")).evaluateWholeTree(), 3);
+
+    rejected = false;
+    try {
+      ExprTree::buildTree(ExprTree::tokenise("1 )"));
+    } catch (const std::invalid_argument &) {
+      rejected = true;
+    }
+    TS_ASSERT(rejected);
+    TS_ASSERT_EQUALS(ExprTree::buildTree(ExprTree::tokenise("(1 + 2) * 3")).evaluateWholeTree(), 9);
+
+  }
+
+};
@@ -0,0 +1,178 @@
+#include "GradientTape.h"
+#include "OperatorRegistry.h"
+#include "ExprTree.h"
+#include <cmath>
+
+/*
+ * Adds a step to the tape and returns its position.
+ */
+int GradientTape::push(double value, int left, double dLeft, int right, double dRight) {
+	Entry e;
+	e.value = value;
+	e.left = left;
+	e.dLeft = dLeft;
+	e.right = right;
+	e.dRight = dRight;
+	tape.push_back(e);
+	return tape.size() - 1;
+}
+
+/*
+ * Recursive function that records the evaluation of the subtree at n and
+ * returns the tape position of its value.
+ *
+ * Algorithm:
+ * Numbers are pushed as steps with no operands.
+ * Each variable is pushed the first time it is seen and later uses point
+ * at the same step, so its derivative collects in one place.
+ * For ?:, record the condition, then only the branch that is taken, whose
+ * position is returned directly. && and || are short-circuited the same way
+ * as ExprTree::evaluate does.
+ * For other operators, record the operands first, then push the result with
+ * the partial derivatives with respect to each operand.
+ * Deferred nodes are materialised as they are reached, so only the groups
+ * that are evaluated get parsed.
+ */
+int GradientTape::recordNode(TreeNode * n, const RealBindings & bindings) {
+	ExprTree::materialise(n);
+	switch (n->getOperator()) {
+	case Value:
+		return push(n->getValue(), -1, 0, -1, 0);
+	case Variable: {
+		std::map<std::string, int>::iterator seen = variables.find(n->getName());
+		if (seen != variables.end())
+			return seen->second;
+		RealBindings::const_iterator binding = bindings.find(n->getName());
+		int position = push(binding == bindings.end() ? 0 : binding->second, -1, 0, -1, 0);
+		variables[n->getName()] = position;
+		return position;
+	}
+	case Conditional: {
+		int condition = recordNode(n->getLeftChild(), bindings);
+		bool taken = tape[condition].value != 0;
+		TreeNode * branches = n->getRightChild();
+		if (branches->getOperator() != Alternative)
+			return taken ? recordNode(branches, bindings) : push(0, -1, 0, -1, 0);
+		return recordNode(taken ? branches->getLeftChild() : branches->getRightChild(), bindings);
+	}
+	case Alternative:
+		return recordNode(n->getLeftChild(), bindings);
+	case And:
+	case Or: {
+		bool left = tape[recordNode(n->getLeftChild(), bindings)].value != 0;
+		if (left == (n->getOperator() == Or))
+			return push(left, -1, 0, -1, 0);
+		bool right = tape[recordNode(n->getRightChild(), bindings)].value != 0;
+		return push(right, -1, 0, -1, 0);
+	}
+	default:
+		break;
+	}
+
+	const OperatorInfo & info = OperatorRegistry::get(n->getOperator());
+	int l = recordNode(n->getLeftChild(), bindings);
+	int r = info.arity == 1 ? -1 : recordNode(n->getRightChild(), bindings);
+	double a = tape[l].value;
+	double b = r < 0 ? 0 : tape[r].value;
+
+	switch (n->getOperator()) {
+	case Plus:
+		return push(a + b, l, 1, r, 1);
+	case Minus:
+		return push(a - b, l, 1, r, -1);
+	case Times:
+		return push(a * b, l, b, r, a);
+	case Divide:
+		return push(a / b, l, 1 / b, r, -a / (b * b));
+	case Modulo:
+		return push(std::fmod(a, b), l, 1, r, -std::trunc(a / b));
+	case Power: {
+		double v = std::pow(a, b);
+		double dA = b == 0 ? 0 : b * std::pow(a, b - 1);
+		double dB = a > 0 ? v * std::log(a) : 0;
+		return push(v, l, dA, r, dB);
+	}
+	case Min:
+		return a <= b ? push(a, l, 1, r, 0) : push(b, l, 0, r, 1);
+	case Max:
+		return a >= b ? push(a, l, 1, r, 0) : push(b, l, 0, r, 1);
+	case Abs:
+		return push(std::fabs(a), l, a > 0 ? 1 : (a < 0 ? -1 : 0), -1, 0);
+	case Negate:
+		return push(-a, l, -1, -1, 0);
+	case Less:
+		return push(a < b, l, 0, r, 0);
+	case LessEqual:
+		return push(a <= b, l, 0, r, 0);
+	case Greater:
+		return push(a > b, l, 0, r, 0);
+	case GreaterEqual:
+		return push(a >= b, l, 0, r, 0);
+	case Equal:
+		return push(a == b, l, 0, r, 0);
+	case NotEqual:
+		return push(a != b, l, 0, r, 0);
+	default:
+		if (info.kernel == NULL)
+			return push(0, l, 0, r, 0);
+		return push(info.kernel(int(a), int(b)), l, 0, r, 0);
+	}
+}
+
+/*
+ * Clears the tape, records the evaluation of the tree at root with the
+ * given variable values (missing variables are 0) and returns its value.
+ */
+double GradientTape::evaluate(TreeNode * root, const RealBindings & bindings) {
+	tape.clear();
+	variables.clear();
+	if (root == NULL)
+		return 0;
+	recordNode(root, bindings);
+	return value();
+}
+
+/*
+ * Returns the value of the last recorded tree.
+ */
+double GradientTape::value() {
+	return tape.empty() ? 0 : tape.back().value;
+}
+
+/*
+ * Returns the partial derivative of the value of the last recorded tree
+ * with respect to every variable in it.
+ *
+ * Algorithm:
+ * Give every step an adjoint (the derivative of the result with respect to
+ * that step), starting at 1 for the result, which is the last step.
+ * Walk the tape backwards; since operands come before the steps that use
+ * them, a step's adjoint is complete when it is reached, and it is passed
+ * on to its operands multiplied by the stored partial derivatives.
+ * The adjoints of the variable steps are the gradient.
+ */
+std::map<std::string, double> GradientTape::gradient() {
+	std::vector<double> adjoints(tape.size(), 0.0);
+	if (!tape.empty())
+		adjoints.back() = 1;
+
+	for (int i = tape.size() - 1; i >= 0; i--) {
+		const Entry & e = tape[i];
+		if (adjoints[i] == 0)
+			continue;
+		if (e.left >= 0)
+			adjoints[e.left] += adjoints[i] * e.dLeft;
+		if (e.right >= 0)
+			adjoints[e.right] += adjoints[i] * e.dRight;
+	}
+
+	std::map<std::string, double> result;
+	for (std::map<std::string, int>::const_iterator v = variables.begin(); v != variables.end(); ++v)
+		result[v->first] = adjoints[v->second];
+	return result;
+}
+
+/*
+ * Returns the number of steps on the tape.
+ */
+int GradientTape::length() { return tape.size(); }
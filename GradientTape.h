@@ -0,0 +1,62 @@
+#ifndef GRADIENTTAPE_H
+#define GRADIENTTAPE_H
+
+#include <vector>
+#include <string>
+#include <map>
+
+#include "TreeNode.h"
+
+/*
+ * The values of the variables in an expression, by name, as doubles.
+ */
+typedef std::map<std::string, double> RealBindings;
+
+/*
+ * Reverse-mode automatic differentiation of expression trees.
+ *
+ * evaluate(...) evaluates a tree with double values (so / is real division)
+ * and writes every step onto a linear tape, together with the partial
+ * derivatives of that step with respect to its operands. gradient() then
+ * walks the tape backwards once and returns the partial derivative of the
+ * result with respect to every variable, so the whole gradient costs about
+ * as much as one evaluation, however many variables there are.
+ *
+ * Comparisons, && and || are piecewise constant, so they pass no derivative
+ * on. Only the branch of a ?: that was taken is recorded. Custom operators
+ * from the OperatorRegistry only have int kernels, so they are evaluated on
+ * their operands rounded towards zero and treated as constant too.
+ */
+class GradientTape{
+
+ private:
+
+  /*
+   * One step of the evaluation. left and right are the tape positions of
+   * its operands (-1 if it has none) and dLeft and dRight are the partial
+   * derivatives of this step with respect to them.
+   */
+  struct Entry{
+    double value;
+    int left;
+    int right;
+    double dLeft;
+    double dRight;
+  };
+
+  std::vector<Entry> tape; //The steps, operands always before the steps that use them.
+  std::map<std::string, int> variables; //The tape position of each variable.
+
+  int push(double, int, double, int, double);
+  int recordNode(TreeNode *, const RealBindings &);
+
+ public:
+
+  double evaluate(TreeNode *, const RealBindings &); //Clears the tape, records the evaluation of a tree and returns its value.
+  double value(); //Returns the value of the last recorded tree.
+  std::map<std::string, double> gradient(); //Returns d(value)/d(variable) for every variable in the tree.
+  int length(); //Returns the number of steps on the tape.
+
+};
+
+#endif
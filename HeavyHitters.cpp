@@ -0,0 +1,217 @@
+#include "HeavyHitters.h"
+#include "TreeDiff.h"
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <functional>
+
+/*
+ * The profiler installed for every thread, or NULL.
+ */
+std::atomic<HeavyHitters *> installedProfiler(NULL);
+
+/*
+ * The number of calls to HeavyHitters::evaluate left on this thread until
+ * the next sampled one, and the state of the random numbers that pick the
+ * gaps between them.
+ */
+thread_local int sampleCountdown = 0;
+thread_local uint32_t sampleState = 0;
+
+/*
+ * Helper function that orders hitters by time, biggest first.
+ */
+bool costlier(const HeavyHitters::Hitter & a, const HeavyHitters::Hitter & b) {
+	return a.nanoseconds > b.nanoseconds;
+}
+
+/*
+ * Constructor that sets up an empty profiler that keeps the topK most
+ * expensive expressions, samples one in every sampleEvery evaluations, and
+ * has a sketch of depth rows of width counters (rounded up to a power of 2).
+ */
+HeavyHitters::HeavyHitters(int topK, int sampleEvery, int width, int depth) {
+	this->topK = std::max(topK, 1);
+	this->sampleEvery = std::max(sampleEvery, 1);
+	this->width = 1;
+	while (this->width < width)
+		this->width *= 2;
+	this->depth = std::max(depth, 1);
+	times.assign((size_t)this->width * this->depth, 0);
+	counts.assign(times.size(), 0);
+	samples = 0;
+}
+
+/*
+ * Returns the index in the sketches of the counter for key in the given
+ * row. Each row mixes the key with a different odd number, so two keys
+ * that share a counter in one row almost never share one in every row.
+ */
+size_t HeavyHitters::slot(uint64_t key, int row) {
+	uint64_t h = (key + 0x9e3779b97f4a7c15ULL * (row + 1)) * 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 31;
+	return (size_t)row * width + (h & (width - 1));
+}
+
+/*
+ * Evaluates the tree t with the given variables. If this call is sampled,
+ * it is timed and recorded against the tree's hash. Working out the hash
+ * walks the tree, so it is only done for sampled calls.
+ * The gap to the next sampled call is random, sampleEvery on average, so
+ * a thread that evaluates the same few trees in turn samples all of them.
+ */
+int HeavyHitters::evaluate(const ExprTree & t, const Bindings & variables) {
+	if (--sampleCountdown > 0)
+		return ExprTree::evaluate(t.getRoot(), variables);
+	if (sampleState == 0)
+		sampleState = (uint32_t)std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+	sampleState ^= sampleState << 13; //xorshift
+	sampleState ^= sampleState >> 17;
+	sampleState ^= sampleState << 5;
+	sampleCountdown = sampleEvery == 1 ? 1 : 1 + sampleState % (2 * sampleEvery - 1);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int result = ExprTree::evaluate(t.getRoot(), variables);
+	std::chrono::steady_clock::duration taken = std::chrono::steady_clock::now() - start;
+	record(TreeDiff::hash(t.getRoot()), std::chrono::duration_cast<std::chrono::nanoseconds>(taken).count(), t.size());
+	return result;
+}
+
+/*
+ * Adds a sample of the given time for the expression with the given hash
+ * and size.
+ *
+ * Algorithm:
+ * Add the time (and 1 sample) to the key's counter in every row, and take
+ * the smallest of them as the key's estimates.
+ * If the key is in the heap, update it there. Its estimate only grows, so
+ * it can only need to move away from the front.
+ * Else if the heap isn't full, add it. Else if its estimate is bigger than
+ * the cheapest one in the heap (the front), it takes that one's place.
+ */
+void HeavyHitters::record(uint64_t hash, uint64_t nanoseconds, int nodes) {
+	std::unique_lock<std::mutex> guard(lock);
+	samples++;
+	uint64_t time = UINT64_MAX, count = UINT64_MAX;
+	for (int row = 0; row < depth; row++) {
+		size_t i = slot(hash, row);
+		time = std::min(time, times[i] += nanoseconds);
+		count = std::min(count, counts[i] += 1);
+	}
+
+	Hitter hitter;
+	hitter.hash = hash;
+	hitter.nanoseconds = time;
+	hitter.samples = count;
+	hitter.nodes = nodes;
+	std::unordered_map<uint64_t, size_t>::iterator found = position.find(hash);
+	if (found != position.end()) {
+		heap[found->second] = hitter;
+		siftDown(found->second);
+	}
+	else if ((int)heap.size() < topK) {
+		position[hash] = heap.size();
+		heap.push_back(hitter);
+		siftUp(heap.size() - 1);
+	}
+	else if (time > heap[0].nanoseconds) {
+		position.erase(heap[0].hash);
+		position[hash] = 0;
+		heap[0] = hitter;
+		siftDown(0);
+	}
+}
+
+/*
+ * Swaps two hitters in the heap, and their positions.
+ */
+void HeavyHitters::swapHitters(size_t a, size_t b) {
+	std::swap(heap[a], heap[b]);
+	position[heap[a].hash] = a;
+	position[heap[b].hash] = b;
+}
+
+/*
+ * Moves the hitter at i towards the front of the heap while it is cheaper
+ * than its parent.
+ */
+void HeavyHitters::siftUp(size_t i) {
+	while (i > 0 && heap[i].nanoseconds < heap[(i - 1) / 2].nanoseconds) {
+		swapHitters(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+/*
+ * Moves the hitter at i away from the front of the heap while one of its
+ * children is cheaper than it.
+ */
+void HeavyHitters::siftDown(size_t i) {
+	while (true) {
+		size_t cheapest = i;
+		for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < heap.size(); child++) {
+			if (heap[child].nanoseconds < heap[cheapest].nanoseconds)
+				cheapest = child;
+		}
+		if (cheapest == i)
+			return;
+		swapHitters(i, cheapest);
+		i = cheapest;
+	}
+}
+
+/*
+ * Returns a copy of the most expensive expressions so far, most expensive
+ * first.
+ */
+vector<HeavyHitters::Hitter> HeavyHitters::snapshot() {
+	vector<Hitter> result;
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		result = heap;
+	}
+	std::sort(result.begin(), result.end(), costlier);
+	return result;
+}
+
+/*
+ * Returns the number of samples recorded so far.
+ */
+uint64_t HeavyHitters::getSamples() {
+	std::unique_lock<std::mutex> guard(lock);
+	return samples;
+}
+
+/*
+ * Returns how many evaluations there are on each thread for each sampled
+ * one, which is what the times in a snapshot need multiplying by to
+ * estimate the total time.
+ */
+int HeavyHitters::getSampleEvery() { return sampleEvery; }
+
+/*
+ * Forgets every sample.
+ */
+void HeavyHitters::reset() {
+	std::unique_lock<std::mutex> guard(lock);
+	std::fill(times.begin(), times.end(), 0);
+	std::fill(counts.begin(), counts.end(), 0);
+	heap.clear();
+	position.clear();
+	samples = 0;
+}
+
+/*
+ * Returns the profiler ExprTree::evaluateWholeTree uses, or NULL.
+ */
+HeavyHitters * HeavyHitters::installed() { return installedProfiler.load(std::memory_order_acquire); }
+
+/*
+ * Makes ExprTree::evaluateWholeTree use the profiler p (or none, if p is
+ * NULL) on every thread, and returns the one it used before. A thread that
+ * was already evaluating with the one before can still be using it, so it
+ * shouldn't be deleted until those evaluations are done.
+ */
+HeavyHitters * HeavyHitters::install(HeavyHitters * p) {
+	return installedProfiler.exchange(p, std::memory_order_acq_rel);
+}
@@ -0,0 +1,79 @@
+#ifndef HEAVYHITTERS_H
+#define HEAVYHITTERS_H
+
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <stdint.h>
+
+#include "ExprTree.h"
+
+/*
+ * A sampling profiler that finds the expressions that take the most time
+ * to evaluate, out of any number of them, in a fixed amount of memory.
+ *
+ * Once it is installed (see install(...)), ExprTree::evaluateWholeTree
+ * times one in every sampleEvery of its calls on each thread, and adds the
+ * time to the expression's structural hash (see TreeDiff::hash), so the
+ * same expression parsed in different places counts as one.
+ * The times are kept in a count-min sketch: depth rows of width counters,
+ * each row indexed by a different hash of the key. A key's time is the
+ * smallest of its counters, which is never too small, and only too big by
+ * about the total time over width. The topK keys with the biggest times are
+ * kept in a heap with their estimates, which is what snapshot() returns.
+ *
+ * When no profiler is installed, evaluateWholeTree only checks for one.
+ * A profiler can be used by any number of threads at once, and must stay
+ * alive until it is uninstalled.
+ */
+class HeavyHitters{
+
+ public:
+
+  /*
+   * One of the most expensive expressions. The time and samples are
+   * estimates from the sketch, and only count sampled evaluations.
+   */
+  struct Hitter{
+    uint64_t hash; //The structural hash of the expression's tree.
+    uint64_t nanoseconds; //The time spent in sampled evaluations of it.
+    uint64_t samples; //The number of sampled evaluations.
+    int nodes; //The size of its tree.
+  };
+
+  HeavyHitters(int topK = 32, int sampleEvery = 64, int width = 4096, int depth = 4);
+  int evaluate(const ExprTree &, const Bindings &); //Evaluates a tree, timing it if it is sampled.
+  void record(uint64_t, uint64_t, int); //Adds a sample: the hash, the time and the size of a tree.
+  vector<Hitter> snapshot(); //The most expensive expressions so far, most expensive first.
+  uint64_t getSamples(); //The number of samples so far.
+  int getSampleEvery();
+  void reset(); //Forgets every sample.
+
+  static HeavyHitters * installed(); //The profiler evaluateWholeTree uses, or NULL for none.
+  static HeavyHitters * install(HeavyHitters *); //Makes evaluateWholeTree use a profiler (NULL for none) on
+                                                 //every thread and returns the one it used before.
+
+ private:
+
+  int topK;
+  int sampleEvery;
+  int width; //A power of 2.
+  int depth;
+  vector<uint64_t> times; //The sketch of times, depth rows of width counters.
+  vector<uint64_t> counts; //The sketch of samples, laid out the same way.
+  vector<Hitter> heap; //The top keys, cheapest at the front.
+  std::unordered_map<uint64_t, size_t> position; //The index of each key in heap.
+  uint64_t samples;
+  std::mutex lock; //Guards everything from times on.
+
+  HeavyHitters(const HeavyHitters &); //Not copyable.
+  HeavyHitters & operator=(const HeavyHitters &);
+
+  size_t slot(uint64_t, int);
+  void swapHitters(size_t, size_t);
+  void siftUp(size_t);
+  void siftDown(size_t);
+
+};
+
+#endif
@@ -0,0 +1,351 @@
+#include "IncrementalParser.h"
+#include <cctype>
+
+/*
+ * Basic constructor that sets up an empty expression.
+ */
+IncrementalParser::IncrementalParser() {
+	parse("");
+}
+
+/*
+ * Destructor that deletes every node of the tree.
+ */
+IncrementalParser::~IncrementalParser() {
+	freeLevel(groups[0].root, std::set<TreeNode *>());
+}
+
+/*
+ * Returns true if the open parenthesis at pos is that of a function call,
+ * i.e. the token before it is the name of a function like max.
+ * The token before it is the end of the run of letters and digits before
+ * the parenthesis (skipping spaces), from its first letter on, which is
+ * how tokenise would split the run up.
+ */
+bool IncrementalParser::isFunctionCall(size_t pos) const {
+	size_t end = pos;
+	while (end > 0 && text[end - 1] == ' ')
+		end--;
+	size_t start = end;
+	while (start > 0 && (isalnum((unsigned char)text[start - 1])))
+		start--;
+	while (start < end && !isalpha((unsigned char)text[start]))
+		start++;
+	if (start == end)
+		return false;
+	Operator op = OperatorRegistry::lookup(text.substr(start, end - start));
+	return op != NoOp && OperatorRegistry::get(op).notation == Function;
+}
+
+/*
+ * Finds every pair of parentheses in the text and sets up the groups, none
+ * of them with a subtree yet.
+ * Operator symbols can't have parentheses in them, so every '(' and ')' in
+ * the text is a token of its own.
+ */
+void IncrementalParser::findGroups() {
+	groups.clear();
+	Group whole;
+	whole.open = 0;
+	whole.close = text.size();
+	whole.parent = -1;
+	whole.function = false;
+	whole.root = NULL;
+	groups.push_back(whole);
+
+	int current = 0;
+	for (size_t i = 0; i < text.size(); i++) {
+		if (text[i] == '(') {
+			Group g;
+			g.open = i;
+			g.close = text.size();
+			g.parent = current;
+			g.function = isFunctionCall(i);
+			g.root = NULL;
+			groups.push_back(g);
+			groups[current].children.push_back(groups.size() - 1);
+			current = groups.size() - 1;
+		}
+		else if (text[i] == ')' && current != 0) {
+			groups[current].close = i;
+			current = groups[current].parent;
+		}
+	}
+}
+
+/*
+ * Tokenises the text from one position up to another onto the back of tokens.
+ * The pieces of text given to this always start and end next to a
+ * parenthesis, which can't join up with the tokens around it, so they
+ * tokenise the same way as they would as part of the whole text.
+ */
+void IncrementalParser::tokenisePiece(size_t from, size_t to, vector<string> & tokens) {
+	if (from >= to)
+		return;
+	vector<string> piece = ExprTree::tokenise(text.substr(from, to - from));
+	tokens.insert(tokens.end(), piece.begin(), piece.end());
+}
+
+/*
+ * Recursive function that puts the tokens inside group g onto the back of
+ * tokens. Kept groups inside it are put in as a "()" token, with their
+ * subtree added to subtrees and kept. Groups inside it that have never been
+ * parsed are parsed first, to see whether they can be kept. The rest are
+ * put in token by token, parentheses included.
+ */
+void IncrementalParser::collect(int g, vector<string> & tokens, vector<TreeNode *> & subtrees,
+                                std::set<TreeNode *> & kept) {
+	size_t from = g == 0 ? 0 : groups[g].open + 1;
+	for (size_t i = 0; i < groups[g].children.size(); i++) {
+		int c = groups[g].children[i];
+		tokenisePiece(from, groups[c].open, tokens);
+
+		if (!groups[c].function && groups[c].root == NULL) {
+			std::set<TreeNode *> inner;
+			TreeNode * r = parseGroup(c, inner);
+			if (r != NULL && r->isOperator())
+				groups[c].root = r;
+			else
+				freeLevel(r, inner);
+		}
+
+		if (groups[c].root != NULL) {
+			tokens.push_back("()");
+			subtrees.push_back(groups[c].root);
+			kept.insert(groups[c].root);
+		} else {
+			tokens.push_back("(");
+			collect(c, tokens, subtrees, kept);
+			tokens.push_back(")");
+		}
+		from = groups[c].close + 1;
+	}
+	tokenisePiece(from, g == 0 ? text.size() : groups[g].close, tokens);
+}
+
+/*
+ * Parses group g and returns the root of its new subtree, which has no
+ * parent yet. The subtrees of the kept groups inside it are used as they
+ * are, and are added to kept.
+ */
+TreeNode * IncrementalParser::parseGroup(int g, std::set<TreeNode *> & kept) {
+	vector<string> tokens;
+	vector<TreeNode *> subtrees;
+	if (g != 0)
+		tokens.push_back("(");
+	collect(g, tokens, subtrees, kept);
+	if (g != 0)
+		tokens.push_back(")");
+
+	parsedTokens += tokens.size();
+	TreeNode * r = ExprTree::buildSubtree(tokens, subtrees);
+	if (r != NULL)
+		r->setParent(NULL);
+	return r;
+}
+
+/*
+ * Recursive function that deletes the nodes of the subtree at n, except for
+ * the subtrees whose roots are in kept.
+ */
+void IncrementalParser::freeLevel(TreeNode * n, const std::set<TreeNode *> & kept) {
+	if (n == NULL || kept.count(n) != 0)
+		return;
+	freeLevel(n->getLeftChild(), kept);
+	freeLevel(n->getRightChild(), kept);
+	delete n;
+}
+
+/*
+ * Returns the parent of the root of each group that has one (and NULL for
+ * the others), by group.
+ */
+std::vector<TreeNode *> IncrementalParser::rootParents() const {
+	std::vector<TreeNode *> parents(groups.size(), NULL);
+	for (size_t g = 0; g < groups.size(); g++) {
+		if (groups[g].root != NULL)
+			parents[g] = groups[g].root->getParent();
+	}
+	return parents;
+}
+
+/*
+ * Puts back the text and groups from before a parse or edit that threw,
+ * given with the parents of their roots (from rootParents).
+ * The subtrees made for the groups since then are deleted. Parsing only
+ * ever changes the parents of the old tree's kept subtrees, when it puts
+ * them into new ones, so giving those back their parents mends the old tree.
+ */
+void IncrementalParser::restore(string & oldText, std::vector<Group> & oldGroups, const std::vector<TreeNode *> & parents) {
+	std::set<TreeNode *> roots, old;
+	for (size_t g = 0; g < oldGroups.size(); g++) {
+		if (oldGroups[g].root != NULL) {
+			roots.insert(oldGroups[g].root);
+			old.insert(oldGroups[g].root);
+		}
+	}
+	for (size_t g = 0; g < groups.size(); g++) {
+		if (groups[g].root != NULL)
+			roots.insert(groups[g].root);
+	}
+	for (std::set<TreeNode *>::iterator r = roots.begin(); r != roots.end(); ++r) {
+		if (old.count(*r) != 0)
+			continue;
+		freeLevel((*r)->getLeftChild(), roots);
+		freeLevel((*r)->getRightChild(), roots);
+		delete *r;
+	}
+	for (size_t g = 0; g < oldGroups.size(); g++) {
+		if (oldGroups[g].root != NULL)
+			oldGroups[g].root->setParent(parents[g]);
+	}
+	text.swap(oldText);
+	groups.swap(oldGroups);
+}
+
+/*
+ * Throws away the old tree and parses the expression e from scratch.
+ * Each group is parsed once, bottom up, and its subtree goes into the group
+ * around it as it is, so this does the same work as buildTree(tokenise(e)).
+ * The old tree is only deleted once e has been parsed, so it can be put
+ * back if e can't be.
+ */
+void IncrementalParser::parse(const string & e) {
+	std::vector<TreeNode *> parents = rootParents();
+	string oldText = e;
+	std::vector<Group> oldGroups;
+	oldText.swap(text);
+	oldGroups.swap(groups);
+	findGroups();
+	parsedTokens = 0;
+	try {
+		std::set<TreeNode *> kept;
+		groups[0].root = parseGroup(0, kept);
+	} catch (...) {
+		restore(oldText, oldGroups, parents);
+		throw;
+	}
+	if (!oldGroups.empty())
+		freeLevel(oldGroups[0].root, std::set<TreeNode *>());
+}
+
+/*
+ * Replaces count chars of the text at pos with replacement, and brings the
+ * tree up to date (see update). If that throws, the text, groups and tree
+ * are put back as they were.
+ */
+void IncrementalParser::edit(size_t pos, size_t count, const string & replacement) {
+	string oldText = text;
+	std::vector<Group> oldGroups = groups;
+	std::vector<TreeNode *> parents = rootParents();
+	try {
+		update(pos, count, replacement);
+	} catch (...) {
+		restore(oldText, oldGroups, parents);
+		throw;
+	}
+}
+
+/*
+ * Replaces count chars of the text at pos with replacement, and brings the
+ * tree up to date.
+ *
+ * Algorithm:
+ * If the edit adds or removes a parenthesis or a comma, parse the whole text.
+ * Else the groups stay the same, so move the positions of the parentheses
+ * after the edit along by the change in length. If the first group after the
+ * edit has become a function call or stopped being one, parse the whole text.
+ * Else find the innermost kept group that has the edit inside it and parse it
+ * again, reusing the kept groups inside it.
+ *	If it comes out as a number or variable, it can't be kept any more (see
+ *	Group), so parse the kept group around it instead.
+ *	Else put the new subtree where the old one was (the outer groups that
+ *	had the same root get the new root too) and delete the old subtree's
+ *	nodes, apart from the kept subtrees in it.
+ */
+void IncrementalParser::update(size_t pos, size_t count, const string & replacement) {
+	if (pos > text.size())
+		pos = text.size();
+	if (count > text.size() - pos)
+		count = text.size() - pos;
+
+	if (text.find_first_of("(),", pos) < pos + count || replacement.find_first_of("(),") != string::npos) {
+		string e = text;
+		e.replace(pos, count, replacement);
+		parse(e);
+		return;
+	}
+
+	text.replace(pos, count, replacement);
+	size_t end = pos + replacement.size();
+	for (size_t g = 1; g < groups.size(); g++) {
+		if (groups[g].open >= pos + count)
+			groups[g].open = groups[g].open - count + replacement.size();
+		if (groups[g].close >= pos + count)
+			groups[g].close = groups[g].close - count + replacement.size();
+	}
+	groups[0].close = text.size();
+
+	int g = 0;
+	for (size_t i = 1; i < groups.size(); i++) {
+		if (groups[i].open >= end) {
+			if (isFunctionCall(groups[i].open) != groups[i].function) {
+				string e = text;
+				parse(e);
+				return;
+			}
+			break;
+		}
+		if (groups[i].close >= end)
+			g = i;
+	}
+
+	parsedTokens = 0;
+	while (g != 0 && (groups[g].function || groups[g].root == NULL))
+		g = groups[g].parent;
+	while (true) {
+		std::set<TreeNode *> kept;
+		TreeNode * old = groups[g].root;
+		//Where old hangs from has to be read before parsing: if old is also the root of a
+		//group inside this one (as in "((x))"), parseGroup makes it a child of the new root.
+		TreeNode * parent = old == NULL ? NULL : old->getParent();
+		bool onLeft = parent != NULL && parent->getLeftChild() == old;
+		TreeNode * fresh = parseGroup(g, kept);
+		if (g != 0 && (fresh == NULL || !fresh->isOperator())) {
+			freeLevel(fresh, kept);
+			groups[g].root = NULL;
+			do
+				g = groups[g].parent;
+			while (g != 0 && (groups[g].function || groups[g].root == NULL));
+			continue;
+		}
+
+		if (parent != NULL) {
+			if (onLeft)
+				parent->setLeftChild(fresh);
+			else
+				parent->setRightChild(fresh);
+		}
+		if (fresh != NULL)
+			fresh->setParent(parent);
+		for (int a = g; a >= 0 && groups[a].root == old; a = groups[a].parent)
+			groups[a].root = fresh;
+		freeLevel(old, kept);
+		return;
+	}
+}
+
+/*
+ * Returns the text of the expression.
+ */
+const string & IncrementalParser::getText() const { return text; }
+
+/*
+ * Returns the root of the tree.
+ */
+TreeNode * IncrementalParser::getRoot() { return groups[0].root; }
+
+/*
+ * Returns how many tokens the last parse(...) or edit(...) parsed.
+ */
+int IncrementalParser::tokensParsed() const { return parsedTokens; }
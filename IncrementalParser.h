@@ -0,0 +1,79 @@
+#ifndef INCREMENTALPARSER_H
+#define INCREMENTALPARSER_H
+
+#include <vector>
+#include <string>
+#include <set>
+
+#include "ExprTree.h"
+
+/*
+ * Keeps the tree of an expression up to date while its text is edited,
+ * without parsing the whole text again after every edit.
+ *
+ * A parenthesised group always becomes one subtree, whatever is around it,
+ * so the parser remembers where each group is in the text and which subtree
+ * it became. After an edit, only the innermost group around the edit is
+ * tokenised and parsed again, with the groups inside it that the edit
+ * didn't touch put back in as they are. Its new subtree then takes the place
+ * of the old one. The work done depends on the size of that one group's own
+ * text (not counting the groups in it), not on the size of the expression.
+ *
+ * Edits that add or remove parentheses or commas change where the groups
+ * are, and edits that turn a function name into something else (or the other
+ * way around) change what a group is, so those fall back to a full parse.
+ * The tree is always the same as buildTree(tokenise(getText())) would give.
+ */
+class IncrementalParser{
+
+ private:
+
+  /*
+   * A parenthesised group: the positions of its parentheses in the text,
+   * and the subtree it became, if that is being kept.
+   * Only groups that are not the arguments of a function call and whose
+   * subtree has an operator at the root are kept. Others (like "(5)", which
+   * a neg in front of it folds into a negative number) are parsed along
+   * with the group around them.
+   * Group 0 is the whole text, from 0 to the length of the text, and is
+   * always kept, whatever is at its root.
+   */
+  struct Group{
+    size_t open;
+    size_t close;
+    int parent;
+    std::vector<int> children;
+    bool function; //True if the parentheses are those of a function call, e.g. max(1, 2).
+    TreeNode * root;
+  };
+
+  string text;
+  std::vector<Group> groups; //In the order their open parentheses appear.
+  int parsedTokens;
+
+  bool isFunctionCall(size_t) const;
+  void findGroups();
+  void tokenisePiece(size_t, size_t, vector<string> &);
+  void collect(int, vector<string> &, vector<TreeNode *> &, std::set<TreeNode *> &);
+  TreeNode * parseGroup(int, std::set<TreeNode *> &);
+  static void freeLevel(TreeNode *, const std::set<TreeNode *> &);
+  std::vector<TreeNode *> rootParents() const;
+  void restore(string &, std::vector<Group> &, const std::vector<TreeNode *> &);
+  void update(size_t, size_t, const string &);
+
+ public:
+
+  IncrementalParser(); //Sets up an empty expression.
+  ~IncrementalParser();
+  void parse(const string &); //Parses a whole new expression.
+  void edit(size_t, size_t, const string &); //Replaces a number of chars at a position with new text
+                                             //and brings the tree up to date.
+                                             //If the new text can't be parsed, both throw
+                                             //std::invalid_argument and leave the text and tree as they were.
+  const string & getText() const;
+  TreeNode * getRoot(); //Returns the root of the tree. The parser keeps ownership of the nodes.
+  int tokensParsed() const; //Returns how many tokens the last parse(...) or edit(...) had to parse.
+
+};
+
+#endif
@@ -0,0 +1,259 @@
+#include "IndexedPrefix.h"
+#include <sstream>
+
+/*
+ * Helper function that returns the number of digits of n.
+ */
+size_t countDigits(size_t n) {
+	size_t digits = 1;
+	while (n >= 10) {
+		n /= 10;
+		digits++;
+	}
+	return digits;
+}
+
+/*
+ * Recursive function that works out the length of the indexed prefix form of
+ * the subtree at n, and stores the length of the operands of every operator in
+ * lengths, in prefix order, for write to use.
+ * NoOp nodes are written as ":0", without their children.
+ * Deferred nodes are materialised as they are reached, so appendIndexed
+ * never sees one.
+ */
+size_t measure(TreeNode * n, vector<size_t> & lengths) {
+	ExprTree::materialise(n);
+	size_t slot = lengths.size();
+	lengths.push_back(0);
+	if (n->isValue() || n->isVariable())
+		return n->toString().size();
+	if (!n->isOperator())
+		return 2;
+
+	size_t operands = measure(n->getLeftChild(), lengths);
+	if (!n->isUnary())
+		operands += 1 + measure(n->getRightChild(), lengths);
+	lengths[slot] = operands;
+	return n->toString().size() + 1 + countDigits(operands) + 1 + operands;
+}
+
+/*
+ * Recursive function that appends the indexed prefix form of the subtree at n
+ * to out, taking the operand lengths from lengths in the same order measure
+ * stored them.
+ */
+void appendIndexed(TreeNode * n, const vector<size_t> & lengths, size_t & slot, string & out) {
+	size_t operands = lengths[slot++];
+	if (n->isValue() || n->isVariable()) {
+		out += n->toString();
+		return;
+	}
+	if (!n->isOperator()) {
+		out += ":0";
+		return;
+	}
+
+	std::stringstream stream;
+	stream << operands;
+	out += n->toString();
+	out += ':';
+	out += stream.str();
+	out += ' ';
+	appendIndexed(n->getLeftChild(), lengths, slot, out);
+	if (!n->isUnary()) {
+		out += ' ';
+		appendIndexed(n->getRightChild(), lengths, slot, out);
+	}
+}
+
+/*
+ * Given an ExprTree t, this function returns the indexed prefix form of it.
+ *
+ * Algorithm:
+ * The length of an operator's operands has to be written before them, so
+ * first measure every subtree bottom up, then write the tree top down using
+ * the lengths. Both passes visit each node once.
+ */
+string IndexedPrefix::write(const ExprTree & t) {
+	TreeNode * root = t.getRoot();
+	string out;
+	if (root == NULL)
+		return out;
+
+	vector<size_t> lengths;
+	out.reserve(measure(root, lengths));
+	size_t slot = 0;
+	appendIndexed(root, lengths, slot, out);
+	return out;
+}
+
+/*
+ * Returns the position just past the token at pos.
+ */
+size_t IndexedPrefix::tokenEnd(const string & s, size_t pos) {
+	size_t end = s.find(' ', pos);
+	return end == string::npos ? s.size() : end;
+}
+
+/*
+ * Reads the header of the operator at pos: its operator, and where its
+ * operands start and how many chars they take.
+ * It returns false if the token at pos is a number or a variable instead.
+ */
+bool IndexedPrefix::readHeader(const string & s, size_t pos, Operator & op, size_t & start, size_t & length) {
+	size_t end = tokenEnd(s, pos);
+	if (end == pos)
+		return false;
+	size_t colon = s.rfind(':', end - 1);
+	if (colon == string::npos || colon < pos || colon + 1 == end)
+		return false;
+
+	length = 0;
+	for (size_t i = colon + 1; i < end; i++) {
+		if (s[i] < '0' || s[i] > '9')
+			return false;
+		length = length * 10 + (s[i] - '0');
+	}
+	op = OperatorRegistry::lookup(s.substr(pos, colon - pos));
+	start = length == 0 ? end : end + 1;
+	return true;
+}
+
+/*
+ * Returns the position just past the subtree at pos. For an operator this
+ * only reads its header.
+ */
+size_t IndexedPrefix::skip(const string & s, size_t pos) {
+	Operator op;
+	size_t start, length;
+	if (readHeader(s, pos, op, start, length))
+		return start + length;
+	return tokenEnd(s, pos);
+}
+
+/*
+ * Returns the position of the k-th operand (0 for the left one) of the node
+ * at pos, or string::npos if it doesn't have one. The operands before it are
+ * skipped, not read.
+ */
+size_t IndexedPrefix::child(const string & s, size_t pos, int k) {
+	Operator op;
+	size_t start, length;
+	if (!readHeader(s, pos, op, start, length) || length == 0)
+		return string::npos;
+
+	size_t c = start;
+	for (int i = 0; i < k; i++) {
+		c = skip(s, c) + 1;
+		if (c >= start + length)
+			return string::npos;
+	}
+	return c;
+}
+
+/*
+ * Returns the position of the node at the end of path, a string of "L" (left
+ * operand) and "R" (right operand) steps from the root, or string::npos if
+ * the path leaves the tree.
+ */
+size_t IndexedPrefix::find(const string & s, const string & path) {
+	if (s.empty())
+		return string::npos;
+	size_t pos = 0;
+	for (string::const_iterator step = path.begin(); step != path.end(); ++step) {
+		pos = child(s, pos, *step == 'R' ? 1 : 0);
+		if (pos == string::npos)
+			return pos;
+	}
+	return pos;
+}
+
+/*
+ * Returns the indexed prefix form of the subtree at pos, which is just the
+ * part of s that it takes up.
+ */
+string IndexedPrefix::extract(const string & s, size_t pos) {
+	return s.substr(pos, skip(s, pos) - pos);
+}
+
+/*
+ * Evaluates the subtree at pos, which must not contain variables.
+ */
+int IndexedPrefix::evaluate(const string & s, size_t pos) {
+	static const Bindings noVariables;
+	return evaluate(s, pos, noVariables);
+}
+
+/*
+ * Evaluates the subtree at pos the same way ExprTree::evaluate does, straight
+ * off the string. The operands of &&, || and ?: that are not needed are
+ * skipped over without being read.
+ */
+int IndexedPrefix::evaluate(const string & s, size_t pos, const Bindings & variables) {
+	Operator op;
+	size_t start, length;
+	if (!readHeader(s, pos, op, start, length)) {
+		string token = s.substr(pos, tokenEnd(s, pos) - pos);
+		if (!token.empty() && (token[0] == '-' || (token[0] >= '0' && token[0] <= '9')))
+			return atoi(token.c_str());
+		Bindings::const_iterator binding = variables.find(token);
+		return binding == variables.end() ? 0 : binding->second;
+	}
+	if (length == 0)
+		return 0;
+
+	size_t right = skip(s, start) + 1;
+	switch (op) {
+	case And:
+		return evaluate(s, start, variables) != 0 && evaluate(s, right, variables) != 0;
+	case Or:
+		return evaluate(s, start, variables) != 0 || evaluate(s, right, variables) != 0;
+	case Conditional: {
+		int condition = evaluate(s, start, variables);
+		Operator branchOp;
+		size_t branches, branchesLength;
+		if (!readHeader(s, right, branchOp, branches, branchesLength) || branchOp != Alternative)
+			return condition ? evaluate(s, right, variables) : 0;
+		return evaluate(s, condition ? branches : skip(s, branches) + 1, variables);
+	}
+	case Alternative:
+		return evaluate(s, start, variables);
+	default: {
+		const OperatorInfo & info = OperatorRegistry::get(op);
+		if (info.kernel == NULL)
+			return 0;
+		int left = evaluate(s, start, variables);
+		if (info.arity == 1)
+			return info.kernel(left, 0);
+		return info.kernel(left, evaluate(s, right, variables));
+	}
+	}
+}
+
+/*
+ * Builds TreeNodes for the subtree at pos. The caller owns the result,
+ * e.g. by giving it to an ExprTree.
+ */
+TreeNode * IndexedPrefix::toTree(const string & s, size_t pos) {
+	Operator op;
+	size_t start, length;
+	if (!readHeader(s, pos, op, start, length)) {
+		string token = s.substr(pos, tokenEnd(s, pos) - pos);
+		if (!token.empty() && (token[0] == '-' || (token[0] >= '0' && token[0] <= '9')))
+			return new TreeNode(atoi(token.c_str()));
+		return new TreeNode(token);
+	}
+
+	TreeNode * n = new TreeNode(op);
+	if (length == 0)
+		return n;
+	TreeNode * left = toTree(s, start);
+	n->setLeftChild(left);
+	left->setParent(n);
+	if (OperatorRegistry::get(op).arity != 1) {
+		TreeNode * right = toTree(s, skip(s, start) + 1);
+		n->setRightChild(right);
+		right->setParent(n);
+	}
+	return n;
+}
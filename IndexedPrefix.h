@@ -0,0 +1,47 @@
+#ifndef INDEXEDPREFIX_H
+#define INDEXEDPREFIX_H
+
+#include <string>
+
+#include "ExprTree.h"
+
+/*
+ * A text form of prefix notation where every operator carries the length
+ * of its operands, so a reader can step over a whole subtree without
+ * reading it.
+ *
+ * Numbers and variables are written as in prefixOrder. An operator is
+ * written as its symbol, a colon and the number of chars taken by its
+ * operands (including the spaces between them), e.g. 2 * (3 + 4) is
+ *
+ *	*:9 2 +:3 3 4
+ *
+ * Skipping a subtree is then one header read, and the operands of any
+ * node, and so any path from the root, can be reached by skipping the
+ * siblings before them. Positions are char offsets into the string, and
+ * the root is at position 0.
+ */
+class IndexedPrefix{
+
+ private:
+
+  static size_t tokenEnd(const string &, size_t);
+  static bool readHeader(const string &, size_t, Operator &, size_t &, size_t &);
+
+ public:
+
+  static string write(const ExprTree &); //Returns the indexed prefix form of a tree.
+  static size_t skip(const string &, size_t); //Returns the position just past the subtree at a position.
+  static size_t child(const string &, size_t, int); //Returns the position of the k-th operand (0 = left)
+                                                    //of the node at a position, or string::npos if there isn't one.
+  static size_t find(const string &, const string &); //Returns the position of the node at the end of a path
+                                                      //from the root, written as "L" and "R" steps (e.g. "LRL"),
+                                                      //or string::npos if there isn't one.
+  static string extract(const string &, size_t); //Returns the indexed prefix form of the subtree at a position.
+  static int evaluate(const string &, size_t); //Evaluates the subtree at a position without building it.
+  static int evaluate(const string &, size_t, const Bindings &);
+  static TreeNode * toTree(const string &, size_t); //Builds the subtree at a position. The caller owns the result.
+
+};
+
+#endif
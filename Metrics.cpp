@@ -0,0 +1,319 @@
+#include "Metrics.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <chrono>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+
+/*
+ * A count of every metric.
+ */
+struct MetricsTotals{
+	uint64_t counters[Metrics::counterCount];
+	uint64_t buckets[Metrics::phaseCount][Metrics::bucketCount + 1]; //The last one is +Inf.
+	uint64_t nanoseconds[Metrics::phaseCount];
+};
+
+/*
+ * The counts of one thread. Only that thread changes them, so it adds with
+ * a load and a store rather than a locked add. They are atomic so they can
+ * be read from other threads at the same time. It is aligned to a cache
+ * line (and so takes whole lines), so no two threads' shards share one; it
+ * has its own operator new, since the plain one only honours that from
+ * C++17.
+ * Other threads never change the counts, as a store between the owner's
+ * load and store would be lost. Instead, Metrics::reset keeps what each
+ * count was at the time as its base, and reading takes the base off.
+ */
+struct alignas(64) MetricsShard{
+	std::atomic<uint64_t> counters[Metrics::counterCount];
+	std::atomic<uint64_t> buckets[Metrics::phaseCount][Metrics::bucketCount + 1];
+	std::atomic<uint64_t> nanoseconds[Metrics::phaseCount];
+	MetricsTotals base; //Guarded by metricsLock.
+
+	static void * operator new(size_t);
+	static void operator delete(void *);
+};
+
+void * MetricsShard::operator new(size_t size) {
+	void * memory;
+	if (posix_memalign(&memory, alignof(MetricsShard), size) != 0)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void MetricsShard::operator delete(void * memory) {
+	free(memory);
+}
+
+/*
+ * Frees the calling thread's shard when the thread ends (see ownShard).
+ */
+struct MetricsShardOwner{
+	~MetricsShardOwner();
+};
+
+/*
+ * Whether the library counts anything.
+ */
+std::atomic<bool> metricsOn(false);
+
+/*
+ * The shards of the threads that are running, and the lock that guards
+ * the list. It is only taken when a thread makes or frees its shard, and
+ * when reading or resetting.
+ */
+std::mutex metricsLock;
+std::vector<MetricsShard *> metricsShards;
+
+/*
+ * What the threads that have ended counted since the last reset. Guarded by
+ * metricsLock.
+ */
+MetricsTotals metricsRetired;
+
+/*
+ * The calling thread's shard, or NULL until it counts something.
+ */
+thread_local MetricsShard * metricsShard = NULL;
+
+/*
+ * The names and help text of the counters, by Counter, and the names of
+ * the phases, by Phase.
+ */
+const char * counterNames[] = {"exprtree_expressions_parsed_total", "exprtree_nodes_built_total",
+                               "exprtree_nodes_freed_total", "exprtree_bytes_allocated_total",
+                               "exprtree_evaluations_total", "exprtree_cache_hits_total",
+                               "exprtree_cache_misses_total"};
+const char * counterHelp[] = {"Expressions parsed into trees by buildTree.", "TreeNodes made.", "TreeNodes deleted.",
+                              "Bytes allocated for TreeNodes, including their headers.",
+                              "Trees evaluated by evaluateWholeTree.", "TreeCache lookups that found the tree.",
+                              "TreeCache lookups that had to parse the expression."};
+const char * phaseNames[] = {"tokenise", "build", "evaluate"};
+
+/*
+ * Helper function that returns the calling thread's shard, making it and
+ * adding it to the list if it has none. The first time, it also makes the
+ * thread's MetricsShardOwner, so the shard is freed when the thread ends.
+ */
+MetricsShard * ownShard() {
+	if (metricsShard == NULL) {
+		static thread_local MetricsShardOwner owner;
+		MetricsShard * s = new MetricsShard();
+		for (int c = 0; c < Metrics::counterCount; c++) {
+			s->counters[c].store(0, std::memory_order_relaxed);
+			s->base.counters[c] = 0;
+		}
+		for (int p = 0; p < Metrics::phaseCount; p++) {
+			for (int b = 0; b <= Metrics::bucketCount; b++) {
+				s->buckets[p][b].store(0, std::memory_order_relaxed);
+				s->base.buckets[p][b] = 0;
+			}
+			s->nanoseconds[p].store(0, std::memory_order_relaxed);
+			s->base.nanoseconds[p] = 0;
+		}
+		std::unique_lock<std::mutex> guard(metricsLock);
+		metricsShards.push_back(s);
+		metricsShard = s;
+	}
+	return metricsShard;
+}
+
+/*
+ * Helper function that adds what shard s has counted since its base to
+ * totals. metricsLock must be held.
+ */
+void addSinceBase(const MetricsShard & s, MetricsTotals & totals) {
+	for (int c = 0; c < Metrics::counterCount; c++)
+		totals.counters[c] += s.counters[c].load(std::memory_order_relaxed) - s.base.counters[c];
+	for (int p = 0; p < Metrics::phaseCount; p++) {
+		for (int b = 0; b <= Metrics::bucketCount; b++)
+			totals.buckets[p][b] += s.buckets[p][b].load(std::memory_order_relaxed) - s.base.buckets[p][b];
+		totals.nanoseconds[p] += s.nanoseconds[p].load(std::memory_order_relaxed) - s.base.nanoseconds[p];
+	}
+}
+
+/*
+ * Helper function that returns every metric since the last reset: what the
+ * ended threads counted, plus what each running thread has.
+ */
+MetricsTotals metricsTotals() {
+	std::unique_lock<std::mutex> guard(metricsLock);
+	MetricsTotals totals = metricsRetired;
+	for (size_t i = 0; i < metricsShards.size(); i++)
+		addSinceBase(*metricsShards[i], totals);
+	return totals;
+}
+
+/*
+ * Destructor, run when a thread that counted something ends, that adds its
+ * shard's counts to metricsRetired, takes it off the list and frees it. So
+ * short-lived threads don't leave a shard behind each, and nothing they
+ * counted is lost.
+ */
+MetricsShardOwner::~MetricsShardOwner() {
+	MetricsShard * s = metricsShard;
+	if (s == NULL)
+		return;
+	std::unique_lock<std::mutex> guard(metricsLock);
+	addSinceBase(*s, metricsRetired);
+	metricsShards.erase(std::find(metricsShards.begin(), metricsShards.end(), s));
+	metricsShard = NULL;
+	delete s;
+}
+
+/*
+ * Helper function that adds n to a counter that only the calling thread
+ * changes.
+ */
+void bump(std::atomic<uint64_t> & counter, uint64_t n) {
+	counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+/*
+ * Returns the upper bound of histogram bucket b, in nanoseconds.
+ */
+uint64_t bucketBound(int b) {
+	return (uint64_t)1000 << (2 * b);
+}
+
+/*
+ * Returns true if the library is counting.
+ */
+bool Metrics::enabled() { return metricsOn.load(std::memory_order_relaxed); }
+
+/*
+ * Starts or stops the library counting.
+ */
+void Metrics::enable(bool on) { metricsOn.store(on, std::memory_order_relaxed); }
+
+/*
+ * Adds n to counter c.
+ */
+void Metrics::add(Counter c, uint64_t n) {
+	bump(ownShard()->counters[c], n);
+}
+
+/*
+ * Adds the time from start (from now()) until now to the histogram of
+ * phase p: to the first bucket whose bound it is under, and to the sum.
+ */
+void Metrics::observe(Phase p, uint64_t start) {
+	uint64_t taken = now() - start;
+	int b = 0;
+	while (b < bucketCount && taken > bucketBound(b))
+		b++;
+	MetricsShard * s = ownShard();
+	bump(s->buckets[p][b], 1);
+	bump(s->nanoseconds[p], taken);
+}
+
+/*
+ * Returns the time from a steady clock in nanoseconds.
+ */
+uint64_t Metrics::now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * Returns the total of counter c over every thread.
+ */
+uint64_t Metrics::get(Counter c) {
+	return metricsTotals().counters[c];
+}
+
+/*
+ * Returns how many times phase p has been timed, over every thread.
+ */
+uint64_t Metrics::observations(Phase p) {
+	MetricsTotals totals = metricsTotals();
+	uint64_t total = 0;
+	for (int b = 0; b <= bucketCount; b++)
+		total += totals.buckets[p][b];
+	return total;
+}
+
+/*
+ * Returns every metric in the Prometheus text exposition format: each
+ * counter, the number of live TreeNodes (made less deleted) as a gauge,
+ * and a histogram of each phase's latency in seconds, labelled with the
+ * phase, with cumulative buckets as the format wants.
+ * The shards are added up under the lock, so every metric is from the
+ * same moment, give or take counts made while they are added up.
+ */
+string Metrics::render() {
+	MetricsTotals totals = metricsTotals();
+	const uint64_t * counters = totals.counters;
+
+	std::stringstream out;
+	out.precision(12);
+	for (int c = 0; c < counterCount; c++) {
+		out << "# HELP " << counterNames[c] << " " << counterHelp[c] << "\n";
+		out << "# TYPE " << counterNames[c] << " counter\n";
+		out << counterNames[c] << " " << counters[c] << "\n";
+	}
+	uint64_t live = counters[NodesBuilt] > counters[NodesFreed] ? counters[NodesBuilt] - counters[NodesFreed] : 0;
+	out << "# HELP exprtree_nodes_live TreeNodes made and not yet deleted.\n";
+	out << "# TYPE exprtree_nodes_live gauge\n";
+	out << "exprtree_nodes_live " << live << "\n";
+
+	out << "# HELP exprtree_phase_duration_seconds Time taken by tokenise, buildTree and evaluateWholeTree.\n";
+	out << "# TYPE exprtree_phase_duration_seconds histogram\n";
+	for (int p = 0; p < phaseCount; p++) {
+		uint64_t cumulative = 0;
+		for (int b = 0; b <= bucketCount; b++) {
+			cumulative += totals.buckets[p][b];
+			out << "exprtree_phase_duration_seconds_bucket{phase=\"" << phaseNames[p] << "\",le=\"";
+			if (b == bucketCount)
+				out << "+Inf";
+			else
+				out << bucketBound(b) / 1e9;
+			out << "\"} " << cumulative << "\n";
+		}
+		out << "exprtree_phase_duration_seconds_sum{phase=\"" << phaseNames[p] << "\"} " << totals.nanoseconds[p] / 1e9 << "\n";
+		out << "exprtree_phase_duration_seconds_count{phase=\"" << phaseNames[p] << "\"} " << cumulative << "\n";
+	}
+	return out.str();
+}
+
+/*
+ * Writes render() to the file at path. It is written under another name
+ * and then renamed, so a scraper never reads half a file.
+ */
+bool Metrics::write(const string & path) {
+	string text = render();
+	string temporary = path + ".tmp";
+	{
+		std::ofstream file(temporary.c_str(), std::ios::trunc);
+		if (!file.write(text.data(), text.size()))
+			return false;
+	}
+	return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+/*
+ * Sets every metric back to 0, by making each shard's counts so far its
+ * base, and forgetting what ended threads counted. The shards themselves
+ * are left to their threads, so a thread that is counting meanwhile loses
+ * nothing: its counts from after the reset are all read back.
+ */
+void Metrics::reset() {
+	std::unique_lock<std::mutex> guard(metricsLock);
+	metricsRetired = MetricsTotals();
+	for (size_t i = 0; i < metricsShards.size(); i++) {
+		MetricsShard * s = metricsShards[i];
+		for (int c = 0; c < counterCount; c++)
+			s->base.counters[c] = s->counters[c].load(std::memory_order_relaxed);
+		for (int p = 0; p < phaseCount; p++) {
+			for (int b = 0; b <= bucketCount; b++)
+				s->base.buckets[p][b] = s->buckets[p][b].load(std::memory_order_relaxed);
+			s->base.nanoseconds[p] = s->nanoseconds[p].load(std::memory_order_relaxed);
+		}
+	}
+}
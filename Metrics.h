@@ -0,0 +1,48 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <stdint.h>
+
+using std::string;
+
+/*
+ * Counters and latency histograms for the whole library, which can be
+ * written out in the Prometheus text exposition format, e.g. into the
+ * directory a node exporter's textfile collector reads.
+ *
+ * Once enabled, the library counts the expressions it parses
+ * (buildTree), the TreeNodes it makes and frees and their bytes, the
+ * trees it evaluates (evaluateWholeTree), and TreeCache hits and misses,
+ * and times tokenise, buildTree and evaluateWholeTree. When disabled (the
+ * default) each of those places only checks whether it is enabled.
+ * Each thread counts into a shard of its own, so counting takes no locks
+ * and threads don't share cache lines. Reading adds up the shards. When a
+ * thread ends, its counts are added to a total kept for ended threads and
+ * its shard is freed, so nothing counted is lost.
+ * Everything is static, as there is one set of metrics for the process.
+ */
+class Metrics{
+
+ public:
+
+  enum Counter{ExpressionsParsed, NodesBuilt, NodesFreed, BytesAllocated, Evaluations, CacheHits, CacheMisses,
+               counterCount};
+  enum Phase{Tokenise, Build, Evaluate, phaseCount};
+  static const int bucketCount = 12; //Histogram buckets, from 1 microsecond up by 4 times each, then +Inf.
+
+  static bool enabled();
+  static void enable(bool);
+  static void add(Counter, uint64_t = 1); //Adds to a counter, on the calling thread's shard.
+  static void observe(Phase, uint64_t); //Adds the time since a start time (from now()) to a phase's histogram.
+  static uint64_t now(); //The time in nanoseconds.
+  static uint64_t get(Counter); //The total of a counter over every thread.
+  static uint64_t observations(Phase); //How many times a phase has been timed.
+  static string render(); //Every metric in the Prometheus text format.
+  static bool write(const string &); //Writes render() to a file (through a temporary file, renamed into
+                                     //place). Returns false if it can't.
+  static void reset(); //Sets everything back to 0. Threads can keep counting while it runs.
+
+};
+
+#endif
@@ -0,0 +1,303 @@
+#include "NativeRules.h"
+#include <fstream>
+#include <cstdlib>
+#include <climits>
+#include <dlfcn.h>
+#include <unistd.h>
+
+/*
+ * The start of the generated source. It has the built in kernels of
+ * OperatorRegistry.cpp, so the compiler can inline them. The ones that can
+ * overflow are done with unsigned ints, which wrap the same way the
+ * kernels do when they are called through a pointer, but which the
+ * compiler can't assume never overflow.
+ */
+const char * nativePrelude =
+	"typedef int (*Kernel)(int, int);\n"
+	"static inline int add(int a, int b) { return (int)((unsigned)a + (unsigned)b); }\n"
+	"static inline int subtract(int a, int b) { return (int)((unsigned)a - (unsigned)b); }\n"
+	"static inline int multiply(int a, int b) { return (int)((unsigned)a * (unsigned)b); }\n"
+	"static inline int divide(int a, int b) { return a / b; }\n"
+	"static inline int modulo(int a, int b) { return a % b; }\n"
+	"static inline int minimum(int a, int b) { return a < b ? a : b; }\n"
+	"static inline int maximum(int a, int b) { return a > b ? a : b; }\n"
+	"static inline int absolute(int a, int) { return a < 0 ? (int)(0u - (unsigned)a) : a; }\n"
+	"static inline int negate(int a, int) { return (int)(0u - (unsigned)a); }\n"
+	"static inline int less(int a, int b) { return a < b; }\n"
+	"static inline int lessEqual(int a, int b) { return a <= b; }\n"
+	"static inline int greater(int a, int b) { return a > b; }\n"
+	"static inline int greaterEqual(int a, int b) { return a >= b; }\n"
+	"static inline int equal(int a, int b) { return a == b; }\n"
+	"static inline int notEqual(int a, int b) { return a != b; }\n"
+	"static inline int power(int base, int exp) {\n"
+	"\tif (exp < 0)\n"
+	"\t\treturn base == 1 ? 1 : base == -1 ? (exp % 2 == 0 ? 1 : -1) : 0;\n"
+	"\tint result = 1;\n"
+	"\twhile (exp > 0) {\n"
+	"\t\tif (exp & 1)\n"
+	"\t\t\tresult = multiply(result, base);\n"
+	"\t\texp >>= 1;\n"
+	"\t\tif (exp > 0)\n"
+	"\t\t\tbase = multiply(base, base);\n"
+	"\t}\n"
+	"\treturn result;\n"
+	"}\n";
+
+/*
+ * The names of the kernels in nativePrelude, by Operator value, for the
+ * built in operators that have one.
+ */
+const char * nativeKernels[] = {NULL, "add", "subtract", "multiply", "divide", "power", "modulo",
+                                "minimum", "maximum", "absolute", "negate", "less", "lessEqual",
+                                "greater", "greaterEqual", "equal", "notEqual"};
+
+/*
+ * Constructor that sets up an empty set of rules.
+ */
+NativeRules::NativeRules() {
+	library = NULL;
+}
+
+/*
+ * Destructor that unloads the library and deletes the rules.
+ */
+NativeRules::~NativeRules() {
+	unload();
+	for (size_t i = 0; i < rules.size(); i++)
+		delete rules[i];
+}
+
+/*
+ * Forgets the compiled rules and unloads the library.
+ */
+void NativeRules::unload() {
+	functions.clear();
+	if (library != NULL)
+		dlclose(library);
+	library = NULL;
+}
+
+/*
+ * Adds a copy of the tree t as a rule, with its Deferred nodes parsed, and
+ * adds the variables in it that no rule had yet to the end of the list of
+ * variables. Returns the id of the rule.
+ */
+int NativeRules::addRule(const ExprTree & t) {
+	ExprTree * rule = new ExprTree(t);
+	ExprTree::materialiseAll(rule->getRoot());
+	for (TreeNode * n : rule->preorder()) {
+		if (n->isVariable() && variableIndex.count(n->getName()) == 0) {
+			variableIndex[n->getName()] = variables.size();
+			variables.push_back(n->getName());
+		}
+	}
+	rules.push_back(rule);
+	return rules.size() - 1;
+}
+
+/*
+ * Recursive function that writes the code for the subtree at n onto the
+ * back of out, each line starting with indent, and returns the C++
+ * expression for its value: a number, a variable, or the local that the
+ * code puts the value in. Locals are numbered with next.
+ *
+ * Algorithm:
+ * A number or a variable needs no code.
+ * && and || work out their left operand, and only work out the right one
+ * inside an if, when it is needed. ?: works out its condition and then one
+ * branch or the other. Alternative on its own gives its left operand, as in
+ * ExprTree::evaluate.
+ * Any other operator works out its operands and puts its kernel's result
+ * in a new local. Built in kernels are called by name, and custom ones
+ * through the kernel table k. An operator without a kernel is 0.
+ */
+string NativeRules::emit(TreeNode * n, std::stringstream & out, int & next, const string & indent) {
+	std::stringstream value;
+	switch (n->getOperator()) {
+	case Value:
+		if (n->getValue() == INT_MIN)
+			return "(-2147483647 - 1)";
+		value << "(" << n->getValue() << ")";
+		return value.str();
+	case Variable:
+		value << "v[" << variableIndex[n->getName()] << "]";
+		return value.str();
+	case And:
+	case Or: {
+		bool isAnd = n->getOperator() == And;
+		string left = emit(n->getLeftChild(), out, next, indent);
+		value << "t" << next++;
+		out << indent << "int " << value.str() << ";\n";
+		out << indent << "if ((" << left << ") " << (isAnd ? "!=" : "==") << " 0) {\n";
+		string right = emit(n->getRightChild(), out, next, indent + "\t");
+		out << indent << "\t" << value.str() << " = (" << right << ") != 0;\n";
+		out << indent << "} else\n";
+		out << indent << "\t" << value.str() << " = " << (isAnd ? "0" : "1") << ";\n";
+		return value.str();
+	}
+	case Conditional: {
+		string condition = emit(n->getLeftChild(), out, next, indent);
+		TreeNode * branches = n->getRightChild();
+		bool alternative = branches->getOperator() == Alternative;
+		value << "t" << next++;
+		out << indent << "int " << value.str() << ";\n";
+		out << indent << "if ((" << condition << ") != 0) {\n";
+		string whenTrue = emit(alternative ? branches->getLeftChild() : branches, out, next, indent + "\t");
+		out << indent << "\t" << value.str() << " = " << whenTrue << ";\n";
+		out << indent << "} else {\n";
+		string whenFalse = alternative ? emit(branches->getRightChild(), out, next, indent + "\t") : "0";
+		out << indent << "\t" << value.str() << " = " << whenFalse << ";\n";
+		out << indent << "}\n";
+		return value.str();
+	}
+	case Alternative:
+		return emit(n->getLeftChild(), out, next, indent);
+	default: {
+		const OperatorInfo & info = OperatorRegistry::get(n->getOperator());
+		if (info.kernel == NULL)
+			return "0";
+		string left = emit(n->getLeftChild(), out, next, indent);
+		string right = info.arity == 1 ? "0" : emit(n->getRightChild(), out, next, indent);
+		value << "t" << next++;
+		out << indent << "const int " << value.str() << " = ";
+		if (n->getOperator() <= NotEqual)
+			out << nativeKernels[n->getOperator()];
+		else
+			out << "k[" << n->getOperator() << "]";
+		out << "(" << left << ", " << right << ");\n";
+		return value.str();
+	}
+	}
+}
+
+/*
+ * Returns the C++ source for the rules: the kernels, then one function for
+ * each rule, named rule0, rule1 and so on (see Function).
+ */
+string NativeRules::generate() {
+	std::stringstream out;
+	out << nativePrelude;
+	for (size_t i = 0; i < rules.size(); i++) {
+		out << "\nextern \"C\" int rule" << i << "(const int * v, const Kernel * k) {\n";
+		out << "\t(void)v;\n\t(void)k;\n";
+		int next = 0;
+		string result = rules[i]->getRoot() == NULL ? "0" : emit(rules[i]->getRoot(), out, next, "\t");
+		out << "\treturn " << result << ";\n}\n";
+	}
+	return out.str();
+}
+
+/*
+ * Builds the rules into a shared library and loads it.
+ *
+ * Algorithm:
+ * Write the source from generate() into a new temporary directory, and run
+ * the compiler command on it with the flags for a shared library, keeping
+ * what it prints. Load the library with dlopen and look up every rule's
+ * function. The files are deleted once the library is loaded (or not), as
+ * the loaded library doesn't need them.
+ * If any step fails, keep the reason in error and leave every rule to be
+ * evaluated with ExprTree::evaluate.
+ */
+bool NativeRules::compile(const string & compiler) {
+	unload();
+	error.clear();
+	kernels.resize(LastOperator + 1);
+	for (int op = 0; op <= LastOperator; op++)
+		kernels[op] = OperatorRegistry::get(Operator(op)).kernel;
+
+	char directory[] = "/tmp/nativerulesXXXXXX";
+	if (mkdtemp(directory) == NULL) {
+		error = "can't make a temporary directory";
+		return false;
+	}
+	string source = string(directory) + "/rules.cpp";
+	string shared = string(directory) + "/rules.so";
+	string log = string(directory) + "/errors.txt";
+	{
+		std::ofstream file(source.c_str());
+		file << generate();
+	}
+
+	string command = compiler + " -shared -fPIC -o " + shared + " " + source + " 2> " + log;
+	if (std::system(command.c_str()) != 0) {
+		std::ifstream file(log.c_str());
+		std::stringstream messages;
+		messages << file.rdbuf();
+		error = "the compiler failed: " + command + "\n" + messages.str();
+	}
+	else if ((library = dlopen(shared.c_str(), RTLD_NOW | RTLD_LOCAL)) == NULL)
+		error = dlerror();
+	else {
+		for (size_t i = 0; i < rules.size() && error.empty(); i++) {
+			std::stringstream name;
+			name << "rule" << i;
+			Function f = (Function)dlsym(library, name.str().c_str());
+			if (f == NULL)
+				error = "missing " + name.str();
+			functions.push_back(f);
+		}
+		if (!error.empty())
+			unload();
+	}
+
+	unlink(source.c_str());
+	unlink(shared.c_str());
+	unlink(log.c_str());
+	rmdir(directory);
+	return error.empty();
+}
+
+/*
+ * Returns true if the rule with the given id is evaluated with native code.
+ */
+bool NativeRules::isNative(int id) { return id >= 0 && id < (int)functions.size(); }
+
+/*
+ * Returns why the last compile(...) failed, or "" if it didn't.
+ */
+const string & NativeRules::getError() { return error; }
+
+/*
+ * Returns the names of the variables of all the rules, in the order
+ * evaluate(int, const vector<int> &) takes their values.
+ */
+const vector<string> & NativeRules::getVariables() { return variables; }
+
+/*
+ * Evaluates the rule with the given id, with values holding the values of
+ * the variables in the order of getVariables() (missing ones are 0).
+ */
+int NativeRules::evaluate(int id, const vector<int> & values) {
+	if (isNative(id)) {
+		if (values.size() >= variables.size())
+			return functions[id](values.empty() ? NULL : &values[0], &kernels[0]);
+		vector<int> padded(values);
+		padded.resize(variables.size());
+		return functions[id](padded.empty() ? NULL : &padded[0], &kernels[0]);
+	}
+	Bindings bindings;
+	for (size_t i = 0; i < values.size() && i < variables.size(); i++)
+		bindings[variables[i]] = values[i];
+	return ExprTree::evaluate(rules[id]->getRoot(), bindings);
+}
+
+/*
+ * Evaluates the rule with the given id, with the variables given by name.
+ */
+int NativeRules::evaluate(int id, const Bindings & bindings) {
+	if (!isNative(id))
+		return ExprTree::evaluate(rules[id]->getRoot(), bindings);
+	vector<int> values(variables.size());
+	for (size_t i = 0; i < variables.size(); i++) {
+		Bindings::const_iterator binding = bindings.find(variables[i]);
+		if (binding != bindings.end())
+			values[i] = binding->second;
+	}
+	return functions[id](values.empty() ? NULL : &values[0], &kernels[0]);
+}
+
+/*
+ * Returns the number of rules.
+ */
+int NativeRules::size() { return rules.size(); }
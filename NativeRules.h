@@ -0,0 +1,67 @@
+#ifndef NATIVERULES_H
+#define NATIVERULES_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include <sstream>
+
+#include "ExprTree.h"
+
+/*
+ * A set of rules (expression trees) that can be compiled to native code.
+ *
+ * compile(...) writes C++ source with one function for each rule, builds it
+ * into a shared library with the system compiler, and loads it with dlopen.
+ * Each function works out its rule in straight-line code, one local for
+ * each operator, so the compiler can optimise it like any other code.
+ * If anything goes wrong (no compiler, a build error, a missing symbol) the
+ * rules are evaluated with ExprTree::evaluate instead, and getError() says
+ * why. Either way, evaluate gives the same results as ExprTree::evaluate,
+ * including not working out the operands that &&, || and ?: don't need.
+ */
+class NativeRules{
+
+ public:
+
+  /*
+   * The type of a compiled rule: it takes the values of the variables, in
+   * the order of getVariables(), and the kernels of the operators (used for
+   * custom operators), by Operator value.
+   */
+  typedef int (*Function)(const int *, const Kernel *);
+
+  NativeRules();
+  ~NativeRules(); //Unloads the library.
+  int addRule(const ExprTree &); //Adds a copy of a tree as a rule and returns its id. It is evaluated
+                                 //with ExprTree::evaluate until compile(...) is called again.
+  string generate(); //Returns the C++ source for all the rules.
+  bool compile(const string & = "c++ -O2"); //Builds and loads the rules with the given compiler command.
+                                            //Returns true if they are all native now.
+  bool isNative(int); //Returns true if a rule is evaluated with native code.
+  const string & getError(); //Why the last compile(...) failed, or "".
+  const vector<string> & getVariables(); //The variables of all the rules.
+  int evaluate(int, const vector<int> &); //Evaluates a rule with the values of the variables,
+                                          //in the order of getVariables().
+  int evaluate(int, const Bindings &);
+  int size(); //The number of rules.
+
+ private:
+
+  vector<ExprTree *> rules;
+  vector<string> variables;
+  map<string, int> variableIndex; //The position of each variable in variables.
+  vector<Function> functions; //The compiled rules, by id. Rules added since compiling have none.
+  vector<Kernel> kernels; //The kernels of every operator, by Operator value.
+  void * library; //The handle from dlopen, or NULL.
+  string error;
+
+  NativeRules(const NativeRules &); //Not copyable.
+  NativeRules & operator=(const NativeRules &);
+
+  string emit(TreeNode *, std::stringstream &, int &, const string &);
+  void unload();
+
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "NodeArena.h"
+#include <new>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+ * The mbind(2) policy that puts pages only on the given nodes. It is
+ * spelled out here so that libnuma isn't needed to build.
+ */
+const int bindPolicy = 2; //MPOL_BIND
+
+const size_t arenaAlignment = 16; //Every allocation starts at a multiple of this.
+
+/*
+ * The arena each thread allocates TreeNodes from, if any.
+ */
+thread_local NodeArena * currentArena = NULL;
+
+/*
+ * Constructor that sets up an arena with no memory yet, bound to the given
+ * NUMA node (or to none, if it is -1).
+ */
+NodeArena::NodeArena(int numaNode) {
+	this->numaNode = numaNode;
+	chunk = 0;
+	next = NULL;
+	end = NULL;
+}
+
+/*
+ * Destructor that gives the chunks back to the system.
+ */
+NodeArena::~NodeArena() {
+	for (size_t i = 0; i < chunks.size(); i++)
+		munmap(chunks[i], sizes[i]);
+}
+
+/*
+ * Moves on to a chunk with room for at least size bytes: the next one, if
+ * it is big enough, else a new one, which goes in before it.
+ * A new chunk is mapped straight from the system, so that mbind can be used
+ * on it, and so that its pages aren't touched (and placed) until the
+ * allocating thread first writes to them.
+ */
+void NodeArena::nextChunk(size_t size) {
+	if (next != NULL)
+		chunk++;
+	if (chunk >= chunks.size() || sizes[chunk] < size) {
+		size_t length = size > chunkSize ? size : chunkSize;
+		void * p = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			throw std::bad_alloc();
+		if (numaNode >= 0 && numaNode < 64) {
+			unsigned long mask = 1UL << numaNode;
+			syscall(SYS_mbind, p, length, bindPolicy, &mask, sizeof(mask) * 8, 0); //If it fails, first touch places the pages.
+		}
+		chunks.insert(chunks.begin() + chunk, (char *)p);
+		sizes.insert(sizes.begin() + chunk, length);
+	}
+	next = chunks[chunk];
+	end = chunks[chunk] + sizes[chunk];
+}
+
+/*
+ * Returns size bytes of the arena, aligned for any TreeNode.
+ */
+void * NodeArena::allocate(size_t size) {
+	size = (size + arenaAlignment - 1) / arenaAlignment * arenaAlignment;
+	if (next == NULL || (size_t)(end - next) < size)
+		nextChunk(size);
+	void * p = next;
+	next += size;
+	return p;
+}
+
+/*
+ * Starts allocating from the first chunk again. The chunks are kept, so an
+ * arena that is reset after every batch stops asking the system for memory
+ * once it has enough for the biggest batch.
+ */
+void NodeArena::reset() {
+	chunk = 0;
+	next = NULL;
+	end = NULL;
+}
+
+/*
+ * Returns the size of all the chunks taken from the system.
+ */
+size_t NodeArena::bytesReserved() {
+	size_t total = 0;
+	for (size_t i = 0; i < sizes.size(); i++)
+		total += sizes[i];
+	return total;
+}
+
+/*
+ * Returns the NUMA node the memory is bound to, or -1.
+ */
+int NodeArena::getNumaNode() { return numaNode; }
+
+/*
+ * Returns the arena the calling thread allocates TreeNodes from, or NULL.
+ */
+NodeArena * NodeArena::current() { return currentArena; }
+
+/*
+ * Makes the calling thread allocate TreeNodes from arena (or from the heap,
+ * if it is NULL) and returns the arena it used before.
+ */
+NodeArena * NodeArena::use(NodeArena * arena) {
+	NodeArena * previous = currentArena;
+	currentArena = arena;
+	return previous;
+}
@@ -0,0 +1,58 @@
+#ifndef NODEARENA_H
+#define NODEARENA_H
+
+#include <cstddef>
+#include <vector>
+
+/*
+ * A block of memory that TreeNodes can be allocated from instead of the
+ * heap, so that a thread can keep the nodes it builds in memory that is
+ * close to the core it runs on (see BatchEvaluator).
+ *
+ * The memory is taken from the system a chunk at a time. If the arena is
+ * given a NUMA node, each chunk is bound to that node's memory, and if that
+ * can't be done (e.g. the machine has one node) the pages end up on the
+ * node of the thread that first touches them, which is the thread
+ * allocating from the arena.
+ *
+ * While a thread is using an arena (see use(...)), every TreeNode it makes
+ * comes from the arena. Deleting one of those nodes doesn't give its memory
+ * back: all of it is given back at once by reset(), so every node from the
+ * arena must have been deleted (or never be looked at again) by then.
+ * Only one thread can allocate from an arena at a time, but its nodes can
+ * be read and deleted by any thread.
+ */
+class NodeArena{
+
+ public:
+
+  static const size_t chunkSize = 1 << 20; //How much memory to take from the system at a time.
+
+  NodeArena(int = -1); //Takes the NUMA node to bind the memory to, or -1 to leave it to first touch.
+  ~NodeArena(); //Gives every chunk back to the system.
+  void * allocate(size_t);
+  void reset(); //Makes all of the memory free again, keeping the chunks for reuse.
+  size_t bytesReserved(); //The size of all the chunks taken from the system.
+  int getNumaNode();
+
+  static NodeArena * current(); //The arena the calling thread allocates TreeNodes from, or NULL for the heap.
+  static NodeArena * use(NodeArena *); //Makes the calling thread allocate TreeNodes from an arena (NULL for
+                                       //the heap) and returns the one it used before.
+
+ private:
+
+  int numaNode;
+  std::vector<char *> chunks;
+  std::vector<size_t> sizes; //The size of each chunk.
+  size_t chunk; //The chunk being allocated from.
+  char * next; //The next free byte in it.
+  char * end;
+
+  NodeArena(const NodeArena &); //Not copyable.
+  NodeArena & operator=(const NodeArena &);
+
+  void nextChunk(size_t);
+
+};
+
+#endif
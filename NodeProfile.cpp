@@ -0,0 +1,250 @@
+#include "NodeProfile.h"
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * Constructor that numbers the nodes of the tree t in prefix order, and
+ * works out the size and depth of each one.
+ * The sizes are worked out from the last node back, since a node's
+ * children come after it. Node i's right child comes after its left
+ * subtree, at i + 1 + the size of that.
+ */
+NodeProfile::NodeProfile(const ExprTree & t) {
+	ExprTree::materialiseAll(t.getRoot());
+	for (TreeNode * n : t.preorder())
+		nodes.push_back(n);
+	sizes.assign(nodes.size(), 1);
+	depths.assign(nodes.size(), 0);
+	for (int i = (int)nodes.size() - 1; i >= 0; i--) {
+		if (nodes[i]->getLeftChild() != NULL)
+			sizes[i] += sizes[i + 1];
+		if (nodes[i]->getRightChild() != NULL)
+			sizes[i] += sizes[rightOf(i)];
+	}
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (nodes[i]->getLeftChild() != NULL)
+			depths[i + 1] = depths[i] + 1;
+		if (nodes[i]->getRightChild() != NULL)
+			depths[rightOf(i)] = depths[i] + 1;
+	}
+	visits.assign(nodes.size(), 0);
+	cycles.assign(nodes.size(), 0);
+}
+
+/*
+ * Returns the position of the right child of the node at i.
+ */
+int NodeProfile::rightOf(int i) {
+	return i + 1 + (nodes[i]->getLeftChild() != NULL ? sizes[i + 1] : 0);
+}
+
+/*
+ * Reads the time stamp counter, or the time in nanoseconds on machines
+ * without one.
+ */
+uint64_t NodeProfile::now() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/*
+ * Evaluates the tree, with every variable 0, adding to the counts.
+ */
+int NodeProfile::evaluate() {
+	static const Bindings noVariables;
+	return evaluate(noVariables);
+}
+
+/*
+ * Evaluates the tree with the given variables, adding to the counts.
+ */
+int NodeProfile::evaluate(const Bindings & variables) {
+	if (nodes.empty())
+		return 0;
+	return evaluateAt(0, variables);
+}
+
+/*
+ * Evaluates the subtree at position i the way ExprTree::evaluate does,
+ * counting the visit and the cycles it takes.
+ * Operands that && , || and ?: don't need are never evaluated (evaluate
+ * sometimes evaluates small ones anyway, as that is faster than a branch,
+ * but it doesn't change the result), so their counts show how often they
+ * were really needed. The Alternative node under a ?: is counted with the
+ * branch that was taken.
+ */
+int NodeProfile::evaluateAt(int i, const Bindings & variables) {
+	uint64_t start = now();
+	const TreeNode * n = nodes[i];
+	int result;
+	switch (n->getOperator()) {
+	case Value:
+		result = n->getValue();
+		break;
+	case Variable: {
+		Bindings::const_iterator binding = variables.find(n->getName());
+		result = binding == variables.end() ? 0 : binding->second;
+		break;
+	}
+	case And:
+		result = evaluateAt(i + 1, variables) != 0 && evaluateAt(rightOf(i), variables) != 0;
+		break;
+	case Or:
+		result = evaluateAt(i + 1, variables) != 0 || evaluateAt(rightOf(i), variables) != 0;
+		break;
+	case Conditional: {
+		int condition = evaluateAt(i + 1, variables);
+		int branches = rightOf(i);
+		if (nodes[branches]->getOperator() != Alternative) {
+			result = condition ? evaluateAt(branches, variables) : 0;
+			break;
+		}
+		uint64_t branchStart = now();
+		result = condition ? evaluateAt(branches + 1, variables) : evaluateAt(rightOf(branches), variables);
+		visits[branches]++;
+		cycles[branches] += now() - branchStart;
+		break;
+	}
+	case Alternative:
+		result = evaluateAt(i + 1, variables);
+		break;
+	default: {
+		const OperatorInfo & info = OperatorRegistry::get(n->getOperator());
+		if (info.kernel == NULL)
+			result = 0;
+		else if (info.arity == 1)
+			result = info.kernel(evaluateAt(i + 1, variables), 0);
+		else {
+			int left = evaluateAt(i + 1, variables);
+			result = info.kernel(left, evaluateAt(rightOf(i), variables));
+		}
+		break;
+	}
+	}
+	visits[i]++;
+	cycles[i] += now() - start;
+	return result;
+}
+
+/*
+ * Sets every count back to 0.
+ */
+void NodeProfile::reset() {
+	visits.assign(nodes.size(), 0);
+	cycles.assign(nodes.size(), 0);
+}
+
+/*
+ * Returns the number of nodes in the tree.
+ */
+int NodeProfile::size() { return nodes.size(); }
+
+/*
+ * Returns the node at position i in prefix order.
+ */
+const TreeNode * NodeProfile::getNode(int i) { return nodes[i]; }
+
+/*
+ * Returns how many times the node at i was evaluated.
+ */
+uint64_t NodeProfile::getVisits(int i) { return visits[i]; }
+
+/*
+ * Returns the cycles spent evaluating the subtree at i.
+ */
+uint64_t NodeProfile::getCycles(int i) { return cycles[i]; }
+
+/*
+ * Returns the cycles spent in the node at i itself: its cycles less its
+ * children's.
+ */
+uint64_t NodeProfile::getSelfCycles(int i) {
+	uint64_t children = 0;
+	if (nodes[i]->getLeftChild() != NULL)
+		children += cycles[i + 1];
+	if (nodes[i]->getRightChild() != NULL)
+		children += cycles[rightOf(i)];
+	return cycles[i] > children ? cycles[i] - children : 0;
+}
+
+/*
+ * Returns the cycles of the subtree at i as a percentage of the whole
+ * tree's, e.g. "37.5%".
+ */
+string NodeProfile::share(int i) {
+	std::stringstream out;
+	out << std::fixed << std::setprecision(1) << (cycles[0] == 0 ? 0.0 : 100.0 * cycles[i] / cycles[0]) << "%";
+	return out.str();
+}
+
+/*
+ * Returns the nodes in prefix order, one to a line, indented by their
+ * depth, with their visits, cycles, self cycles and share of the cycles.
+ * Nodes whose subtree has at least the given share (a fraction) of the
+ * cycles start with a *, so the hot path stands out.
+ */
+string NodeProfile::annotatedPrefix(double threshold) {
+	std::stringstream out;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		bool hot = cycles[0] != 0 && cycles[i] >= threshold * cycles[0];
+		out << (hot ? "* " : "  ") << string(2 * depths[i], ' ') << nodes[i]->toString()
+			<< "  [visits " << visits[i] << ", cycles " << cycles[i] << ", self " << getSelfCycles(i)
+			<< ", " << share(i) << "]\n";
+	}
+	return out.str();
+}
+
+/*
+ * Returns the infix form of the tree (as infixOrder writes it), with every
+ * subtree that has at least the given share (a fraction) of the cycles in
+ * [ ], followed by its share, e.g. "[[x * y]=60.0% + 1]=100.0%".
+ */
+string NodeProfile::annotatedInfix(double threshold) {
+	string out;
+	if (!nodes.empty())
+		appendAnnotated(0, threshold, out);
+	return out;
+}
+
+/*
+ * Writes the subtree at i onto the back of out for annotatedInfix.
+ */
+void NodeProfile::appendAnnotated(int i, double threshold, string & out) {
+	const TreeNode * n = nodes[i];
+	bool hot = cycles[0] != 0 && cycles[i] >= threshold * cycles[0] && n->isOperator();
+	if (hot)
+		out += '[';
+	if (n->isValue() || n->isVariable())
+		out += n->toString();
+	else if (n->getOperator() == Negate) {
+		out += '-';
+		appendAnnotated(i + 1, threshold, out);
+	}
+	else if (n->isFunction()) {
+		out += n->toString();
+		out += '(';
+		appendAnnotated(i + 1, threshold, out);
+		if (!n->isUnary()) {
+			out += ", ";
+			appendAnnotated(rightOf(i), threshold, out);
+		}
+		out += ')';
+	}
+	else {
+		appendAnnotated(i + 1, threshold, out);
+		out += ' ';
+		out += n->toString();
+		out += ' ';
+		appendAnnotated(rightOf(i), threshold, out);
+	}
+	if (hot)
+		out += "]=" + share(i);
+}
@@ -0,0 +1,60 @@
+#ifndef NODEPROFILE_H
+#define NODEPROFILE_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+#include "ExprTree.h"
+
+/*
+ * A profile of where the time goes when a tree is evaluated, node by node.
+ *
+ * It has its own evaluator, which gives the same results as
+ * ExprTree::evaluate but also counts how many times each node is evaluated
+ * and the cycles (from the CPU's time stamp counter, or nanoseconds where
+ * there isn't one) spent in it and its subtree. ExprTree::evaluate isn't
+ * changed, so it costs nothing when nothing is being profiled.
+ * The counts are kept in arrays beside the tree, one entry for each node in
+ * prefix order, so node i's left child is node i + 1. Reading the counter
+ * takes a few cycles itself, so small subtrees look a bit slower than they
+ * are.
+ * The profile refers to the tree's nodes, so the tree must outlive it and
+ * not be changed while it exists. Deferred nodes are parsed when it is
+ * made.
+ */
+class NodeProfile{
+
+ public:
+
+  NodeProfile(const ExprTree &);
+  int evaluate(); //Evaluates the tree, adding to the counts.
+  int evaluate(const Bindings &);
+  void reset(); //Sets every count back to 0.
+  int size(); //The number of nodes.
+  const TreeNode * getNode(int); //The node at a position in prefix order.
+  uint64_t getVisits(int); //How many times a node was evaluated.
+  uint64_t getCycles(int); //The cycles spent in a node and its subtree.
+  uint64_t getSelfCycles(int); //The cycles spent in a node, not counting its children.
+  string annotatedPrefix(double = 0.1); //Each node on its own line, with its counts. Subtrees with at least
+                                        //the given share of the cycles are marked with a *.
+  string annotatedInfix(double = 0.1); //The infix form, with each subtree that has at least the given share
+                                       //of the cycles in [ ], followed by its share.
+  static uint64_t now(); //Reads the cycle counter.
+
+ private:
+
+  vector<const TreeNode *> nodes; //The nodes in prefix order.
+  vector<int> sizes; //The size of the subtree at each node.
+  vector<int> depths; //How far each node is from the root.
+  vector<uint64_t> visits;
+  vector<uint64_t> cycles;
+
+  int evaluateAt(int, const Bindings &);
+  int rightOf(int); //The position of a node's right child.
+  string share(int); //A node's cycles as a percentage of the whole tree's.
+  void appendAnnotated(int, double, string &);
+
+};
+
+#endif
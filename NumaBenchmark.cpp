@@ -0,0 +1,112 @@
+#include "BatchEvaluator.h"
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+using namespace std;
+
+/*
+ * Benchmark of evaluating trees from local and from remote memory.
+ *
+ * The trees are built by the workers of the first NUMA node, so they are in
+ * that node's memory. They are then evaluated by the first node's workers
+ * (local) and by the last node's workers (remote), and the throughput of
+ * each is printed, along with that of BatchEvaluator::evaluate, which
+ * parses and evaluates on the same node.
+ * On a machine with one node, local and remote are the same thing.
+ *
+ * Usage: NumaBenchmark [expressions] [terms per expression] [rounds]
+ */
+
+/*
+ * Returns a random expression with about terms numbers and variables in it.
+ */
+string randomExpression(int terms) {
+	static const char * symbols[] = {"+", "-", "*", "%", "<", "&&", "||"};
+	stringstream out;
+	out << "(x + " << rand() % 100 + 1 << ")";
+	for (int i = 1; i < terms; i++) {
+		out << ' ' << symbols[rand() % 7] << ' ';
+		if (rand() % 4 == 0)
+			out << "max(y, " << rand() % 100 << ")";
+		else if (rand() % 3 == 0)
+			out << "x";
+		else
+			out << rand() % 100 + 1;
+	}
+	return out.str();
+}
+
+std::atomic<long> sink(0); //Keeps the sums of evaluateOn, so the evaluations can't be optimised away.
+
+/*
+ * Evaluates every tree rounds times on the workers of node n, and returns
+ * how many nodes were visited per second.
+ */
+double evaluateOn(BatchEvaluator & batch, int n, vector<TreeNode *> & roots, long nodes, int rounds,
+                  const Bindings & variables) {
+	int workers = batch.workerCount(n);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	batch.run(n, [&](int, int w) {
+		long sum = 0;
+		for (int r = 0; r < rounds; r++)
+			for (size_t i = w; i < roots.size(); i += workers)
+				sum += ExprTree::evaluate(roots[i], variables);
+		sink += sum;
+	});
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	return nodes * rounds / seconds;
+}
+
+int main(int argc, char ** argv) {
+	int count = argc > 1 ? atoi(argv[1]) : 20000;
+	int terms = argc > 2 ? atoi(argv[2]) : 200;
+	int rounds = argc > 3 ? atoi(argv[3]) : 20;
+
+	BatchEvaluator batch;
+	cout << "NUMA nodes:";
+	for (int n = 0; n < batch.nodeCount(); n++)
+		cout << ' ' << batch.getNumaNode(n) << " (" << batch.workerCount(n) << " workers)";
+	cout << endl;
+
+	srand(1);
+	vector<string> expressions;
+	for (int i = 0; i < count; i++)
+		expressions.push_back(randomExpression(terms));
+	Bindings variables;
+	variables["x"] = 3;
+	variables["y"] = 7;
+
+	vector<TreeNode *> roots(count);
+	batch.run(0, [&](int, int w) {
+		for (size_t i = w; i < roots.size(); i += batch.workerCount(0))
+			roots[i] = ExprTree::buildTree(ExprTree::tokenise(expressions[i])).release();
+	});
+	long nodes = 0;
+	for (size_t i = 0; i < roots.size(); i++) {
+		ExprTree t(roots[i]);
+		nodes += t.size();
+		t.release();
+	}
+
+	int last = batch.nodeCount() - 1;
+	double local = evaluateOn(batch, 0, roots, nodes, rounds, variables);
+	double remote = evaluateOn(batch, last, roots, nodes, rounds, variables);
+	cout << "local:  " << local / 1e6 << " M nodes/s on node " << batch.getNumaNode(0) << endl;
+	cout << "remote: " << remote / 1e6 << " M nodes/s on node " << batch.getNumaNode(last);
+	if (last == 0)
+		cout << " (only one node, so this is local too)";
+	cout << endl;
+
+	for (size_t i = 0; i < roots.size(); i++)
+		ExprTree t(roots[i]);
+	batch.run(0, [](int, int) { NodeArena::current()->reset(); });
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (int r = 0; r < rounds; r++)
+		batch.evaluate(expressions, variables);
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cout << "parse and evaluate on the same node: " << count * rounds / seconds / 1e6 << " M expressions/s" << endl;
+	return 0;
+}
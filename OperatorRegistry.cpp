@@ -0,0 +1,183 @@
+#include "OperatorRegistry.h"
+
+/*
+ * The kernels of the built in operators.
+ */
+int add(int a, int b) { return a + b; }
+int subtract(int a, int b) { return a - b; }
+int multiply(int a, int b) { return a * b; }
+int divide(int a, int b) { return a / b; }
+int modulo(int a, int b) { return a % b; }
+int minimum(int a, int b) { return a < b ? a : b; }
+int maximum(int a, int b) { return a > b ? a : b; }
+int absolute(int a, int) { return a < 0 ? -a : a; }
+int negate(int a, int) { return -a; }
+int less(int a, int b) { return a < b; }
+int lessEqual(int a, int b) { return a <= b; }
+int greater(int a, int b) { return a > b; }
+int greaterEqual(int a, int b) { return a >= b; }
+int equal(int a, int b) { return a == b; }
+int notEqual(int a, int b) { return a != b; }
+
+/*
+ * Raises base to the power of exp using exponentiation by squaring,
+ * so it takes O(log exp) multiplications instead of the exp - 1 that
+ * a chain of Times nodes would need.
+ * Negative exponents follow integer division: the result truncates
+ * to 0 unless the base is 1 or -1.
+ */
+int power(int base, int exp) {
+	if (exp < 0) {
+		if (base == 1)
+			return 1;
+		if (base == -1)
+			return (exp % 2 == 0) ? 1 : -1;
+		return 0;
+	}
+
+	int result = 1;
+	while (exp > 0) {
+		if (exp & 1)
+			result *= base;
+		exp >>= 1;
+		if (exp > 0)
+			base *= base;
+	}
+	return result;
+}
+
+/*
+ * Sets up the built in operators. The precedence levels are:
+ *	1  ?:  (right associative)
+ *	2  ||
+ *	3  &&
+ *	4  ==  !=
+ *	5  <  <=  >  >=
+ *	6  +  -
+ *	7  *  /  %
+ *	8  neg (unary minus)
+ *	9  ^   (right associative)
+ *	10 min, max, abs
+ * Entries that are not in use have no symbol and no kernel, like NoOp.
+ */
+OperatorRegistry::OperatorRegistry() {
+	for (int i = 0; i < capacity; i++)
+		add(Operator(i), "", 10, false, 2, Infix, NULL);
+
+	add(Value, "val", 10, false, 0, Infix, NULL);
+	add(Variable, "", 10, false, 0, Infix, NULL);
+	add(Deferred, "", 10, false, 0, Infix, NULL);
+	add(Conditional, "?", 1, true, 2, Infix, NULL);
+	add(Alternative, ":", 1, true, 2, Infix, NULL);
+	add(Or, "||", 2, false, 2, Infix, NULL);
+	add(And, "&&", 3, false, 2, Infix, NULL);
+	add(Equal, "==", 4, false, 2, Infix, equal);
+	add(NotEqual, "!=", 4, false, 2, Infix, notEqual);
+	add(Less, "<", 5, false, 2, Infix, less);
+	add(LessEqual, "<=", 5, false, 2, Infix, lessEqual);
+	add(Greater, ">", 5, false, 2, Infix, greater);
+	add(GreaterEqual, ">=", 5, false, 2, Infix, greaterEqual);
+	add(Plus, "+", 6, false, 2, Infix, ::add);
+	add(Minus, "-", 6, false, 2, Infix, subtract);
+	add(Times, "*", 7, false, 2, Infix, multiply);
+	add(Divide, "/", 7, false, 2, Infix, divide);
+	add(Modulo, "%", 7, false, 2, Infix, modulo);
+	add(Negate, "neg", 8, true, 1, Prefix, negate);
+	add(Power, "^", 9, true, 2, Infix, power);
+	add(Min, "min", 10, false, 2, Function, minimum);
+	add(Max, "max", 10, false, 2, Function, maximum);
+	add(Abs, "abs", 10, false, 1, Function, absolute);
+
+	next = NoOp + 1;
+}
+
+/*
+ * Returns the one registry, setting it up the first time.
+ */
+OperatorRegistry & OperatorRegistry::instance() {
+	static OperatorRegistry registry;
+	return registry;
+}
+
+/*
+ * Fills in the table entry of an operator and, if it has a symbol, adds it
+ * to the list for the first char of the symbol, keeping longer symbols first
+ * so "<=" is matched before "<".
+ */
+void OperatorRegistry::add(Operator op, const std::string & symbol, int precedence,
+	bool rightAssociative, int arity, Notation notation, Kernel kernel) {
+	OperatorInfo & info = table[op];
+	info.symbol = symbol;
+	info.precedence = precedence;
+	info.rightAssociative = rightAssociative;
+	info.arity = arity;
+	info.notation = notation;
+	info.kernel = kernel;
+
+	if (symbol.empty() || op == Value)
+		return;
+	std::vector<Operator> & bucket = bySymbolStart[(unsigned char)symbol[0]];
+	std::vector<Operator>::iterator i = bucket.begin();
+	while (i != bucket.end() && table[*i].symbol.size() >= symbol.size())
+		++i;
+	bucket.insert(i, op);
+}
+
+/*
+ * Returns the details of an operator.
+ */
+const OperatorInfo & OperatorRegistry::get(Operator op) {
+	return instance().table[(unsigned char)op];
+}
+
+/*
+ * Returns the operator with the given symbol, or NoOp if there isn't one.
+ */
+Operator OperatorRegistry::lookup(const std::string & symbol) {
+	if (symbol.empty())
+		return NoOp;
+	OperatorRegistry & registry = instance();
+	const std::vector<Operator> & bucket = registry.bySymbolStart[(unsigned char)symbol[0]];
+	for (std::vector<Operator>::const_iterator i = bucket.begin(); i != bucket.end(); ++i)
+		if (registry.table[*i].symbol == symbol)
+			return *i;
+	return NoOp;
+}
+
+/*
+ * Returns the length of the longest operator symbol that the string has at
+ * position pos. If no symbol matches, it returns 1 so the char becomes a
+ * token on its own (e.g. a parenthesis).
+ */
+std::string::size_type OperatorRegistry::matchSymbol(const std::string & s, std::string::size_type pos) {
+	OperatorRegistry & registry = instance();
+	const std::vector<Operator> & bucket = registry.bySymbolStart[(unsigned char)s[pos]];
+	for (std::vector<Operator>::const_iterator i = bucket.begin(); i != bucket.end(); ++i) {
+		const std::string & symbol = registry.table[*i].symbol;
+		if (s.compare(pos, symbol.size(), symbol) == 0)
+			return symbol.size();
+	}
+	return 1;
+}
+
+/*
+ * Adds a binary infix operator. The symbol can be a word (e.g. "xor") or
+ * made of other chars (e.g. "<<"), but not contain spaces, digits at the
+ * start, parentheses or commas.
+ * Returns the Operator value of the new operator, or NoOp if the symbol
+ * is not allowed or taken, or the table is full.
+ */
+Operator OperatorRegistry::registerOperator(const std::string & symbol, int precedence,
+	bool rightAssociative, Kernel kernel) {
+	OperatorRegistry & registry = instance();
+	if (symbol.empty() || (symbol[0] >= '0' && symbol[0] <= '9') || kernel == NULL)
+		return NoOp;
+	if (symbol.find_first_of(" (),") != std::string::npos)
+		return NoOp;
+	if (lookup(symbol) != NoOp || registry.next >= capacity)
+		return NoOp;
+
+	Operator op = Operator(registry.next++);
+	registry.add(op, symbol, precedence, rightAssociative, 2, Infix, kernel);
+	return op;
+}
@@ -0,0 +1,72 @@
+#ifndef OPERATORREGISTRY_H
+#define OPERATORREGISTRY_H
+
+#include <string>
+#include <vector>
+
+#include "TreeNode.h"
+
+/*
+ * The function that does the maths for an operator. Unary operators
+ * get their operand as the first argument and 0 as the second.
+ */
+typedef int (*Kernel)(int, int);
+
+/*
+ * How an operator is written in infix notation:
+ * Infix between its operands (1 + 2), Function with a call (max(1, 2))
+ * or Prefix in front of its single operand (neg, written as -x).
+ */
+enum Notation {Infix, Function, Prefix};
+
+/*
+ * Everything the tokeniser, parser, evaluator and serialisers need to
+ * know about an operator.
+ */
+struct OperatorInfo {
+  std::string symbol; //How the operator is written in tokens and printed, e.g. "+", "<=", "max".
+  int precedence; //Higher goes first. See the table in OperatorRegistry.cpp for the built in levels.
+  bool rightAssociative; //True if a op b op c means a op (b op c).
+  int arity; //The number of operands, 1 or 2.
+  Notation notation; //How the operator is written in infix notation.
+  Kernel kernel; //Does the maths. NULL for &&, || and ?:, which evaluate handles
+                 //itself because it doesn't always evaluate all of their operands.
+};
+
+/*
+ * The table of all operators, indexed by the Operator value (which fits in a byte),
+ * so every lookup by operator is a single array access. Lookups by symbol only
+ * compare against the few symbols that start with the same char.
+ *
+ * Custom binary operators can be added with registerOperator(...) and are then
+ * tokenised, parsed, evaluated and printed like the built in ones. Register them
+ * before parsing any expression that uses them; the registry is not locked.
+ */
+class OperatorRegistry{
+
+ private:
+
+  static const int capacity = 256;
+
+  OperatorInfo table[capacity]; //The operators, by Operator value.
+  std::vector<Operator> bySymbolStart[capacity]; //The operators, by the first char of their
+                                                 //symbol, longest symbol first.
+  int next; //The Operator value the next custom operator gets.
+
+  OperatorRegistry();
+  static OperatorRegistry & instance();
+  void add(Operator, const std::string &, int, bool, int, Notation, Kernel);
+
+ public:
+
+  static const OperatorInfo & get(Operator); //Returns the details of an operator.
+  static Operator lookup(const std::string &); //Returns the operator with the given symbol, or NoOp.
+  static std::string::size_type matchSymbol(const std::string &, std::string::size_type);
+          //Returns the length of the longest operator symbol at the given position in the string (at least 1).
+  static Operator registerOperator(const std::string &, int, bool, Kernel);
+          //Adds a binary infix operator with the given symbol, precedence, associativity and kernel.
+          //Returns its Operator value, or NoOp if the symbol is taken or the table is full.
+
+};
+
+#endif
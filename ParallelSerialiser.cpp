@@ -0,0 +1,337 @@
+#include "ParallelSerialiser.h"
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+
+/*
+ * Add a piece to the end of a Layout.
+ */
+void ParallelSerialiser::Layout::add(const char * text) {
+	Piece p = {text, strlen(text), NULL};
+	pieces[count++] = p;
+}
+
+void ParallelSerialiser::Layout::add(const string & text) {
+	Piece p = {text.data(), text.size(), NULL};
+	pieces[count++] = p;
+}
+
+void ParallelSerialiser::Layout::add(TreeNode * operand) {
+	Piece p = {NULL, 0, operand};
+	pieces[count++] = p;
+}
+
+/*
+ * Fills in how the operator node n is written in the given order. This is
+ * the only place the text of the orders is made, so measuring a task and
+ * writing it can't disagree. It follows appendPrefix, appendInfix,
+ * appendParsableInfix and appendPostfix in ExprTree.cpp. The symbols are
+ * the ones kept in the OperatorRegistry.
+ */
+void ParallelSerialiser::describe(TreeNode * n, Order order, Layout & l) {
+	TreeNode * left = n->getLeftChild();
+	TreeNode * right = n->isUnary() ? NULL : n->getRightChild();
+	const string & symbol = OperatorRegistry::get(n->getOperator()).symbol;
+	ExprTree::materialise(left);
+	ExprTree::materialise(right);
+	l.count = 0;
+
+	switch (order) {
+	case PrefixOrder:
+		l.add(symbol);
+		l.add(" ");
+		l.add(left);
+		if (right != NULL) {
+			l.add(" ");
+			l.add(right);
+		}
+		break;
+	case InfixOrder:
+		if (n->getOperator() == Negate) {
+			bool parenthesise = left->isOperator() && !left->isFunction() && !left->isUnary();
+			l.add(parenthesise ? "-(" : "-");
+			l.add(left);
+			if (parenthesise)
+				l.add(")");
+		} else if (n->isFunction()) {
+			l.add(symbol);
+			l.add("(");
+			l.add(left);
+			if (right != NULL) {
+				l.add(", ");
+				l.add(right);
+			}
+			l.add(")");
+		} else {
+			l.add(left);
+			l.add(" ");
+			l.add(symbol);
+			l.add(" ");
+			l.add(right);
+		}
+		break;
+	case ParsableInfixOrder: {
+		if (n->isFunction()) {
+			describe(n, InfixOrder, l);
+			break;
+		}
+		if (n->getOperator() == Negate)
+			l.add("-");
+		bool parenthesise = ExprTree::needsParentheses(n, left);
+		l.add(parenthesise ? "(" : "");
+		l.add(left);
+		l.add(parenthesise ? ")" : "");
+		if (n->getOperator() == Negate)
+			break;
+		l.add(" ");
+		l.add(symbol);
+		l.add(" ");
+		parenthesise = ExprTree::needsParentheses(n, right);
+		l.add(parenthesise ? "(" : "");
+		l.add(right);
+		l.add(parenthesise ? ")" : "");
+		break;
+	}
+	case PostfixOrder:
+		l.add(left);
+		l.add(" ");
+		if (right != NULL) {
+			l.add(right);
+			l.add(" ");
+		}
+		l.add(symbol);
+		break;
+	}
+}
+
+/*
+ * Writes the number or variable n at out, unless out is NULL, and returns
+ * how many chars it takes. Numbers are written through a buffer on the
+ * stack rather than a string.
+ */
+size_t ParallelSerialiser::leaf(TreeNode * n, char * out) {
+	if (n->isVariable()) {
+		if (out != NULL)
+			std::copy(n->getName().begin(), n->getName().end(), out);
+		return n->getName().size();
+	}
+	char digits[12];
+	char * end = digits + sizeof(digits);
+	char * first = end;
+	unsigned magnitude = n->getValue() < 0 ? 0u - (unsigned)n->getValue() : (unsigned)n->getValue();
+	do {
+		*--first = '0' + magnitude % 10;
+		magnitude /= 10;
+	} while (magnitude != 0);
+	if (n->getValue() < 0)
+		*--first = '-';
+	if (out != NULL)
+		std::copy(first, end, out);
+	return end - first;
+}
+
+/*
+ * Cuts the tree at root into tasks of at least target nodes (and at most
+ * about twice that), in postorder, so the tasks cut out of a task come
+ * before it and the root's task is last.
+ *
+ * Algorithm:
+ * Walk the tree in postorder with a stack of frames, so a long chain of
+ * nodes can't overflow the stack. Each frame counts the nodes under it that
+ * aren't in a task yet. When a node's count reaches target (or it is the
+ * root), it becomes the root of a task, whose holes are the tasks cut since
+ * its frame was pushed, and it counts as no nodes to its parent.
+ * So the shape of the tree doesn't matter: a left-deep chain is cut into
+ * pieces of target nodes, each one a hole in the piece above it.
+ * Deferred nodes are materialised on the way, so the threads only read the
+ * tree.
+ */
+void ParallelSerialiser::cut(TreeNode * root, size_t target, vector<Task> & tasks) {
+	struct Frame{
+		TreeNode * node;
+		int visited; //How many of its children have been pushed.
+		size_t count;
+		size_t firstHole; //The size of open when it was pushed.
+	};
+	vector<size_t> open; //Tasks that aren't a hole of another task yet, from left to right.
+	vector<Frame> frames;
+	ExprTree::materialise(root);
+	Frame first = {root, 0, 1, 0};
+	frames.push_back(first);
+
+	while (!frames.empty()) {
+		Frame & top = frames.back();
+		TreeNode * child = NULL;
+		if (top.node->isOperator() && top.visited == 0)
+			child = top.node->getLeftChild();
+		else if (top.node->isOperator() && top.visited == 1 && !top.node->isUnary())
+			child = top.node->getRightChild();
+		if (child != NULL) {
+			top.visited++;
+			ExprTree::materialise(child);
+			Frame next = {child, 0, 1, open.size()};
+			frames.push_back(next);
+			continue;
+		}
+
+		Frame done = top;
+		frames.pop_back();
+		if (done.count < target && !frames.empty()) {
+			frames.back().count += done.count;
+			continue;
+		}
+		Task task;
+		task.root = done.node;
+		task.holes.assign(open.begin() + done.firstHole, open.end());
+		open.resize(done.firstHole);
+		open.push_back(tasks.size());
+		tasks.push_back(task);
+	}
+}
+
+/*
+ * Measures (if out is NULL) or writes at out the chars of task t itself,
+ * and returns how many there are.
+ * It keeps a stack of the pieces still to go rather than recursing, so a
+ * long chain of nodes can't overflow the stack. Operands always come left
+ * before right, so the holes are reached in the order they are listed.
+ * When measuring, the number of chars before each hole is noted, and when
+ * writing, the gap the hole's task fills is stepped over.
+ */
+size_t ParallelSerialiser::walk(vector<Task> & tasks, size_t t, Order order, char * out) {
+	Task & task = tasks[t];
+	size_t length = 0;
+	size_t hole = 0;
+	Layout l;
+	vector<Piece> pending;
+	Piece whole = {NULL, 0, task.root};
+	pending.push_back(whole);
+	if (out == NULL)
+		task.before.clear();
+
+	while (!pending.empty()) {
+		Piece p = pending.back();
+		pending.pop_back();
+		if (p.operand == NULL) {
+			if (out != NULL)
+				out = std::copy(p.text, p.text + p.length, out);
+			length += p.length;
+			continue;
+		}
+
+		TreeNode * n = p.operand;
+		if (hole < task.holes.size() && n == tasks[task.holes[hole]].root) {
+			if (out == NULL)
+				task.before.push_back(length);
+			else
+				out += tasks[task.holes[hole]].length;
+			hole++;
+			continue;
+		}
+		ExprTree::materialise(n);
+		if (n->isValue() || n->isVariable()) {
+			size_t chars = leaf(n, out);
+			if (out != NULL)
+				out += chars;
+			length += chars;
+		} else if (n->isOperator()) {
+			describe(n, order, l);
+			for (int i = l.count - 1; i >= 0; i--)
+				pending.push_back(l.pieces[i]);
+		}
+	}
+	return length;
+}
+
+/*
+ * Given an ExprTree t, this function returns it written in the given order,
+ * using up to the given number of threads.
+ *
+ * Algorithm:
+ * Cut the tree into tasks (see cut), enough for every thread to get several.
+ * A small tree, or one thread, gets one task for the whole tree.
+ * Pass 1: the threads take tasks one at a time and measure them.
+ * Then the calling thread works out the length of each task's whole
+ * subtree, from the first task up, and the offset of each task, from the
+ * root's task down: a hole starts after the chars its task writes before
+ * it and the holes to its left.
+ * Pass 2: the threads take tasks again and write each one at its offset.
+ * No two tasks overlap, so the threads never write the same chars.
+ */
+string ParallelSerialiser::write(const ExprTree & t, Order order, unsigned threads) {
+	TreeNode * root = t.getRoot();
+	if (root == NULL)
+		return "";
+	if (threads == 0)
+		threads = std::thread::hardware_concurrency();
+	vector<Task> tasks;
+	if (threads <= 1 || t.size() < sequentialSize) {
+		tasks.resize(1);
+		tasks[0].root = root;
+	} else
+		cut(root, std::max<size_t>(t.size() / (threads * tasksPerThread), 1), tasks);
+
+	string out;
+	for (int pass = 0; pass < 2; pass++) {
+		if (pass == 1) {
+			for (size_t i = 0; i < tasks.size(); i++) {
+				tasks[i].length = tasks[i].ownLength;
+				for (size_t h = 0; h < tasks[i].holes.size(); h++)
+					tasks[i].length += tasks[tasks[i].holes[h]].length;
+			}
+			tasks.back().offset = 0;
+			for (size_t i = tasks.size(); i-- > 0;) {
+				size_t holes = 0;
+				for (size_t h = 0; h < tasks[i].holes.size(); h++) {
+					Task & hole = tasks[tasks[i].holes[h]];
+					hole.offset = tasks[i].offset + tasks[i].before[h] + holes;
+					holes += hole.length;
+				}
+			}
+			out.resize(tasks.back().length);
+		}
+
+		std::atomic<size_t> next(0);
+		std::function<void()> work = [&, pass]() {
+			for (size_t task = next++; task < tasks.size(); task = next++) {
+				if (pass == 0)
+					tasks[task].ownLength = walk(tasks, task, order, NULL);
+				else
+					walk(tasks, task, order, &out[0] + tasks[task].offset);
+			}
+		};
+		if (tasks.size() == 1) {
+			work();
+			continue;
+		}
+		vector<std::thread> workers;
+		for (unsigned i = 0; i < threads && i < tasks.size(); i++)
+			workers.push_back(std::thread(work));
+		for (vector<std::thread>::iterator w = workers.begin(); w != workers.end(); ++w)
+			w->join();
+	}
+	return out;
+}
+
+/*
+ * Given an ExprTree t, these functions return the same strings as
+ * ExprTree::prefixOrder, infixOrder, parsableInfixOrder and postfixOrder, written by the given
+ * number of threads (0 for one per core).
+ */
+string ParallelSerialiser::prefixOrder(const ExprTree & t, unsigned threads) {
+	return write(t, PrefixOrder, threads);
+}
+
+string ParallelSerialiser::infixOrder(const ExprTree & t, unsigned threads) {
+	return write(t, InfixOrder, threads);
+}
+
+string ParallelSerialiser::parsableInfixOrder(const ExprTree & t, unsigned threads) {
+	return write(t, ParsableInfixOrder, threads);
+}
+
+string ParallelSerialiser::postfixOrder(const ExprTree & t, unsigned threads) {
+	return write(t, PostfixOrder, threads);
+}
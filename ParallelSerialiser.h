@@ -0,0 +1,84 @@
+#ifndef PARALLELSERIALISER_H
+#define PARALLELSERIALISER_H
+
+#include <string>
+#include <vector>
+
+#include "ExprTree.h"
+
+/*
+ * Writes the prefix, infix and postfix notations of big trees using several
+ * threads. The output is the same, byte for byte, as ExprTree::prefixOrder,
+ * infixOrder, parsableInfixOrder and postfixOrder.
+ *
+ * The tree is cut into many tasks of about the same number of nodes, each
+ * a subtree less the subtrees of the tasks below it. The threads first work
+ * out how many chars each task takes, which gives every task a fixed offset
+ * in the output, and then write the tasks straight into their own parts of
+ * one shared string.
+ */
+class ParallelSerialiser{
+
+ private:
+
+  enum Order {PrefixOrder, InfixOrder, ParsableInfixOrder, PostfixOrder};
+
+  static const int sequentialSize = 4096; //Trees with fewer nodes than this are written by one thread.
+  static const unsigned tasksPerThread = 8; //How many tasks to cut the tree into for each thread.
+
+  /*
+   * A piece of the text of an operator node in one of the orders: fixed
+   * text (its symbol, or spaces, parentheses and commas, which are never
+   * copied into a string of their own), or the place of one of its operands.
+   */
+  struct Piece{
+    const char * text;
+    size_t length;
+    TreeNode * operand; //If not NULL, the piece is the text of this operand.
+  };
+
+  /*
+   * How an operator node is written: its pieces, in order.
+   */
+  struct Layout{
+    Piece pieces[9];
+    int count;
+    void add(const char *); //Adds fixed text, which must outlive the Layout.
+    void add(const string &);
+    void add(TreeNode *); //Adds the place of an operand.
+  };
+
+  /*
+   * Part of the tree that one thread writes: the subtree at root, less the
+   * subtrees of the tasks in holes, which are left as gaps for those tasks
+   * to fill.
+   */
+  struct Task{
+    TreeNode * root;
+    vector<size_t> holes; //The tasks cut out of this one, from left to right.
+    vector<size_t> before; //How many of this task's own chars come before each hole.
+    size_t ownLength; //How many chars this task writes.
+    size_t length; //How many chars the whole subtree at root takes.
+    size_t offset; //Where the subtree at root starts in the output.
+  };
+
+  static void describe(TreeNode *, Order, Layout &);
+  static size_t leaf(TreeNode *, char *);
+  static void cut(TreeNode *, size_t, vector<Task> &);
+  static size_t walk(vector<Task> &, size_t, Order, char *);
+  static string write(const ExprTree &, Order, unsigned);
+
+ public:
+
+  /*
+   * The number of threads to use can be given, and 0 means one for every
+   * core. Small trees are written by the calling thread.
+   */
+  static string prefixOrder(const ExprTree &, unsigned = 0);
+  static string infixOrder(const ExprTree &, unsigned = 0);
+  static string parsableInfixOrder(const ExprTree &, unsigned = 0);
+  static string postfixOrder(const ExprTree &, unsigned = 0);
+
+};
+
+#endif
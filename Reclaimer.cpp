@@ -0,0 +1,128 @@
+#include "Reclaimer.h"
+
+/*
+ * Constructor that sets up an empty queue, which holds at most queueLimit
+ * trees, and starts the background thread, which frees batchSize nodes at a
+ * time.
+ */
+Reclaimer::Reclaimer(int queueLimit, int batchSize) {
+	this->queueLimit = queueLimit < 1 ? 1 : queueLimit;
+	this->batchSize = batchSize < 1 ? 1 : batchSize;
+	stopping = false;
+	busy = false;
+	stats.treesQueued = 0;
+	stats.treesFreed = 0;
+	stats.nodesFreed = 0;
+	stats.batches = 0;
+	stats.stalls = 0;
+	stats.maxQueueDepth = 0;
+	worker = std::thread(&Reclaimer::run, this);
+}
+
+/*
+ * Destructor that lets the background thread free whatever is still
+ * queued, then waits for it to stop.
+ */
+Reclaimer::~Reclaimer() {
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		stopping = true;
+	}
+	work.notify_one();
+	worker.join();
+}
+
+/*
+ * Adds the tree with the given root to the queue. If the queue is full,
+ * this waits until the background thread has taken trees off it.
+ */
+void Reclaimer::reclaim(TreeNode * root) {
+	if (root == NULL)
+		return;
+	std::unique_lock<std::mutex> guard(lock);
+	if ((int)queue.size() >= queueLimit) {
+		stats.stalls++;
+		room.wait(guard, [this]() { return (int)queue.size() < queueLimit; });
+	}
+	queue.push_back(root);
+	stats.treesQueued++;
+	if ((int)queue.size() > stats.maxQueueDepth)
+		stats.maxQueueDepth = queue.size();
+	guard.unlock();
+	work.notify_one();
+}
+
+/*
+ * Waits until the queue is empty and the background thread has freed the
+ * trees it took off it.
+ */
+void Reclaimer::drain() {
+	std::unique_lock<std::mutex> guard(lock);
+	room.wait(guard, [this]() { return queue.empty() && !busy; });
+}
+
+/*
+ * Returns a copy of the counts so far.
+ */
+Reclaimer::Stats Reclaimer::getStats() {
+	std::unique_lock<std::mutex> guard(lock);
+	return stats;
+}
+
+/*
+ * The background thread.
+ *
+ * Algorithm:
+ * Wait for trees to be queued, then take all of them off the queue at once.
+ * Free their nodes with a stack of nodes still to free (so long chains
+ * don't use up the thread's stack). After every batchSize nodes, add them
+ * to the stats and yield, so the thread doesn't hog a core (or the
+ * allocator) while it frees a huge tree.
+ * Stop when asked to and the queue is empty.
+ */
+void Reclaimer::run() {
+	std::vector<TreeNode *> pending;
+	while (true) {
+		std::deque<TreeNode *> taken;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			work.wait(guard, [this]() { return stopping || !queue.empty(); });
+			if (queue.empty())
+				return;
+			taken.swap(queue);
+			busy = true;
+		}
+		room.notify_all();
+
+		for (std::deque<TreeNode *>::iterator root = taken.begin(); root != taken.end(); ++root) {
+			pending.push_back(*root);
+			long freed = 0;
+			while (!pending.empty()) {
+				TreeNode * n = pending.back();
+				pending.pop_back();
+				if (n->getLeftChild() != NULL)
+					pending.push_back(n->getLeftChild());
+				if (n->getRightChild() != NULL)
+					pending.push_back(n->getRightChild());
+				delete n;
+
+				if (++freed == batchSize || pending.empty()) {
+					std::unique_lock<std::mutex> guard(lock);
+					stats.nodesFreed += freed;
+					stats.batches++;
+					if (pending.empty())
+						stats.treesFreed++;
+					guard.unlock();
+					freed = 0;
+					std::this_thread::yield();
+				}
+			}
+		}
+
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			busy = false;
+		}
+		room.notify_all();
+	}
+}
@@ -0,0 +1,66 @@
+#ifndef RECLAIMER_H
+#define RECLAIMER_H
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "TreeNode.h"
+
+/*
+ * Frees trees on a background thread, so that getting rid of a big tree
+ * doesn't hold up the thread that was using it.
+ *
+ * Trees are handed over by their root (or by giving an ExprTree a
+ * Reclaimer with setReclaimer, so its destructor hands the tree over) and
+ * wait in a queue. The queue holds a limited number of trees; handing over
+ * a tree when it is full waits for the background thread to catch up, so a
+ * burst of frees can't pile up without limit.
+ * The background thread frees the nodes a batch at a time, and lets other
+ * threads run between batches.
+ */
+class Reclaimer{
+
+ public:
+
+  /*
+   * Counts of what the reclaimer has done so far.
+   */
+  struct Stats{
+    long treesQueued; //Trees handed over.
+    long treesFreed; //Trees whose nodes have all been freed.
+    long nodesFreed;
+    long batches; //Batches of nodes freed.
+    long stalls; //Times a tree was handed over while the queue was full, and had to wait.
+    int maxQueueDepth; //The most trees that were waiting at once.
+  };
+
+  static const int defaultQueueLimit = 64;
+  static const int defaultBatchSize = 4096;
+
+  Reclaimer(int = defaultQueueLimit, int = defaultBatchSize); //Starts the background thread.
+  ~Reclaimer(); //Frees everything still queued, then stops the background thread.
+  void reclaim(TreeNode *); //Takes over the tree with the given root, to be freed later.
+  void drain(); //Waits until every tree handed over so far has been freed.
+  Stats getStats();
+
+ private:
+
+  std::deque<TreeNode *> queue; //The roots of the trees waiting to be freed.
+  int queueLimit;
+  int batchSize;
+  bool stopping;
+  bool busy; //True while the background thread is freeing trees it has taken off the queue.
+  Stats stats;
+  std::mutex lock; //Guards everything above.
+  std::condition_variable work; //Signalled when a tree is queued, or when stopping.
+  std::condition_variable room; //Signalled when trees are taken off the queue, or have been freed.
+  std::thread worker;
+
+  void run();
+
+};
+
+#endif
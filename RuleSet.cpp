@@ -0,0 +1,245 @@
+#include "RuleSet.h"
+#include <algorithm>
+#include <climits>
+
+/*
+ * Helper function that reads a guard from a comparison between a variable
+ * and a number, in either order. The comparison is turned around if needed
+ * so that it reads "variable op bound".
+ * It returns false if n is not such a comparison.
+ */
+bool readGuard(TreeNode * n, string & variable, Operator & op, int & bound) {
+	op = n->getOperator();
+	if (op != Less && op != LessEqual && op != Greater && op != GreaterEqual && op != Equal)
+		return false;
+
+	TreeNode * left = n->getLeftChild();
+	TreeNode * right = n->getRightChild();
+	if (left->isVariable() && right->isValue()) {
+		variable = left->getName();
+		bound = right->getValue();
+		return true;
+	}
+	if (left->isValue() && right->isVariable()) {
+		variable = right->getName();
+		bound = left->getValue();
+		switch (op) {
+		case Less: op = Greater; break;
+		case LessEqual: op = GreaterEqual; break;
+		case Greater: op = Less; break;
+		case GreaterEqual: op = LessEqual; break;
+		default: break;
+		}
+		return true;
+	}
+	return false;
+}
+
+/*
+ * Basic constructor that sets up an empty RuleSet.
+ */
+RuleSet::RuleSet() {
+	sorted = true;
+}
+
+/*
+ * Destructor to clean up the rules.
+ */
+RuleSet::~RuleSet() {
+	for (vector<ExprTree *>::iterator i = rules.begin(); i != rules.end(); ++i)
+		delete *i;
+}
+
+/*
+ * This function looks for a guard of the rule with the given root and
+ * id and adds the rule to the index under it.
+ * It returns false if the rule has no guard.
+ *
+ * Algorithm:
+ * Walk down the && chain at the root with a stack, reading a guard from
+ * every conjunct that is a comparison. An == guard is used as soon as it
+ * is found, since it passes for only one value. Otherwise the first range
+ * guard found is used, with >= and <= turned into > and < so that each
+ * variable only needs an above list and a below list.
+ */
+bool RuleSet::indexRule(TreeNode * root, int id) {
+	stack<TreeNode *> conjuncts;
+	conjuncts.push(root);
+
+	bool found = false;
+	string bestVariable;
+	Operator bestOp = NoOp;
+	int bestBound = 0;
+
+	while (!conjuncts.empty()) {
+		TreeNode * n = conjuncts.top();
+		conjuncts.pop();
+
+		if (n->getOperator() == And) {
+			conjuncts.push(n->getRightChild());
+			conjuncts.push(n->getLeftChild());
+			continue;
+		}
+
+		string variable;
+		Operator op;
+		int bound;
+		if (!readGuard(n, variable, op, bound))
+			continue;
+		if (op == GreaterEqual) {
+			if (bound == INT_MIN)
+				continue;
+			op = Greater;
+			bound--;
+		}
+		if (op == LessEqual) {
+			if (bound == INT_MAX)
+				continue;
+			op = Less;
+			bound++;
+		}
+		if (!found || op == Equal) {
+			found = true;
+			bestVariable = variable;
+			bestOp = op;
+			bestBound = bound;
+		}
+		if (op == Equal)
+			break;
+	}
+
+	if (!found)
+		return false;
+
+	VariableIndex & vi = index[bestVariable];
+	Guard g;
+	g.bound = bestBound;
+	g.rule = id;
+	if (bestOp == Equal)
+		vi.equal[bestBound].push_back(id);
+	else if (bestOp == Greater)
+		vi.above.push_back(g);
+	else
+		vi.below.push_back(g);
+	sorted = false;
+	return true;
+}
+
+/*
+ * Sorts the above and below lists of every variable by their bounds.
+ */
+void RuleSet::sortIndex() {
+	for (map<string, VariableIndex>::iterator i = index.begin(); i != index.end(); ++i) {
+		std::stable_sort(i->second.above.begin(), i->second.above.end());
+		std::stable_sort(i->second.below.begin(), i->second.below.end());
+	}
+	sorted = true;
+}
+
+/*
+ * Parses an expression and adds it as a rule. Returns the id of the rule.
+ */
+int RuleSet::addRule(string expression) {
+	ExprTree t = ExprTree::buildTree(ExprTree::tokenise(expression));
+	return addRule(t.release());
+}
+
+/*
+ * Adds the tree with the given root as a rule and takes ownership of it.
+ * An empty tree is kept under its id but never matches.
+ * Returns the id of the rule.
+ */
+int RuleSet::addRule(TreeNode * root) {
+	int id = rules.size();
+	rules.push_back(new ExprTree(root));
+	if (root != NULL && !indexRule(root, id))
+		unindexed.push_back(id);
+	return id;
+}
+
+/*
+ * This function returns the ids of the rules that are true for the event,
+ * in increasing order. Variables missing from the event count as 0, the
+ * same as in ExprTree::evaluate.
+ *
+ * Algorithm:
+ * For every variable in the index, look up its value v in the event.
+ * The above guards that pass have bound < v, which is a prefix of the sorted
+ * above list, and the below guards that pass have bound > v, a suffix of the
+ * sorted below list. Both ends are found with a binary search.
+ * The == guards that pass are the ones stored under v.
+ * Evaluate every rule found this way and every unindexed rule in full.
+ */
+vector<int> RuleSet::match(const Bindings & event) {
+	if (!sorted)
+		sortIndex();
+
+	vector<int> matched;
+	Guard key;
+	key.rule = 0;
+
+	for (map<string, VariableIndex>::const_iterator i = index.begin(); i != index.end(); ++i) {
+		Bindings::const_iterator binding = event.find(i->first);
+		key.bound = binding == event.end() ? 0 : binding->second;
+		const VariableIndex & vi = i->second;
+
+		vector<Guard>::const_iterator end = std::lower_bound(vi.above.begin(), vi.above.end(), key);
+		for (vector<Guard>::const_iterator g = vi.above.begin(); g != end; ++g)
+			if (rules[g->rule]->evaluateWholeTree(event) != 0)
+				matched.push_back(g->rule);
+
+		vector<Guard>::const_iterator begin = std::upper_bound(vi.below.begin(), vi.below.end(), key);
+		for (vector<Guard>::const_iterator g = begin; g != vi.below.end(); ++g)
+			if (rules[g->rule]->evaluateWholeTree(event) != 0)
+				matched.push_back(g->rule);
+
+		map<int, vector<int> >::const_iterator equal = vi.equal.find(key.bound);
+		if (equal != vi.equal.end())
+			for (vector<int>::const_iterator r = equal->second.begin(); r != equal->second.end(); ++r)
+				if (rules[*r]->evaluateWholeTree(event) != 0)
+					matched.push_back(*r);
+	}
+
+	for (vector<int>::const_iterator r = unindexed.begin(); r != unindexed.end(); ++r)
+		if (rules[*r]->evaluateWholeTree(event) != 0)
+			matched.push_back(*r);
+
+	std::sort(matched.begin(), matched.end());
+	return matched;
+}
+
+/*
+ * Returns how many rules match(...) would evaluate in full for the event,
+ * i.e. the unindexed rules plus the rules whose guards pass.
+ */
+int RuleSet::candidates(const Bindings & event) {
+	if (!sorted)
+		sortIndex();
+
+	int count = unindexed.size();
+	Guard key;
+	key.rule = 0;
+
+	for (map<string, VariableIndex>::const_iterator i = index.begin(); i != index.end(); ++i) {
+		Bindings::const_iterator binding = event.find(i->first);
+		key.bound = binding == event.end() ? 0 : binding->second;
+		const VariableIndex & vi = i->second;
+
+		count += std::lower_bound(vi.above.begin(), vi.above.end(), key) - vi.above.begin();
+		count += vi.below.end() - std::upper_bound(vi.below.begin(), vi.below.end(), key);
+		map<int, vector<int> >::const_iterator equal = vi.equal.find(key.bound);
+		if (equal != vi.equal.end())
+			count += equal->second.size();
+	}
+	return count;
+}
+
+/*
+ * Returns the rule with the given id.
+ */
+ExprTree & RuleSet::getRule(int id) { return *rules[id]; }
+
+/*
+ * Returns the number of rules.
+ */
+int RuleSet::size() { return rules.size(); }
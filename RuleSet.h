@@ -0,0 +1,69 @@
+#ifndef RULESET_H
+#define RULESET_H
+
+#include <vector>
+#include <string>
+#include <map>
+
+#include "ExprTree.h"
+
+/*
+ * A RuleSet holds many rules (expressions that are true when they
+ * evaluate to anything but 0) and finds the ones that are true for
+ * an event, i.e. one set of variable values.
+ *
+ * Most rules are false for most events, so instead of evaluating every
+ * rule, each rule is indexed by a guard: a comparison between a variable
+ * and a number (x > 5, 3 <= y, z == 7, ...) that is the rule itself or one
+ * of the conjuncts of the && chain at its root. The rule can only be true
+ * when its guard is, and the guards that pass for a value of x are a
+ * contiguous range of the guards on x sorted by their number, so only
+ * the rules in those ranges are evaluated in full. Rules without such a
+ * guard are evaluated for every event.
+ */
+class RuleSet{
+
+ private:
+
+  /*
+   * A guard of one rule on some variable, normalised so the rule can
+   * only be true when the variable is above bound (for the above list),
+   * below bound (for the below list) or equal to it (for the equal map).
+   */
+  struct Guard{
+    int bound;
+    int rule;
+    bool operator<(const Guard & other) const { return bound < other.bound; }
+  };
+
+  struct VariableIndex{
+    vector<Guard> above; //Sorted by bound when the index is up to date.
+    vector<Guard> below; //Sorted by bound when the index is up to date.
+    map<int, vector<int> > equal; //Rules by the value the variable must have.
+  };
+
+  vector<ExprTree *> rules; //The rules, by id.
+  map<string, VariableIndex> index; //The guards, by the variable they test.
+  vector<int> unindexed; //Rules without a guard.
+  bool sorted; //False when guards have been added since the lists were last sorted.
+
+  bool indexRule(TreeNode *, int);
+  void sortIndex();
+
+  RuleSet(const RuleSet &); //Not copyable, it owns its rules.
+  RuleSet & operator=(const RuleSet &);
+
+ public:
+
+  RuleSet();
+  ~RuleSet();
+  int addRule(string); //Parses an expression and adds it as a rule. Returns the id of the rule.
+  int addRule(TreeNode *); //Adds a tree as a rule and takes ownership of it. Returns the id of the rule.
+  vector<int> match(const Bindings &); //Returns the ids of the rules that are true for an event, in increasing order.
+  int candidates(const Bindings &); //Returns how many rules match(...) would evaluate in full for an event.
+  ExprTree & getRule(int); //Returns the rule with the given id.
+  int size(); //Returns the number of rules.
+
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include "ExprTree.h"
+#include "ParallelSerialiser.h"
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstdlib>
+using namespace std;
+
+/*
+ * Stress benchmark of many threads reading one shared tree.
+ *
+ * One big tree is built, and then evaluated by one thread and by many
+ * threads at once (64 by default), all reading the same nodes without
+ * copies or locks, and the throughput of each run is printed. Every
+ * thread checks that it gets the same value as the single thread did, and
+ * then that it writes the same infix and postfix text.
+ *
+ * Usage: SharedTreeBenchmark [threads] [terms] [evaluations per thread]
+ */
+
+/*
+ * Returns a random expression with about terms numbers and variables in it,
+ * in parenthesised groups of 16, so the tree isn't one long chain.
+ */
+string sharedExpression(int terms) {
+	static const char * symbols[] = {"+", "-", "*", "<", "&&", "||", "+", "-"};
+	stringstream out;
+	for (int i = 0; i < terms; i++) {
+		if (i % 16 == 0)
+			out << (i == 0 ? "(" : ") " + string(symbols[rand() % 8]) + " (");
+		else
+			out << ' ' << symbols[rand() % 8] << ' ';
+		out << (rand() % 3 == 0 ? "y" : "7");
+	}
+	out << ")";
+	return out.str();
+}
+
+int main(int argc, char ** argv) {
+	int threads = argc > 1 ? atoi(argv[1]) : 64;
+	int terms = argc > 2 ? atoi(argv[2]) : 100000;
+	int evaluations = argc > 3 ? atoi(argv[3]) : 20;
+
+	srand(92);
+	const ExprTree tree = ExprTree::buildTree(ExprTree::tokenise(sharedExpression(terms)));
+	Bindings variables;
+	variables["x"] = 5;
+	variables["y"] = 3;
+	cout << "tree of " << tree.size() << " nodes" << endl;
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	int expected = 0;
+	for (int e = 0; e < evaluations; e++)
+		expected = tree.evaluateWholeTree(variables);
+	double single = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	string text = ExprTree::infixOrder(tree);
+
+	atomic<int> mismatches(0);
+	vector<thread> readers;
+	start = chrono::steady_clock::now();
+	for (int t = 0; t < threads; t++) {
+		readers.push_back(thread([&]() {
+			for (int e = 0; e < evaluations; e++)
+				if (tree.evaluateWholeTree(variables) != expected)
+					mismatches++;
+		}));
+	}
+	for (size_t t = 0; t < readers.size(); t++)
+		readers[t].join();
+	double shared = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	readers.clear();
+	for (int t = 0; t < threads; t++) {
+		readers.push_back(thread([&]() {
+			if (ExprTree::infixOrder(tree) != text || ParallelSerialiser::postfixOrder(tree, 2) != ExprTree::postfixOrder(tree))
+				mismatches++;
+		}));
+	}
+	for (size_t t = 0; t < readers.size(); t++)
+		readers[t].join();
+
+	cout << "1 thread:   " << evaluations / single << " evaluations/s" << endl;
+	cout << threads << " threads: " << evaluations * threads / shared << " evaluations/s" << endl;
+	cout << "mismatches: " << mismatches << endl;
+	return mismatches == 0 ? 0 : 1;
+}
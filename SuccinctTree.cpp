@@ -0,0 +1,681 @@
+#include "SuccinctTree.h"
+#include <sstream>
+
+/*
+ * Basic constructor that sets up an empty bit vector.
+ */
+BitVector::BitVector() {
+	length = 0;
+}
+
+/*
+ * Adds a bit at the end.
+ */
+void BitVector::push(bool bit) {
+	if (length % 64 == 0)
+		words.push_back(0);
+	if (bit)
+		words.back() |= uint64_t(1) << (length % 64);
+	length++;
+}
+
+/*
+ * Builds the count of ones before every block of 512 bits (8 words).
+ */
+void BitVector::finish() {
+	blockRanks.clear();
+	uint32_t ones = 0;
+	for (size_t w = 0; w < words.size(); w++) {
+		if (w % (blockBits / 64) == 0)
+			blockRanks.push_back(ones);
+		ones += __builtin_popcountll(words[w]);
+	}
+}
+
+/*
+ * Returns the bit at position i.
+ */
+bool BitVector::get(size_t i) const {
+	return (words[i / 64] >> (i % 64)) & 1;
+}
+
+/*
+ * Returns the number of ones before position i: the count for its block,
+ * plus the ones in the whole words of the block before it, plus the ones
+ * below it in its own word.
+ */
+size_t BitVector::rank1(size_t i) const {
+	if (i >= length)
+		return blockRanks.empty() ? 0 : rank1(length - 1) + get(length - 1);
+	size_t w = i / 64;
+	size_t ones = blockRanks[i / blockBits];
+	for (size_t b = w - w % (blockBits / 64); b < w; b++)
+		ones += __builtin_popcountll(words[b]);
+	if (i % 64 != 0)
+		ones += __builtin_popcountll(words[w] & ((uint64_t(1) << (i % 64)) - 1));
+	return ones;
+}
+
+/*
+ * Returns the position of the k-th one, counting from 0, or size() if
+ * there are not that many.
+ *
+ * Algorithm:
+ * Binary search for the last block with fewer than k + 1 ones before it,
+ * then count through the words of the block, then the bits of the word.
+ */
+size_t BitVector::select1(size_t k) const {
+	if (blockRanks.empty())
+		return length;
+	size_t low = 0;
+	size_t high = blockRanks.size() - 1;
+	while (low < high) {
+		size_t middle = (low + high + 1) / 2;
+		if (blockRanks[middle] <= k)
+			low = middle;
+		else
+			high = middle - 1;
+	}
+
+	size_t remaining = k - blockRanks[low];
+	for (size_t w = low * (blockBits / 64); w < words.size(); w++) {
+		size_t ones = __builtin_popcountll(words[w]);
+		if (remaining < ones) {
+			uint64_t word = words[w];
+			for (size_t r = 0; r < remaining; r++)
+				word &= word - 1;
+			return w * 64 + __builtin_ctzll(word);
+		}
+		remaining -= ones;
+	}
+	return length;
+}
+
+/*
+ * Returns the number of bits.
+ */
+size_t BitVector::size() const { return length; }
+
+/*
+ * Returns the number of bytes used by the bits and the rank counts.
+ */
+size_t BitVector::memoryUsage() const {
+	return words.size() * sizeof(uint64_t) + blockRanks.size() * sizeof(uint32_t);
+}
+
+/*
+ * Returns the bits, 64 to a word, first bit lowest.
+ */
+const std::vector<uint64_t> & BitVector::getWords() const { return words; }
+
+/*
+ * For every byte of the shape (bits read lowest first, 1 = +1, 0 = -1),
+ * the excess of the whole byte and the lowest excess after any of its bits.
+ */
+struct ByteExcessTable {
+	signed char total[256];
+	signed char minimum[256];
+
+	ByteExcessTable() {
+		for (int b = 0; b < 256; b++) {
+			int excess = 0;
+			int lowest = 8;
+			for (int bit = 0; bit < 8; bit++) {
+				excess += ((b >> bit) & 1) ? 1 : -1;
+				if (excess < lowest)
+					lowest = excess;
+			}
+			total[b] = excess;
+			minimum[b] = lowest;
+		}
+	}
+};
+
+static const ByteExcessTable byteExcess;
+
+/*
+ * Helper functions for the zigzag encoding, which maps 0, -1, 1, -2, ...
+ * to 0, 1, 2, 3, ... so that small negative numbers stay short.
+ */
+uint32_t zigzag(int n) {
+	return (uint32_t(n) << 1) ^ uint32_t(n >> 31);
+}
+
+int unzigzag(uint32_t n) {
+	return int(n >> 1) ^ -int(n & 1);
+}
+
+/*
+ * Helper function that appends a number to a string.
+ */
+void appendNumber(string & out, int n) {
+	std::stringstream stream;
+	stream << n;
+	out += stream.str();
+}
+
+/*
+ * Basic constructor that sets up an empty tree.
+ */
+SuccinctTree::SuccinctTree() {
+	literalCount = 0;
+	shape.finish();
+	literalNodes.finish();
+}
+
+/*
+ * Constructor that encodes the tree with the given root.
+ *
+ * Algorithm:
+ * Encode the nodes in prefix order (see encode), then build the rank counts
+ * and, for every block of the shape, the excess of the block and the lowest
+ * excess inside it, which findClose uses to skip whole blocks.
+ */
+SuccinctTree::SuccinctTree(TreeNode * root) {
+	literalCount = 0;
+	std::map<string, int> nameIndex;
+	if (root != NULL)
+		encode(root, nameIndex);
+	shape.finish();
+	literalNodes.finish();
+
+	const std::vector<uint64_t> & words = shape.getWords();
+	for (size_t start = 0; start < shape.size(); start += BitVector::blockBits) {
+		int excess = 0;
+		int lowest = BitVector::blockBits;
+		for (size_t i = start; i < start + BitVector::blockBits && i < shape.size(); i++) {
+			excess += ((words[i / 64] >> (i % 64)) & 1) ? 1 : -1;
+			if (excess < lowest)
+				lowest = excess;
+		}
+		blockExcess.push_back(excess);
+		blockMinExcess.push_back(lowest);
+	}
+}
+
+/*
+ * Recursive function that appends the subtree at n to the streams in prefix order.
+ * Numbers go into the literal stream zigzag encoded, variables as the index
+ * of their name, which is added to names the first time it is seen.
+ * Deferred nodes are materialised as they are reached.
+ */
+void SuccinctTree::encode(TreeNode * n, std::map<string, int> & nameIndex) {
+	ExprTree::materialise(n);
+	shape.push(true);
+	opcodes.push_back((unsigned char)n->getOperator());
+
+	if (n->isValue()) {
+		literalNodes.push(true);
+		pushLiteral(zigzag(n->getValue()));
+	}
+	else if (n->isVariable()) {
+		literalNodes.push(true);
+		std::map<string, int>::iterator found = nameIndex.find(n->getName());
+		if (found == nameIndex.end()) {
+			found = nameIndex.insert(std::make_pair(n->getName(), int(names.size()))).first;
+			names.push_back(n->getName());
+		}
+		pushLiteral(found->second);
+	}
+	else
+		literalNodes.push(false);
+
+	if (n->getLeftChild() != NULL)
+		encode(n->getLeftChild(), nameIndex);
+	if (n->getRightChild() != NULL)
+		encode(n->getRightChild(), nameIndex);
+	shape.push(false);
+}
+
+/*
+ * Appends a literal to the literal stream, 7 bits to a byte with the top bit
+ * set on every byte but the last, sampling the offset of every 32nd one.
+ */
+void SuccinctTree::pushLiteral(uint32_t n) {
+	if (literalCount % literalSampleRate == 0)
+		literalSamples.push_back(literals.size());
+	literalCount++;
+	while (n >= 0x80) {
+		literals.push_back((unsigned char)(n | 0x80));
+		n >>= 7;
+	}
+	literals.push_back((unsigned char)n);
+}
+
+/*
+ * Reads the literal at byte offset and moves offset past it.
+ */
+uint32_t SuccinctTree::readLiteral(size_t & offset) const {
+	uint32_t n = 0;
+	int shift = 0;
+	while (literals[offset] & 0x80) {
+		n |= uint32_t(literals[offset++] & 0x7F) << shift;
+		shift += 7;
+	}
+	n |= uint32_t(literals[offset++]) << shift;
+	return n;
+}
+
+/*
+ * Returns the byte offset of the k-th literal, decoding at most 31 literals
+ * from the nearest sample before it.
+ */
+size_t SuccinctTree::literalOffset(int k) const {
+	if (k >= literalCount)
+		return literals.size();
+	size_t offset = literalSamples[k / literalSampleRate];
+	for (int i = k - k % literalSampleRate; i < k; i++)
+		readLiteral(offset);
+	return offset;
+}
+
+/*
+ * Returns a cursor at the given node.
+ */
+SuccinctTree::Cursor SuccinctTree::cursorAt(int node) const {
+	Cursor c;
+	c.position = shape.select1(node);
+	c.node = node;
+	c.literal = literalNodes.rank1(node);
+	c.literalByte = literalOffset(c.literal);
+	return c;
+}
+
+/*
+ * Moves the cursor past the subtree of the node it is at without visiting it,
+ * using findClose to jump over the shape and rank to find the next literal.
+ */
+void SuccinctTree::skip(Cursor & c) const {
+	size_t close = findClose(c.position);
+	c.node += (close - c.position + 1) / 2;
+	c.position = close + 1;
+	c.literal = literalNodes.rank1(c.node);
+	c.literalByte = literalOffset(c.literal);
+}
+
+/*
+ * Reads the literal of the node the cursor is at, if it has one, and moves
+ * the cursor onto its first child (or its close parenthesis).
+ * It returns the literal, or 0 if the node has none.
+ */
+int SuccinctTree::literalValue(Cursor & c) const {
+	uint32_t literal = 0;
+	if (literalNodes.get(c.node)) {
+		literal = readLiteral(c.literalByte);
+		c.literal++;
+	}
+	c.position++;
+	c.node++;
+	return literal;
+}
+
+/*
+ * Returns the shape position of the close parenthesis matching the open
+ * parenthesis at position p, or the size of the shape if there is none.
+ *
+ * Algorithm:
+ * Keep the excess d of the bits after p (+1 for an open, -1 for a close);
+ * the match is the first position where d gets to -1. Check bit by bit up
+ * to a byte boundary, then skip whole blocks of 512 bits and whole bytes
+ * while their lowest excess shows that d can't get to -1 inside them, and
+ * only check bit by bit in the byte where it does.
+ */
+size_t SuccinctTree::findClose(size_t p) const {
+	const std::vector<uint64_t> & words = shape.getWords();
+	size_t n = shape.size();
+	int d = 0;
+	size_t q = p + 1;
+
+	while (q < n && q % 8 != 0) {
+		d += shape.get(q) ? 1 : -1;
+		if (d == -1)
+			return q;
+		q++;
+	}
+
+	while (q < n) {
+		if (q % BitVector::blockBits == 0) {
+			size_t b = q / BitVector::blockBits;
+			if (d + blockMinExcess[b] > -1) {
+				d += blockExcess[b];
+				q += BitVector::blockBits;
+				continue;
+			}
+		}
+		unsigned char byte = (unsigned char)(words[q / 64] >> (q % 64));
+		if (q + 8 <= n && d + byteExcess.minimum[byte] > -1) {
+			d += byteExcess.total[byte];
+			q += 8;
+			continue;
+		}
+		for (int bit = 0; bit < 8 && q < n; bit++, q++) {
+			d += ((byte >> bit) & 1) ? 1 : -1;
+			if (d == -1)
+				return q;
+		}
+	}
+	return n;
+}
+
+/*
+ * Returns the number of nodes.
+ */
+int SuccinctTree::size() const { return opcodes.size(); }
+
+/*
+ * Returns true if the tree has no nodes.
+ */
+bool SuccinctTree::isEmpty() const { return opcodes.empty(); }
+
+/*
+ * Returns the number of bytes used by the encoding.
+ */
+size_t SuccinctTree::memoryUsage() const {
+	size_t bytes = sizeof(SuccinctTree) + shape.memoryUsage() + literalNodes.memoryUsage();
+	bytes += opcodes.size() + literals.size() + literalSamples.size() * sizeof(uint32_t);
+	bytes += (blockExcess.size() + blockMinExcess.size()) * sizeof(int16_t);
+	for (std::vector<string>::const_iterator i = names.begin(); i != names.end(); ++i)
+		bytes += sizeof(string) + i->size();
+	return bytes;
+}
+
+/*
+ * Returns the operator of a node.
+ */
+Operator SuccinctTree::getOperator(int node) const { return Operator(opcodes[node]); }
+
+/*
+ * Returns the number of a Value node.
+ */
+int SuccinctTree::getValue(int node) const {
+	size_t offset = literalOffset(literalNodes.rank1(node));
+	return unzigzag(readLiteral(offset));
+}
+
+/*
+ * Returns the name of a Variable node.
+ */
+const string & SuccinctTree::getName(int node) const {
+	size_t offset = literalOffset(literalNodes.rank1(node));
+	return names[readLiteral(offset)];
+}
+
+/*
+ * Returns the left child of a node: the next node in prefix order,
+ * if the node has any children.
+ */
+int SuccinctTree::getLeftChild(int node) const {
+	size_t p = shape.select1(node);
+	return shape.get(p + 1) ? node + 1 : -1;
+}
+
+/*
+ * Returns the right child of a node: the node after the left child's
+ * subtree, if that is still inside the node.
+ */
+int SuccinctTree::getRightChild(int node) const {
+	size_t p = shape.select1(node);
+	if (!shape.get(p + 1))
+		return -1;
+	size_t q = findClose(p + 1) + 1;
+	return shape.get(q) ? node + 1 + int((q - p - 1) / 2) : -1;
+}
+
+/*
+ * Returns the number of nodes in the subtree of a node.
+ */
+int SuccinctTree::subtreeSize(int node) const {
+	size_t p = shape.select1(node);
+	return (findClose(p) - p + 1) / 2;
+}
+
+/*
+ * Recursive function that evaluates the subtree at the cursor the same way
+ * ExprTree::evaluate does, and moves the cursor past it.
+ * The operands of &&, || and ?: that are not needed are skipped over.
+ */
+int SuccinctTree::evaluate(Cursor & c, const Bindings & variables) const {
+	Operator op = Operator(opcodes[c.node]);
+	int literal = literalValue(c);
+	int result = 0;
+
+	switch (op) {
+	case Value:
+		result = unzigzag(literal);
+		break;
+	case Variable: {
+		Bindings::const_iterator binding = variables.find(names[literal]);
+		result = binding == variables.end() ? 0 : binding->second;
+		break;
+	}
+	case And:
+	case Or: {
+		bool left = evaluate(c, variables) != 0;
+		if (left == (op == Or))
+			result = left;
+		else
+			result = evaluate(c, variables) != 0;
+		break;
+	}
+	case Conditional: {
+		int condition = evaluate(c, variables);
+		if (Operator(opcodes[c.node]) != Alternative) {
+			if (condition)
+				result = evaluate(c, variables);
+			break;
+		}
+		literalValue(c);
+		if (condition) {
+			result = evaluate(c, variables);
+			skip(c);
+		}
+		else {
+			skip(c);
+			result = evaluate(c, variables);
+		}
+		c.position++;
+		break;
+	}
+	case Alternative:
+		result = evaluate(c, variables);
+		break;
+	default: {
+		const OperatorInfo & info = OperatorRegistry::get(op);
+		if (info.kernel == NULL)
+			break;
+		int left = evaluate(c, variables);
+		result = info.arity == 1 ? info.kernel(left, 0) : info.kernel(left, evaluate(c, variables));
+		break;
+	}
+	}
+
+	while (shape.get(c.position))
+		skip(c);
+	c.position++;
+	return result;
+}
+
+/*
+ * Evaluates the whole tree, which must not contain variables.
+ */
+int SuccinctTree::evaluate() const {
+	static const Bindings noVariables;
+	return evaluate(noVariables);
+}
+
+/*
+ * Evaluates the whole tree with the given variable values.
+ */
+int SuccinctTree::evaluate(const Bindings & variables) const {
+	if (isEmpty())
+		return 0;
+	Cursor c = cursorAt(0);
+	return evaluate(c, variables);
+}
+
+/*
+ * Recursive function that builds TreeNodes for the subtree at the cursor
+ * and moves the cursor past it.
+ */
+TreeNode * SuccinctTree::decode(Cursor & c) const {
+	Operator op = Operator(opcodes[c.node]);
+	int literal = literalValue(c);
+	TreeNode * n;
+	if (op == Value)
+		n = new TreeNode(unzigzag(literal));
+	else if (op == Variable)
+		n = new TreeNode(names[literal]);
+	else
+		n = new TreeNode(op);
+
+	if (shape.get(c.position)) {
+		TreeNode * left = decode(c);
+		n->setLeftChild(left);
+		left->setParent(n);
+	}
+	if (shape.get(c.position)) {
+		TreeNode * right = decode(c);
+		n->setRightChild(right);
+		right->setParent(n);
+	}
+	c.position++;
+	return n;
+}
+
+/*
+ * Builds the tree again out of TreeNodes. The caller owns the result,
+ * e.g. by giving it to an ExprTree.
+ */
+TreeNode * SuccinctTree::decode() const {
+	if (isEmpty())
+		return NULL;
+	Cursor c = cursorAt(0);
+	return decode(c);
+}
+
+/*
+ * Recursive helper functions for the three orders below, written to match
+ * the ones in ExprTree.cpp. Each appends the subtree at the cursor to out
+ * and moves the cursor past it.
+ */
+void SuccinctTree::appendPrefix(Cursor & c, string & out) const {
+	Operator op = Operator(opcodes[c.node]);
+	int literal = literalValue(c);
+	const OperatorInfo & info = OperatorRegistry::get(op);
+
+	if (op == Value)
+		appendNumber(out, unzigzag(literal));
+	else if (op == Variable)
+		out += names[literal];
+	else if (op != NoOp) {
+		out += info.symbol;
+		out += ' ';
+		appendPrefix(c, out);
+		if (info.arity != 1) {
+			out += ' ';
+			appendPrefix(c, out);
+		}
+	}
+
+	while (shape.get(c.position))
+		skip(c);
+	c.position++;
+}
+
+void SuccinctTree::appendInfix(Cursor & c, string & out) const {
+	Operator op = Operator(opcodes[c.node]);
+	int literal = literalValue(c);
+	const OperatorInfo & info = OperatorRegistry::get(op);
+
+	if (op == Value)
+		appendNumber(out, unzigzag(literal));
+	else if (op == Variable)
+		out += names[literal];
+	else if (op == Negate) {
+		const OperatorInfo & operand = OperatorRegistry::get(Operator(opcodes[c.node]));
+		bool parenthesise = opcodes[c.node] != Value && opcodes[c.node] != Variable &&
+			opcodes[c.node] != NoOp && operand.notation != Function && operand.arity != 1;
+		out += '-';
+		if (parenthesise)
+			out += '(';
+		appendInfix(c, out);
+		if (parenthesise)
+			out += ')';
+	}
+	else if (op != NoOp && info.notation == Function) {
+		out += info.symbol;
+		out += '(';
+		appendInfix(c, out);
+		if (info.arity != 1) {
+			out += ", ";
+			appendInfix(c, out);
+		}
+		out += ')';
+	}
+	else if (op != NoOp) {
+		appendInfix(c, out);
+		out += ' ';
+		out += info.symbol;
+		out += ' ';
+		appendInfix(c, out);
+	}
+
+	while (shape.get(c.position))
+		skip(c);
+	c.position++;
+}
+
+void SuccinctTree::appendPostfix(Cursor & c, string & out) const {
+	Operator op = Operator(opcodes[c.node]);
+	int literal = literalValue(c);
+	const OperatorInfo & info = OperatorRegistry::get(op);
+
+	if (op == Value)
+		appendNumber(out, unzigzag(literal));
+	else if (op == Variable)
+		out += names[literal];
+	else if (op != NoOp) {
+		appendPostfix(c, out);
+		out += ' ';
+		if (info.arity != 1) {
+			appendPostfix(c, out);
+			out += ' ';
+		}
+		out += info.symbol;
+	}
+
+	while (shape.get(c.position))
+		skip(c);
+	c.position++;
+}
+
+/*
+ * Given a SuccinctTree t, these functions return the same strings as
+ * ExprTree::prefixOrder, infixOrder and postfixOrder do for the tree it encodes.
+ */
+string SuccinctTree::prefixOrder(const SuccinctTree & t) {
+	string out;
+	if (!t.isEmpty()) {
+		Cursor c = t.cursorAt(0);
+		t.appendPrefix(c, out);
+	}
+	return out;
+}
+
+string SuccinctTree::infixOrder(const SuccinctTree & t) {
+	string out;
+	if (!t.isEmpty()) {
+		Cursor c = t.cursorAt(0);
+		t.appendInfix(c, out);
+	}
+	return out;
+}
+
+string SuccinctTree::postfixOrder(const SuccinctTree & t) {
+	string out;
+	if (!t.isEmpty()) {
+		Cursor c = t.cursorAt(0);
+		t.appendPostfix(c, out);
+	}
+	return out;
+}
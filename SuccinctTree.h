@@ -0,0 +1,128 @@
+#ifndef SUCCINCTTREE_H
+#define SUCCINCTTREE_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+#include "ExprTree.h"
+
+/*
+ * A growable array of bits with rank and select support.
+ * rank1(i) counts the ones before position i in O(1) using a count of the
+ * ones before every block of 512 bits, and select1(k) finds the k-th one
+ * (counting from 0) with a binary search over those counts.
+ */
+class BitVector{
+
+ public:
+
+  static const int blockBits = 512;
+
+  BitVector();
+  void push(bool); //Adds a bit at the end.
+  void finish(); //Builds the rank counts. Call after the last push(...).
+  bool get(size_t) const; //Returns the bit at a position.
+  size_t rank1(size_t) const; //Returns the number of ones before a position.
+  size_t select1(size_t) const; //Returns the position of the k-th one, counting from 0.
+  size_t size() const; //Returns the number of bits.
+  size_t memoryUsage() const; //Returns the number of bytes used.
+  const std::vector<uint64_t> & getWords() const; //Returns the bits, 64 to a word, first bit lowest.
+
+ private:
+
+  std::vector<uint64_t> words;
+  std::vector<uint32_t> blockRanks; //The number of ones before each block.
+  size_t length;
+
+};
+
+/*
+ * A read-only, compact encoding of an expression tree.
+ *
+ * The shape is a balanced parentheses bitvector: walking the tree in prefix
+ * order, a 1 is written when a node is entered and a 0 when it is left, so
+ * each node takes two bits and the nodes are numbered in prefix order by the
+ * rank of their 1. The operators are a stream of one byte per node (the
+ * Operator value), and the numbers and variable indices are a separate stream
+ * of variable-byte integers (numbers are zigzag encoded so small negative
+ * numbers stay short). Every 32nd entry of that stream has its byte offset
+ * sampled, so any one of them can be read without decoding from the start.
+ *
+ * evaluate and the order functions run straight off the encoding, walking
+ * the streams in order and using findClose(...) to skip over subtrees that
+ * && , || and ?: don't need. A node takes about 10 bits plus its number,
+ * against more than 64 bytes for a TreeNode.
+ */
+class SuccinctTree{
+
+ private:
+
+  static const int literalSampleRate = 32;
+
+  BitVector shape; //The balanced parentheses, one open and one close per node.
+  BitVector literalNodes; //1 for every node that has a number or variable in the literal stream.
+  std::vector<unsigned char> opcodes; //The Operator of each node, in prefix order.
+  std::vector<unsigned char> literals; //The numbers and variable indices, as variable-byte integers.
+  std::vector<uint32_t> literalSamples; //The byte offset of every 32nd literal.
+  std::vector<string> names; //The variable names, by index.
+  std::vector<int16_t> blockMinExcess; //The lowest excess (opens minus closes) inside each block of shape.
+  std::vector<int16_t> blockExcess; //The excess of each whole block of shape.
+  int literalCount;
+
+  /*
+   * A position in the walk over the encoding: the shape position of the
+   * open parenthesis of the current node, its node number, and where its
+   * literal (if it has one) starts.
+   */
+  struct Cursor{
+    size_t position;
+    int node;
+    int literal;
+    size_t literalByte;
+  };
+
+  void encode(TreeNode *, std::map<string, int> &);
+  void pushLiteral(uint32_t);
+  uint32_t readLiteral(size_t &) const;
+  size_t literalOffset(int) const;
+  Cursor cursorAt(int) const;
+  void skip(Cursor &) const;
+  int literalValue(Cursor &) const;
+  int evaluate(Cursor &, const Bindings &) const;
+  TreeNode * decode(Cursor &) const;
+  void appendPrefix(Cursor &, string &) const;
+  void appendInfix(Cursor &, string &) const;
+  void appendPostfix(Cursor &, string &) const;
+
+ public:
+
+  SuccinctTree(); //Sets up an empty tree.
+  SuccinctTree(TreeNode *); //Encodes the tree with the given root.
+  int size() const; //Returns the number of nodes.
+  bool isEmpty() const;
+  size_t memoryUsage() const; //Returns the number of bytes used by the encoding.
+
+  /*
+   * Random access to the nodes, by their number in prefix order (the root is 0).
+   * The child functions return -1 if there is no such child.
+   */
+  Operator getOperator(int) const;
+  int getValue(int) const; //Returns the number of a Value node.
+  const string & getName(int) const; //Returns the name of a Variable node.
+  int getLeftChild(int) const;
+  int getRightChild(int) const;
+  int subtreeSize(int) const; //Returns the number of nodes in the subtree of a node.
+  size_t findClose(size_t) const; //Returns the shape position of the close parenthesis matching an open one.
+
+  int evaluate() const; //Evaluates the whole tree, like ExprTree::evaluateWholeTree().
+  int evaluate(const Bindings &) const;
+  TreeNode * decode() const; //Builds the tree again out of TreeNodes. The caller owns the result.
+
+  static string prefixOrder(const SuccinctTree &); //Same results as the ExprTree functions.
+  static string infixOrder(const SuccinctTree &);
+  static string postfixOrder(const SuccinctTree &);
+
+};
+
+#endif
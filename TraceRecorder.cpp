@@ -0,0 +1,228 @@
+#include "TraceRecorder.h"
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+
+/*
+ * A span in a TraceBuffer.
+ */
+struct TraceEvent{
+	const char * name;
+	uint64_t start; //In nanoseconds since the recorder was made.
+	uint64_t duration;
+	long id;
+	long size;
+};
+
+/*
+ * The spans of one thread. Only that thread writes to it. It publishes
+ * each span by storing the new count (with release), so a reader that
+ * loads the count (with acquire) can read that many spans while the
+ * thread carries on. Chunks are never moved or freed until the recorder
+ * is deleted.
+ */
+struct TraceBuffer{
+	int thread; //The thread's number, for its track.
+	string name;
+	std::atomic<TraceEvent *> chunks[TraceRecorder::maxEvents / TraceRecorder::chunkEvents];
+	std::atomic<size_t> count;
+	TraceBuffer * next; //The buffer made before this one.
+};
+
+/*
+ * The recorder BatchEvaluator uses, or NULL.
+ */
+std::atomic<TraceRecorder *> installedTrace(NULL);
+
+/*
+ * Numbers recorders, so each has an id that is never reused.
+ */
+std::atomic<uint64_t> traceRecorders(0);
+
+/*
+ * The id of the recorder the calling thread last recorded into, and its
+ * buffer in it.
+ */
+thread_local uint64_t traceOwner = 0;
+thread_local TraceBuffer * traceBuffer = NULL;
+
+/*
+ * Helper function that returns the time from a steady clock in nanoseconds.
+ */
+uint64_t steadyNanoseconds() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*
+ * Helper function that writes s onto out as a JSON string, in quotes.
+ */
+void appendJsonString(std::stringstream & out, const string & s) {
+	out << '"';
+	for (size_t i = 0; i < s.size(); i++) {
+		if (s[i] == '"' || s[i] == '\\')
+			out << '\\' << s[i];
+		else if ((unsigned char)s[i] < 0x20)
+			out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)(unsigned char)s[i] << std::dec;
+		else
+			out << s[i];
+	}
+	out << '"';
+}
+
+/*
+ * Constructor that sets up a recorder with no spans.
+ */
+TraceRecorder::TraceRecorder() : buffers(NULL), threads(0), dropped(0) {
+	id = ++traceRecorders;
+	epoch = steadyNanoseconds();
+}
+
+/*
+ * Destructor that frees every buffer.
+ */
+TraceRecorder::~TraceRecorder() {
+	TraceBuffer * b = buffers.load();
+	while (b != NULL) {
+		TraceBuffer * next = b->next;
+		for (size_t c = 0; c < maxEvents / chunkEvents; c++)
+			delete[] b->chunks[c].load();
+		delete b;
+		b = next;
+	}
+}
+
+/*
+ * Returns the time in nanoseconds since the recorder was made.
+ */
+uint64_t TraceRecorder::now() { return steadyNanoseconds() - epoch; }
+
+/*
+ * Returns the calling thread's buffer, making it (with the given name, or
+ * "thread N" if that is empty) if the thread has none in this recorder.
+ * A new buffer is pushed onto the front of the list with compare and swap,
+ * so threads making their buffers at once don't need a lock.
+ */
+TraceBuffer * TraceRecorder::buffer(const string & name) {
+	if (traceOwner == id)
+		return traceBuffer;
+	TraceBuffer * b = new TraceBuffer();
+	b->thread = threads.fetch_add(1) + 1;
+	if (name.empty()) {
+		std::stringstream fallback;
+		fallback << "thread " << b->thread;
+		b->name = fallback.str();
+	}
+	else
+		b->name = name;
+	for (size_t c = 0; c < maxEvents / chunkEvents; c++)
+		b->chunks[c].store(NULL, std::memory_order_relaxed);
+	b->count.store(0, std::memory_order_relaxed);
+	b->next = buffers.load(std::memory_order_relaxed);
+	while (!buffers.compare_exchange_weak(b->next, b, std::memory_order_release, std::memory_order_relaxed))
+		;
+	traceOwner = id;
+	traceBuffer = b;
+	return b;
+}
+
+/*
+ * Names the calling thread's track, if it hasn't recorded anything yet.
+ */
+void TraceRecorder::nameThread(const string & name) {
+	buffer(name);
+}
+
+/*
+ * Adds a span with the given name, start and end times (from now()), and
+ * the id and size of the expression it was for, to the calling thread's
+ * buffer. If the buffer is full, the span is dropped.
+ */
+void TraceRecorder::record(const char * name, uint64_t start, uint64_t end, long expression, long size) {
+	TraceBuffer * b = buffer("");
+	size_t i = b->count.load(std::memory_order_relaxed);
+	if (i >= maxEvents) {
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	TraceEvent * chunk = b->chunks[i / chunkEvents].load(std::memory_order_relaxed);
+	if (chunk == NULL) {
+		chunk = new TraceEvent[chunkEvents];
+		b->chunks[i / chunkEvents].store(chunk, std::memory_order_release);
+	}
+	TraceEvent & e = chunk[i % chunkEvents];
+	e.name = name;
+	e.start = start;
+	e.duration = end > start ? end - start : 0;
+	e.id = expression;
+	e.size = size;
+	b->count.store(i + 1, std::memory_order_release);
+}
+
+/*
+ * Returns the spans recorded so far as trace event JSON: a thread_name
+ * event for each thread, then a complete ("X") event for each span, with
+ * times in microseconds and the expression's id and size as its args.
+ */
+string TraceRecorder::toJson() {
+	std::stringstream out;
+	out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	bool first = true;
+	for (TraceBuffer * b = buffers.load(std::memory_order_acquire); b != NULL; b = b->next) {
+		out << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b->thread
+			<< ",\"args\":{\"name\":";
+		appendJsonString(out, b->name);
+		out << "}}";
+		first = false;
+		size_t count = b->count.load(std::memory_order_acquire);
+		for (size_t i = 0; i < count; i++) {
+			const TraceEvent & e = b->chunks[i / chunkEvents].load(std::memory_order_acquire)[i % chunkEvents];
+			out << ",\n{\"name\":";
+			appendJsonString(out, e.name);
+			out << ",\"cat\":\"expr\",\"ph\":\"X\",\"pid\":1,\"tid\":" << b->thread
+				<< ",\"ts\":" << e.start / 1000 << "." << std::setw(3) << std::setfill('0') << e.start % 1000
+				<< ",\"dur\":" << e.duration / 1000 << "." << std::setw(3) << std::setfill('0') << e.duration % 1000
+				<< ",\"args\":{\"id\":" << e.id << ",\"size\":" << e.size << "}}";
+		}
+	}
+	out << "\n]}\n";
+	return out.str();
+}
+
+/*
+ * Writes toJson() to the file at path.
+ */
+bool TraceRecorder::write(const string & path) {
+	std::ofstream file(path.c_str(), std::ios::trunc);
+	string json = toJson();
+	return (bool)file.write(json.data(), json.size());
+}
+
+/*
+ * Returns the number of spans recorded so far, on every thread.
+ */
+long TraceRecorder::eventCount() {
+	long total = 0;
+	for (TraceBuffer * b = buffers.load(std::memory_order_acquire); b != NULL; b = b->next)
+		total += b->count.load(std::memory_order_acquire);
+	return total;
+}
+
+/*
+ * Returns the number of spans dropped because a thread's buffer was full.
+ */
+long TraceRecorder::getDropped() { return dropped.load(std::memory_order_relaxed); }
+
+/*
+ * Returns the recorder BatchEvaluator uses, or NULL.
+ */
+TraceRecorder * TraceRecorder::installed() { return installedTrace.load(std::memory_order_acquire); }
+
+/*
+ * Makes BatchEvaluator use the recorder r (or none, if r is NULL), and
+ * returns the one it used before.
+ */
+TraceRecorder * TraceRecorder::install(TraceRecorder * r) {
+	return installedTrace.exchange(r, std::memory_order_acq_rel);
+}
@@ -0,0 +1,68 @@
+#ifndef TRACERECORDER_H
+#define TRACERECORDER_H
+
+#include <string>
+#include <atomic>
+#include <stdint.h>
+
+using std::string;
+
+struct TraceBuffer;
+
+/*
+ * Records spans of time (e.g. tokenising, building or evaluating one
+ * expression) on any number of threads, and writes them out as trace
+ * events in the JSON format that chrome://tracing and Perfetto read, with
+ * one track for each thread.
+ *
+ * Each thread writes its spans into a buffer of its own, so recording
+ * takes no locks and threads never wait for each other. A buffer grows a
+ * chunk at a time up to maxEvents; spans after that are dropped (and
+ * counted). The spans can be written out while threads are still
+ * recording: each buffer publishes how many of its spans are complete.
+ *
+ * Once a recorder is installed (see install(...)), BatchEvaluator records
+ * its tasks, and tokenise, buildTree and evaluation for each expression.
+ * When none is installed, that costs one check of a pointer.
+ * A recorder must be uninstalled, and every thread done recording into it,
+ * before it is deleted.
+ */
+class TraceRecorder{
+
+ public:
+
+  static const size_t chunkEvents = 4096; //How many spans a buffer grows by at a time.
+  static const size_t maxEvents = chunkEvents * 256; //How many spans one thread can record.
+
+  TraceRecorder();
+  ~TraceRecorder();
+  void record(const char *, uint64_t, uint64_t, long, long); //Adds a span on the calling thread: its name (which
+                                                            //must last as long as the recorder), start and end
+                                                            //(from now()), and the expression's id and size.
+  void nameThread(const string &); //Names the calling thread's track. Only works before it records anything.
+  uint64_t now(); //The time in nanoseconds since the recorder was made.
+  string toJson(); //The spans so far, as trace event JSON.
+  bool write(const string &); //Writes toJson() to a file. Returns false if it can't.
+  long eventCount(); //The number of spans recorded so far.
+  long getDropped(); //The number of spans dropped because a buffer was full.
+
+  static TraceRecorder * installed(); //The recorder BatchEvaluator uses, or NULL for none.
+  static TraceRecorder * install(TraceRecorder *); //Makes BatchEvaluator use a recorder (NULL for none) and returns
+                                                   //the one it used before.
+
+ private:
+
+  uint64_t id; //Tells this recorder apart from any that used to be at the same address.
+  uint64_t epoch; //The time the recorder was made.
+  std::atomic<TraceBuffer *> buffers; //A list of the buffers of every thread, newest first.
+  std::atomic<int> threads; //The number of buffers.
+  std::atomic<long> dropped;
+
+  TraceRecorder(const TraceRecorder &); //Not copyable.
+  TraceRecorder & operator=(const TraceRecorder &);
+
+  TraceBuffer * buffer(const string &); //The calling thread's buffer, made with the given name if it has none.
+
+};
+
+#endif
@@ -0,0 +1,260 @@
+#include "TreeCache.h"
+#include "IndexedPrefix.h"
+#include "TreeDiff.h"
+#include "Metrics.h"
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+
+/*
+ * The first bytes of every cache file.
+ */
+const string cacheMagic = "EXPRTREE-CACHE\n";
+
+/*
+ * Helper function that returns the checksum of the bytes of s up to end
+ * (FNV-1a).
+ */
+uint64_t cacheChecksum(const string & s, size_t end) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < end; i++) {
+		h ^= (unsigned char)s[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/*
+ * Helper function that appends n to out as bytes little end first, so the
+ * file reads the same on any machine.
+ */
+void putBytes(string & out, uint64_t n, int bytes) {
+	for (int i = 0; i < bytes; i++)
+		out += (char)((n >> (8 * i)) & 0xff);
+}
+
+/*
+ * Helper function that reads a number written by putBytes at pos, and moves
+ * pos past it. It returns false if the data ends first.
+ */
+bool getBytes(const string & in, size_t & pos, int bytes, uint64_t & n) {
+	if (in.size() - pos < (size_t)bytes)
+		return false;
+	n = 0;
+	for (int i = 0; i < bytes; i++)
+		n |= (uint64_t)(unsigned char)in[pos + i] << (8 * i);
+	pos += bytes;
+	return true;
+}
+
+/*
+ * Helper function that reads a string written as its length (4 bytes) and
+ * its chars at pos, and moves pos past it. It returns false if the data
+ * ends first.
+ */
+bool readText(const string & in, size_t & pos, string & text) {
+	uint64_t length;
+	if (!getBytes(in, pos, 4, length) || in.size() - pos < length)
+		return false;
+	text.assign(in, pos, length);
+	pos += length;
+	return true;
+}
+
+/*
+ * Constructor that sets up an empty cache.
+ */
+TreeCache::TreeCache() {
+	stats.hits = 0;
+	stats.misses = 0;
+	stats.loaded = 0;
+	stats.validated = 0;
+	stats.rejected = 0;
+}
+
+/*
+ * Destructor that deletes every tree.
+ */
+TreeCache::~TreeCache() {
+	clear();
+}
+
+/*
+ * Returns the tree of the expression e.
+ *
+ * Algorithm:
+ * If e is in the cache and built, return its tree.
+ * Else build a tree without holding the lock, so threads parse at the same
+ * time: if e was loaded, from its indexed prefix form, keeping it if the
+ * hash of what comes out is the one that was saved with it. If e wasn't
+ * loaded, or the tree was thrown away, parse e. If parsing throws, nothing
+ * has been added to the cache.
+ * Then look e up again under the lock. If another thread built it
+ * meanwhile, throw this tree away and return that one, else store it.
+ * Hits and misses are also counted in Metrics, if it is enabled.
+ */
+const ExprTree & TreeCache::get(const string & e) {
+	bool loaded = false;
+	string encoded;
+	uint64_t hash = 0;
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		std::unordered_map<string, Entry>::iterator found = entries.find(e);
+		if (found == entries.end()) {
+			stats.misses++;
+			if (Metrics::enabled())
+				Metrics::add(Metrics::CacheMisses);
+		} else {
+			stats.hits++;
+			if (Metrics::enabled())
+				Metrics::add(Metrics::CacheHits);
+			if (found->second.tree != NULL)
+				return *found->second.tree;
+			loaded = true;
+			encoded = found->second.encoded;
+			hash = found->second.hash;
+		}
+	}
+
+	ExprTree * built = NULL;
+	bool valid = false;
+	if (loaded) {
+		built = new ExprTree(encoded.empty() ? NULL : IndexedPrefix::toTree(encoded, 0));
+		valid = TreeDiff::hash(built->getRoot()) == hash;
+		if (!valid) {
+			delete built;
+			built = NULL;
+		}
+	}
+	if (built == NULL) {
+		TreeNode * root = ExprTree::buildTree(ExprTree::tokenise(e)).release();
+		built = new ExprTree(root);
+	}
+
+	std::unique_lock<std::mutex> guard(lock);
+	Entry & entry = entries[e];
+	if (entry.tree != NULL) {
+		delete built;
+		return *entry.tree;
+	}
+	if (loaded && valid)
+		stats.validated++;
+	else if (loaded)
+		stats.rejected++;
+	entry.tree = built;
+	string().swap(entry.encoded);
+	return *entry.tree;
+}
+
+/*
+ * Writes every expression in the cache, with its tree, to the file at
+ * path.
+ * The format is the magic line, the version (4 bytes) and the number of
+ * expressions (8 bytes), then for each one its text and indexed prefix
+ * form (each a 4 byte length and the chars) and the hash of its tree
+ * (8 bytes), then the checksum of all of that (8 bytes).
+ * The file is written under another name and then renamed, so a process
+ * that loads it never sees half a file.
+ */
+bool TreeCache::save(const string & path) {
+	string out = cacheMagic;
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		putBytes(out, version, 4);
+		putBytes(out, entries.size(), 8);
+		for (std::unordered_map<string, Entry>::iterator i = entries.begin(); i != entries.end(); ++i) {
+			const Entry & entry = i->second;
+			string encoded = entry.tree == NULL ? entry.encoded :
+				entry.tree->isEmpty() ? "" : IndexedPrefix::write(*entry.tree);
+			uint64_t hash = entry.tree == NULL ? entry.hash : TreeDiff::hash(entry.tree->getRoot());
+			putBytes(out, i->first.size(), 4);
+			out += i->first;
+			putBytes(out, encoded.size(), 4);
+			out += encoded;
+			putBytes(out, hash, 8);
+		}
+	}
+	putBytes(out, cacheChecksum(out, out.size()), 8);
+
+	string temporary = path + ".tmp";
+	{
+		std::ofstream file(temporary.c_str(), std::ios::binary | std::ios::trunc);
+		if (!file.write(out.data(), out.size()))
+			return false;
+	}
+	return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+/*
+ * Reads the file at path and adds the expressions in it that aren't in the
+ * cache, without building their trees (see get).
+ * The whole file is checked (magic line, version, checksum, and that every
+ * entry is complete) before anything is added.
+ */
+bool TreeCache::load(const string & path) {
+	std::ifstream file(path.c_str(), std::ios::binary);
+	if (!file)
+		return false;
+	std::stringstream contents;
+	contents << file.rdbuf();
+	string in = contents.str();
+
+	size_t pos = cacheMagic.size();
+	uint64_t fileVersion, count, checksum;
+	if (in.size() < cacheMagic.size() + 20 || in.compare(0, cacheMagic.size(), cacheMagic) != 0)
+		return false;
+	if (!getBytes(in, pos, 4, fileVersion) || fileVersion != version)
+		return false;
+	size_t end = in.size() - 8;
+	if (!getBytes(in, end, 8, checksum) || checksum != cacheChecksum(in, in.size() - 8))
+		return false;
+	in.resize(in.size() - 8);
+
+	vector<std::pair<string, Entry> > read;
+	if (!getBytes(in, pos, 8, count))
+		return false;
+	for (uint64_t i = 0; i < count; i++) {
+		std::pair<string, Entry> item;
+		item.second.tree = NULL;
+		if (!readText(in, pos, item.first) || !readText(in, pos, item.second.encoded) ||
+			!getBytes(in, pos, 8, item.second.hash))
+			return false;
+		read.push_back(item);
+	}
+	if (pos != in.size())
+		return false;
+
+	std::unique_lock<std::mutex> guard(lock);
+	for (size_t i = 0; i < read.size(); i++) {
+		if (entries.insert(read[i]).second)
+			stats.loaded++;
+	}
+	return true;
+}
+
+/*
+ * Deletes every tree and empties the cache. Trees returned by get are no
+ * longer valid after this.
+ */
+void TreeCache::clear() {
+	std::unique_lock<std::mutex> guard(lock);
+	for (std::unordered_map<string, Entry>::iterator i = entries.begin(); i != entries.end(); ++i)
+		delete i->second.tree;
+	entries.clear();
+}
+
+/*
+ * Returns the number of expressions in the cache.
+ */
+int TreeCache::size() {
+	std::unique_lock<std::mutex> guard(lock);
+	return entries.size();
+}
+
+/*
+ * Returns a copy of the counts so far.
+ */
+TreeCache::Stats TreeCache::getStats() {
+	std::unique_lock<std::mutex> guard(lock);
+	return stats;
+}
@@ -0,0 +1,77 @@
+#ifndef TREECACHE_H
+#define TREECACHE_H
+
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <stdint.h>
+
+#include "ExprTree.h"
+
+/*
+ * A cache of parsed trees, by the text of their expression, that can be
+ * saved to a file and loaded again, e.g. when a process restarts, so the
+ * expressions it had parsed don't all have to be parsed again.
+ *
+ * The file has a version number and a checksum, and a file with the wrong
+ * version or checksum isn't loaded at all. Each tree is kept in the file in
+ * indexed prefix form (see IndexedPrefix) with its structural hash (see
+ * TreeDiff::hash). Loading only reads the file: each tree is built the
+ * first time it is asked for, and if its hash doesn't match then (e.g. a
+ * custom operator was registered in a different order, so it has a
+ * different Operator value), the expression is parsed again instead.
+ *
+ * It is safe to use from several threads at once, and they parse without
+ * holding its lock. Trees are never removed, except by clear(), so the
+ * trees it returns stay valid until then.
+ */
+class TreeCache{
+
+ public:
+
+  static const uint32_t version = 1; //Goes up whenever the file format changes.
+
+  /*
+   * Counts of what the cache has done so far.
+   */
+  struct Stats{
+    long hits; //Trees asked for that were in the cache.
+    long misses; //Trees asked for that had to be parsed.
+    long loaded; //Trees read from files.
+    long validated; //Loaded trees that were built and matched their hash.
+    long rejected; //Loaded trees that didn't, and were parsed again.
+  };
+
+  TreeCache();
+  ~TreeCache();
+  const ExprTree & get(const string &); //Returns the tree of an expression, parsing it if it isn't in the cache.
+                                        //Throws std::invalid_argument, and adds nothing, if it can't be parsed.
+  bool save(const string &); //Writes the cache to a file. Returns false if it can't.
+  bool load(const string &); //Adds the trees in a file that aren't in the cache. Returns false, and adds
+                             //nothing, if the file can't be read or has the wrong version or checksum.
+  void clear(); //Deletes every tree.
+  int size(); //The number of expressions in the cache.
+  Stats getStats();
+
+ private:
+
+  /*
+   * A cached expression. Until a loaded one is first asked for, it only
+   * has its indexed prefix form and hash from the file.
+   */
+  struct Entry{
+    ExprTree * tree; //NULL until it is built.
+    string encoded;
+    uint64_t hash;
+  };
+
+  std::unordered_map<string, Entry> entries;
+  Stats stats;
+  std::mutex lock; //Guards everything above.
+
+  TreeCache(const TreeCache &); //Not copyable.
+  TreeCache & operator=(const TreeCache &);
+
+};
+
+#endif
@@ -0,0 +1,197 @@
+#include "TreeDiff.h"
+
+/*
+ * Helper function that scrambles the bits of x, so that inputs that are
+ * close together give hashes that are far apart (the splitmix64 finaliser).
+ */
+uint64_t scramble(uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+/*
+ * Helper function that hashes a variable name (FNV-1a). It is spelled out
+ * rather than using std::hash so that hashes are the same in every run of
+ * the program and can be saved.
+ */
+uint64_t hashName(const string & name) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (string::const_iterator c = name.begin(); c != name.end(); ++c) {
+		h ^= (unsigned char)(*c);
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/*
+ * Helper function that works out the hash of a node from its own contents
+ * and the hashes of its children (0 for a missing child). The left and
+ * right children are mixed in differently, so a - b and b - a differ.
+ */
+uint64_t combineHash(const TreeNode * n, uint64_t left, uint64_t right) {
+	uint64_t h = scramble(n->getOperator() + 1);
+	if (n->isValue())
+		h = scramble(h ^ (uint32_t)n->getValue());
+	else if (n->isVariable())
+		h = scramble(h ^ hashName(n->getName()));
+	h = scramble(h + left * 0x9e3779b97f4a7c15ULL);
+	return scramble(h ^ (right + 0x632be59bd9b4e019ULL));
+}
+
+/*
+ * Recursive function that adds the subtree at n to f in prefix order and
+ * returns its hash.
+ * Deferred nodes are materialised as they are reached, so a group is
+ * hashed by what is in it.
+ */
+uint64_t TreeDiff::flatten(TreeNode * n, Flat & f) {
+	ExprTree::materialise(n);
+	int i = f.nodes.size();
+	f.nodes.push_back(n);
+	f.hashes.push_back(0);
+	f.sizes.push_back(0);
+	uint64_t left = n->getLeftChild() == NULL ? 0 : flatten(n->getLeftChild(), f);
+	uint64_t right = n->getRightChild() == NULL ? 0 : flatten(n->getRightChild(), f);
+	f.hashes[i] = combineHash(n, left, right);
+	f.sizes[i] = f.nodes.size() - i;
+	return f.hashes[i];
+}
+
+/*
+ * Returns the structural hash of the subtree at n, or 0 if n is NULL.
+ * Deferred nodes are materialised first, as in flatten.
+ */
+uint64_t TreeDiff::hash(const TreeNode * n) {
+	if (n == NULL)
+		return 0;
+	ExprTree::materialise(const_cast<TreeNode *>(n)); //Parsing a Deferred node doesn't change what the tree means.
+	uint64_t left = hash(n->getLeftChild());
+	uint64_t right = hash(n->getRightChild());
+	return combineHash(n, left, right);
+}
+
+/*
+ * Recursive function that compares the subtree at i in a with the subtree
+ * at j in b, which are at the same path, and adds the edits between them
+ * to edits.
+ *
+ * Algorithm:
+ * If the hashes (and sizes) are the same, there is nothing to do.
+ * Else if both are leaves, the leaf changed.
+ * Else if both are operators with the same children missing, the operator
+ * changed if it isn't the same one, and the children are compared in turn.
+ * Else the whole subtree was replaced.
+ */
+void TreeDiff::compare(const Flat & a, int i, const Flat & b, int j, string & path, vector<Edit> & edits) {
+	if (a.hashes[i] == b.hashes[j] && a.sizes[i] == b.sizes[j])
+		return;
+
+	TreeNode * before = a.nodes[i];
+	TreeNode * after = b.nodes[j];
+	bool beforeLeft = before->getLeftChild() != NULL, beforeRight = before->getRightChild() != NULL;
+	bool afterLeft = after->getLeftChild() != NULL, afterRight = after->getRightChild() != NULL;
+	Edit e;
+	e.path = path;
+	e.before = before;
+	e.after = after;
+
+	if (!beforeLeft && !beforeRight && !afterLeft && !afterRight) {
+		e.kind = ChangedLeaf;
+		edits.push_back(e);
+		return;
+	}
+	if ((!beforeLeft && !beforeRight) || beforeLeft != afterLeft || beforeRight != afterRight) {
+		e.kind = ReplacedSubtree;
+		edits.push_back(e);
+		return;
+	}
+
+	if (before->getOperator() != after->getOperator()) {
+		e.kind = ChangedOperator;
+		edits.push_back(e);
+	}
+	if (beforeLeft) {
+		path += 'L';
+		compare(a, i + 1, b, j + 1, path, edits);
+		path.erase(path.size() - 1);
+	}
+	if (beforeRight) {
+		int leftA = beforeLeft ? a.sizes[i + 1] : 0;
+		int leftB = afterLeft ? b.sizes[j + 1] : 0;
+		path += 'R';
+		compare(a, i + 1 + leftA, b, j + 1 + leftB, path, edits);
+		path.erase(path.size() - 1);
+	}
+}
+
+/*
+ * Given the roots of two trees, this function returns the edits that turn
+ * the first into the second, in prefix order.
+ */
+vector<TreeDiff::Edit> TreeDiff::diff(TreeNode * before, TreeNode * after) {
+	vector<Edit> edits;
+	if (before == NULL || after == NULL) {
+		if (before != after) {
+			Edit e;
+			e.kind = ReplacedSubtree;
+			e.before = before;
+			e.after = after;
+			edits.push_back(e);
+		}
+		return edits;
+	}
+
+	Flat a, b;
+	flatten(before, a);
+	flatten(after, b);
+	string path;
+	compare(a, 0, b, 0, path, edits);
+	return edits;
+}
+
+/*
+ * Applies edits made by diff(...) to the tree at root, which must be the
+ * same as the first tree given to diff(...) (e.g. a copy of it), and
+ * returns the root afterwards. Changed and replaced subtrees are copied
+ * from the second tree, and the nodes they replace are deleted. A changed
+ * operator gets a new node that takes over the old one's children.
+ */
+TreeNode * TreeDiff::patch(TreeNode * root, const vector<Edit> & edits) {
+	for (vector<Edit>::const_iterator e = edits.begin(); e != edits.end(); ++e) {
+		TreeNode * parent = NULL;
+		TreeNode * n = root;
+		for (string::const_iterator step = e->path.begin(); step != e->path.end(); ++step) {
+			parent = n;
+			n = *step == 'L' ? n->getLeftChild() : n->getRightChild();
+		}
+
+		TreeNode * replacement;
+		if (e->kind == ChangedOperator) {
+			replacement = new TreeNode(e->after->getOperator());
+			replacement->setLeftChild(n->getLeftChild());
+			replacement->setRightChild(n->getRightChild());
+			if (n->getLeftChild() != NULL)
+				n->getLeftChild()->setParent(replacement);
+			if (n->getRightChild() != NULL)
+				n->getRightChild()->setParent(replacement);
+			delete n;
+		} else {
+			replacement = ExprTree::copySubtree(e->after);
+			ExprTree::freeSubtree(n);
+		}
+
+		if (parent == NULL)
+			root = replacement;
+		else if (e->path[e->path.size() - 1] == 'L')
+			parent->setLeftChild(replacement);
+		else
+			parent->setRightChild(replacement);
+		if (replacement != NULL)
+			replacement->setParent(parent);
+	}
+	return root;
+}
@@ -0,0 +1,69 @@
+#ifndef TREEDIFF_H
+#define TREEDIFF_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+#include "ExprTree.h"
+
+/*
+ * Works out what changed between two versions of an expression tree, as a
+ * list of edits that turn the first into the second, so that things built
+ * from the first (caches, compiled forms) can be patched instead of built
+ * again.
+ *
+ * Every subtree gets a structural hash, worked out bottom up from its
+ * operator, its number or name and the hashes of its children, so two
+ * subtrees with the same hash are the same expression (with a 64 bit hash,
+ * a clash is too unlikely to worry about). The two trees are then walked
+ * together from the root, and subtrees in the same position with the same
+ * hash are skipped without looking inside. Each tree is walked once, so
+ * this takes linear time.
+ */
+class TreeDiff{
+
+ public:
+
+  enum Kind {ChangedLeaf, //A number or variable became a different number or variable.
+             ChangedOperator, //An operator became another one with the same number of operands,
+                              //which may have edits of their own.
+             ReplacedSubtree}; //Anything else, e.g. a number became a whole subtree.
+
+  /*
+   * One edit: what it is, where it is, as a path of "L" and "R" steps from
+   * the root (like IndexedPrefix::find), and the subtrees at that place in
+   * the two trees. The subtrees belong to the trees that were compared.
+   */
+  struct Edit{
+    Kind kind;
+    string path;
+    TreeNode * before;
+    TreeNode * after;
+  };
+
+  static uint64_t hash(const TreeNode *); //Returns the structural hash of a subtree (0 for NULL).
+  static vector<Edit> diff(TreeNode *, TreeNode *); //Returns the edits from the first tree to the second,
+                                                    //in prefix order, or none if they are the same.
+  static TreeNode * patch(TreeNode *, const vector<Edit> &); //Applies edits to a tree like the first one
+                                                             //and returns its root, which may be new.
+
+ private:
+
+  /*
+   * The nodes of a tree in prefix order, with the hash and size of the
+   * subtree at each one, so the children of the node at i are at i + 1
+   * and i + 1 + (the size of the left one).
+   */
+  struct Flat{
+    vector<TreeNode *> nodes;
+    vector<uint64_t> hashes;
+    vector<int> sizes;
+  };
+
+  static uint64_t flatten(TreeNode *, Flat &);
+  static void compare(const Flat &, int, const Flat &, int, string &, vector<Edit> &);
+
+};
+
+#endif
@@ -0,0 +1,129 @@
+#include "TreeIterator.h"
+
+/*
+ * Constructor that sets up an iterator at the end of a traversal.
+ */
+TreeIterator::TreeIterator() {
+	order = Preorder;
+	current = NULL;
+	head = 0;
+}
+
+/*
+ * Constructor that sets up an iterator at the first node of the tree with
+ * the given root, in the given order:
+ * the root itself for preorder and level order,
+ * the end of the path of left children from the root for inorder,
+ * and the first leaf (going left where it can, else right) for postorder.
+ */
+TreeIterator::TreeIterator(TreeNode * root, Order order) {
+	this->order = order;
+	head = 0;
+	pending.reserve(32);
+	if (root == NULL || order == Preorder || order == LevelOrder)
+		current = root;
+	else if (order == Inorder) {
+		pushLeftPath(root);
+		current = pop();
+	}
+	else {
+		pushLeafPath(root);
+		current = pop();
+	}
+}
+
+/*
+ * Pushes n and its left child, and its left child, and so on.
+ */
+void TreeIterator::pushLeftPath(TreeNode * n) {
+	for (; n != NULL; n = n->getLeftChild())
+		pending.push_back(n);
+}
+
+/*
+ * Pushes n and its first child (the left one, or the right one if there is
+ * no left one), and its first child, and so on down to a leaf.
+ */
+void TreeIterator::pushLeafPath(TreeNode * n) {
+	while (n != NULL) {
+		pending.push_back(n);
+		n = n->getLeftChild() != NULL ? n->getLeftChild() : n->getRightChild();
+	}
+}
+
+/*
+ * Takes the next node off the stack (or the queue, for level order), or
+ * returns NULL if there are none left.
+ */
+TreeNode * TreeIterator::pop() {
+	if (order == LevelOrder) {
+		if (head == pending.size()) {
+			pending.clear();
+			head = 0;
+			return NULL;
+		}
+		//Now and then the queue is moved back to the start, so it stays about as big as the widest level.
+		if (head >= 1024 && head * 2 >= pending.size()) {
+			pending.erase(pending.begin(), pending.begin() + head);
+			head = 0;
+		}
+		return pending[head++];
+	}
+	if (pending.empty())
+		return NULL;
+	TreeNode * n = pending.back();
+	pending.pop_back();
+	return n;
+}
+
+/*
+ * Moves on to the next node.
+ *
+ * Algorithm:
+ * Preorder: push the right child and then the left child of the current
+ * node, and take the top of the stack, so the left subtree comes first.
+ * Inorder: the stack holds the nodes whose left subtree is being visited.
+ * Push the left path of the right child, and take the top of the stack.
+ * Postorder: the stack holds the ancestors of the current node. If the
+ * current node is the left child of the top one, and it has a right child,
+ * push the path to the first leaf of that. Take the top of the stack.
+ * Level order: add the children of the current node to the back of the
+ * queue, and take the front of it.
+ */
+TreeIterator & TreeIterator::operator++() {
+	if (current == NULL)
+		return *this;
+	switch (order) {
+	case Preorder:
+		if (current->getRightChild() != NULL)
+			pending.push_back(current->getRightChild());
+		if (current->getLeftChild() != NULL)
+			pending.push_back(current->getLeftChild());
+		break;
+	case Inorder:
+		pushLeftPath(current->getRightChild());
+		break;
+	case Postorder:
+		if (!pending.empty() && pending.back()->getLeftChild() == current)
+			pushLeafPath(pending.back()->getRightChild());
+		break;
+	case LevelOrder:
+		if (current->getLeftChild() != NULL)
+			pending.push_back(current->getLeftChild());
+		if (current->getRightChild() != NULL)
+			pending.push_back(current->getRightChild());
+		break;
+	}
+	current = pop();
+	return *this;
+}
+
+/*
+ * Moves on to the next node and returns a copy of the iterator from
+ * before. The copy has its own stack, so ++i is cheaper.
+ */
+TreeIterator TreeIterator::operator++(int) {
+	TreeIterator before = *this;
+	++(*this);
+	return before;
+}
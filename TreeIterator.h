@@ -0,0 +1,76 @@
+#ifndef TREEITERATOR_H
+#define TREEITERATOR_H
+
+#include <vector>
+#include <iterator>
+#include <cstddef>
+
+#include "TreeNode.h"
+
+/*
+ * Visits the nodes of a tree one at a time in preorder, inorder, postorder
+ * or level order, without recursion, so it works on trees of any depth.
+ *
+ * The nodes still to come are kept on a stack (a queue, for level order)
+ * inside the iterator, which is reused from step to step, so a step doesn't
+ * allocate once the stack is as big as the tree is deep (wide, for level
+ * order). Parent pointers aren't used, since not every tree has them set.
+ * Unary operators have only a left child, and Deferred nodes are leaves
+ * (see ExprTree::materialiseAll). Inorder is left subtree, node, right
+ * subtree, so a unary operator comes after its operand.
+ *
+ * Use it through a TreeRange, e.g.
+ *   for (TreeNode * n : t.postorder()) ...
+ */
+class TreeIterator{
+
+ public:
+
+  enum Order {Preorder, Inorder, Postorder, LevelOrder};
+
+  typedef std::forward_iterator_tag iterator_category;
+  typedef TreeNode * value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef TreeNode * const * pointer;
+  typedef TreeNode * const & reference;
+
+  TreeIterator(); //The end of every traversal.
+  TreeIterator(TreeNode *, Order); //The first node of the tree with the given root, in the given order.
+  reference operator*() const { return current; }
+  TreeIterator & operator++();
+  TreeIterator operator++(int);
+  bool operator==(const TreeIterator & other) const { return current == other.current; }
+  bool operator!=(const TreeIterator & other) const { return current != other.current; }
+
+ private:
+
+  Order order;
+  TreeNode * current; //NULL at the end.
+  std::vector<TreeNode *> pending; //The stack, or for level order the queue, of nodes still to come.
+  size_t head; //For level order, where the queue starts in pending.
+
+  void pushLeftPath(TreeNode *);
+  void pushLeafPath(TreeNode *);
+  TreeNode * pop();
+
+};
+
+/*
+ * The nodes of a tree in one order, for use with range-based for.
+ */
+class TreeRange{
+
+ public:
+
+  TreeRange(TreeNode * root, TreeIterator::Order order) : root(root), order(order) {}
+  TreeIterator begin() const { return TreeIterator(root, order); }
+  TreeIterator end() const { return TreeIterator(); }
+
+ private:
+
+  TreeNode * root;
+  TreeIterator::Order order;
+
+};
+
+#endif
@@ -1,7 +1,18 @@
 #include "TreeNode.h"
+#include "OperatorRegistry.h"
+#include "NodeArena.h"
+#include "Metrics.h"
+
+/*
+ * Every node has a header in front of it that says whether it came from a
+ * NodeArena, so delete knows whether to free it. It is a whole alignment
+ * unit, so the node after it stays aligned.
+ */
+const size_t nodeHeader = alignof(std::max_align_t);
 
 TreeNode::TreeNode(Operator o){
   op = o;
+  deferred = 0;
   parent = 0;
   leftChild = 0;
   rightChild = 0;
@@ -10,16 +21,59 @@ TreeNode::TreeNode(Operator o){
 TreeNode::TreeNode(int val){
   op = Value;
   value = val;
+  deferred = 0;
+  parent = 0;
+  leftChild = 0;
+  rightChild = 0;
+}
+
+TreeNode::TreeNode(const std::string & n){
+  op = Variable;
+  value = 0;
+  name = n;
+  deferred = 0;
   parent = 0;
   leftChild = 0;
   rightChild = 0;
 }
 
+TreeNode::TreeNode(DeferredGroup * d){
+  op = Deferred;
+  value = 0;
+  deferred = d;
+  parent = 0;
+  leftChild = 0;
+  rightChild = 0;
+}
+
+TreeNode::~TreeNode(){ delete deferred; }
+
+void * TreeNode::operator new(size_t size){
+  NodeArena * arena = NodeArena::current();
+  char * block = (char *)(arena == NULL ? ::operator new(size + nodeHeader) : arena->allocate(size + nodeHeader));
+  *(bool *)block = arena != NULL;
+  if (Metrics::enabled()){
+    Metrics::add(Metrics::NodesBuilt);
+    Metrics::add(Metrics::BytesAllocated, size + nodeHeader);
+  }
+  return block + nodeHeader;
+}
+
+void TreeNode::operator delete(void * p){
+  if (p == NULL)
+    return;
+  if (Metrics::enabled())
+    Metrics::add(Metrics::NodesFreed);
+  char * block = (char *)p - nodeHeader;
+  if (!*(bool *)block)
+    ::operator delete(block);
+}
+
 void TreeNode::setParent(TreeNode * p){ parent = p; }
 
 void TreeNode::setLeftChild(TreeNode * l){
 
-  if (op != Value){
+  if (op != Value && op != Variable){
     leftChild = l;
   }
 
@@ -27,27 +81,57 @@ void TreeNode::setLeftChild(TreeNode * l){
 
 void TreeNode::setRightChild(TreeNode * r){
 
-  if (op != Value){
+  if (op != Value && op != Variable){
     rightChild = r;
   }
 
 }
 
-TreeNode * TreeNode::getParent(){ return parent; }
+TreeNode * TreeNode::getParent() const{ return parent; }
   
-TreeNode * TreeNode::getLeftChild(){ return leftChild; }
+TreeNode * TreeNode::getLeftChild() const{ return leftChild; }
+
+TreeNode * TreeNode::getRightChild() const{ return rightChild; }
+
+int TreeNode::getValue() const{ return value; }
+
+const std::string & TreeNode::getName() const{ return name; }
+
+DeferredGroup * TreeNode::getDeferred() const{ return deferred; }
+
+void TreeNode::takeOver(TreeNode * other){
 
-TreeNode * TreeNode::getRightChild(){ return rightChild; }
+  delete deferred;
+  op = other->op;
+  value = other->value;
+  name = other->name;
+  deferred = other->deferred;
+  leftChild = other->leftChild;
+  rightChild = other->rightChild;
+  if (leftChild != 0)
+    leftChild->setParent(this);
+  if (rightChild != 0)
+    rightChild->setParent(this);
 
-int TreeNode::getValue(){ return value; }
+  other->deferred = 0;
+  other->leftChild = 0;
+  other->rightChild = 0;
 
-Operator TreeNode::getOperator(){ return op; }
+}
+
+Operator TreeNode::getOperator() const{ return op; }
+
+bool TreeNode::isValue() const{ return op == Value; }
+
+bool TreeNode::isVariable() const{ return op == Variable; }
 
-bool TreeNode::isValue(){ return op == Value; }
+bool TreeNode::isOperator() const{ return op != Value && op != Variable && op != Deferred && op != NoOp; }
 
-bool TreeNode::isOperator(){ return op != Value && op != NoOp; }
+bool TreeNode::isFunction() const{ return OperatorRegistry::get(op).notation == Function; }
 
-std::string TreeNode::toString(){
+bool TreeNode::isUnary() const{ return OperatorRegistry::get(op).arity == 1; }
+
+std::string TreeNode::toString() const{
 
   if (isValue()){
 
@@ -57,14 +141,10 @@ std::string TreeNode::toString(){
     
   }
 
-  switch (op){
-
-  case Value : return "val";
-  case Plus : return "+";
-  case Minus : return "-";
-  case Times : return "*";
-  case Divide : return "/";
-  case NoOp : return "";
+  if (isVariable()){
+    return name;
   }
 
+  return OperatorRegistry::get(op).symbol;
+
 }
@@ -3,6 +3,9 @@
 
 #include <string>
 #include <sstream>
+#include <vector>
+#include <memory>
+#include <cstddef>
 
 /*
  * An enum is just a list of names or labels, so in this
@@ -11,8 +14,36 @@
  * enums are implemented is actually a bit janky, but useful enough
  * for this case).
  * See the test files for examples of use.
+ *
+ * The conditional c ? a : b is stored as a Conditional node with the
+ * condition c as its left child and an Alternative node holding a and b
+ * as its right child, so every operator still has at most two children.
+ *
+ * Variable is a leaf like Value, but it stores a name and only gets its
+ * number when the expression is evaluated.
+ *
+ * Deferred is a stand-in for a parenthesised group that hasn't been parsed
+ * yet (see ExprTree::buildLazyTree). It turns into the group's subtree the
+ * first time it is evaluated or written out.
+ *
+ * The values after NoOp, up to LastOperator, are given out to custom
+ * operators by OperatorRegistry::registerOperator(...).
  */
-enum Operator {Value, Plus, Minus, Times, Divide, NoOp};
+enum Operator {Value, Plus, Minus, Times, Divide, Power, Modulo, Min, Max, Abs, Negate,
+               Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual, And, Or,
+               Conditional, Alternative, Variable, Deferred, NoOp, LastOperator = 255};
+
+/*
+ * The tokens of a group that a Deferred node stands for. The token list
+ * and the index of matching parentheses are shared by all the Deferred
+ * nodes made from the same expression.
+ */
+struct DeferredGroup {
+  std::shared_ptr<const std::vector<std::string> > tokens;
+  std::shared_ptr<const std::vector<int> > matches; //The position of the matching parenthesis of each parenthesis token.
+  int first; //The first token inside the parentheses.
+  int last; //The close parenthesis.
+};
 
 class TreeNode {
 
@@ -22,6 +53,8 @@ class TreeNode {
                //It can take values from the Operator enum (i.e. Plus, Minus, etc.)
                //If it represents a value, use the Value value. :D
   int value; //If this node stores an actual number, this is it.
+  std::string name; //If this node is a variable, this is its name.
+  DeferredGroup * deferred; //If this node is Deferred, these are the tokens it stands for.
 
   TreeNode * parent; //Pointer to the parent.
   TreeNode * leftChild; //Pointer to the left child of this node.
@@ -29,21 +62,34 @@ class TreeNode {
 
  public:
 
-  TreeNode(Operator); //Constructor to use for +, -, * and /.
+  TreeNode(Operator); //Constructor to use for operators, e.g. +, -, *, /, ^, <, &&, ?.
                       //Example: TreeNode(Plus);
   TreeNode(int); //Constructor to use for actual numbers.
                  //Example: TreeNode(5);
+  TreeNode(const std::string &); //Constructor to use for variables.
+                                 //Example: TreeNode("x");
+  TreeNode(DeferredGroup *); //Constructor for Deferred nodes, which take over the DeferredGroup.
+  ~TreeNode(); //Deletes the DeferredGroup, if there is one. It doesn't delete the children.
+  static void * operator new(size_t); //Allocates from the thread's NodeArena, if it has one, else the heap.
+  static void operator delete(void *); //Frees heap nodes. Arena nodes are freed with the whole arena.
   void setParent(TreeNode *); //Set the parent pointer.
   void setLeftChild(TreeNode *); //Set the left child pointer.
   void setRightChild(TreeNode *); //Set the right child pointer.
-  TreeNode * getParent(); //Get the parent pointer.
-  TreeNode * getLeftChild(); //Get the left child pointer.
-  TreeNode * getRightChild(); //Get the right child pointer.
-  int getValue(); //Returns the stored value;
-  Operator getOperator(); //Returns the stored operator.
-  bool isValue(); //Returns true if this node is a Value node.
-  bool isOperator(); //Returns true if this node is Plus, Minus, Times or Divide node.
-  std::string toString(); //Returns a simple string representation of the node.
+  TreeNode * getParent() const; //Get the parent pointer.
+  TreeNode * getLeftChild() const; //Get the left child pointer.
+  TreeNode * getRightChild() const; //Get the right child pointer.
+  int getValue() const; //Returns the stored value;
+  const std::string & getName() const; //Returns the name of a Variable node.
+  DeferredGroup * getDeferred() const; //Returns the tokens of a Deferred node.
+  void takeOver(TreeNode *); //Makes this node the same as another one, children and all, leaving
+                             //the other one empty, so a node can be replaced without touching its parent.
+  Operator getOperator() const; //Returns the stored operator.
+  bool isValue() const; //Returns true if this node is a Value node.
+  bool isVariable() const; //Returns true if this node is a Variable node.
+  bool isOperator() const; //Returns true if this node is any operator node (i.e. not Value, Variable, Deferred or NoOp).
+  bool isFunction() const; //Returns true if this node is written with function-call syntax (min, max, abs).
+  bool isUnary() const; //Returns true if this operator takes a single operand (stored as the left child), i.e. abs or neg.
+  std::string toString() const; //Returns a simple string representation of the node.
   
 };
 